@@ -0,0 +1,311 @@
+/*
+Motor calibration from encoder feedback: minimum PWM, start pulse and
+braking time, measured on the robot and kept in EEPROM.
+
+_minPWM, the start pulse and _decel are otherwise guesses given to the
+constructor.  Too low, and the motor stalls at low speed commands, or
+does not get going; too high, and it lurches, or waits out brake
+windows longer than it takes to stop.  MotorCalibration<MOTOR,ENC>
+finds them for one motor, as a state machine run from update() every
+motor tick, with the motor's own stop and start logic:
+
+  1. breakaway: from rest, the PWM steps up by one every CAL_STEP_MS,
+     with no start pulse, until the encoder moves
+  2. minimum PWM: then steps down every CAL_SLOW_STEP_MS, until the
+     motor stalls.  Sliding friction is less than stiction, so this is
+     lower.  _minPWM is the lowest step that kept it moving, plus
+     CAL_MIN_MARGIN
+  3. start pulse: from rest, starts at the new _minPWM with a start
+     pulse 0, 1, 2 ... ms long, until CAL_TRIALS starts in a row get
+     the motor going.  The pulse is set half as long again
+  4. braking: after CAL_RUN_MS at full speed, brakes, and times the
+     encoder to a stop.  _decel allows a quarter more
+
+Between tests it waits for the motor to brake to a standstill.  "The
+encoder moves" is CAL_MOVE_COUNTS counts over the second half of a
+step, so the slowing from the step before is not counted.  Each
+result is logged to Tel, and at the end the three are written to
+EEPROM at the address given (CALIBRATION_RECORD_LEN bytes), for load()
+at the next boot.  abort() puts the motor's settings back as they were.
+
+Current sense is no help here: it sees drive current, not motion, and
+nothing at all while the motor coasts or brakes in some drivers.
+
+The robot drives itself a short way forward in steps 1 and 3, and at
+full speed in 4: give it room.
+
+provided under LGPL license
+*/
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+#include <EEPROM.h>
+#include "MotorDriveCore.h"
+
+#define CAL_STEP_MS      100  // per PWM step up
+#define CAL_SLOW_STEP_MS 300  // and down: near the threshold it slows to a stall slowly
+#define CAL_MOVE_COUNTS    4  // counts in the second half of a step: moving
+#define CAL_STILL_MS     100  // no counts this long: stopped
+#define CAL_MIN_MARGIN     2  // PWM counts over the lowest that kept moving
+#define CAL_TRIAL_MS     300  // a start pulse trial
+#define CAL_TRIALS         3  // starts in a row, for a pulse to be reliable
+#define CAL_KICK_MAX_MS  100  // longest start pulse tried
+#define CAL_RUN_MS      1000  // at full speed, before the braking test
+
+// stages, also the value of TEL_CAL_FAILED
+#define CAL_IDLE       0
+#define CAL_SETTLE     1  // braking to a standstill, then _next
+#define CAL_BREAKAWAY  2
+#define CAL_RUNNING    3
+#define CAL_KICK       4
+#define CAL_STOP_RUN   5
+#define CAL_STOP_BRAKE 6
+
+#define CALIBRATION_MAGIC 0xC5
+
+struct CalibrationRecord
+{
+  byte magic;              // CALIBRATION_MAGIC when written
+  byte minPWM;
+  unsigned short startMs;  // start pulse
+  unsigned short decel;    // ms per PWM count, Q8 (see setDecelRate())
+  byte check;              // ~sum of the fields above
+
+  byte sum() const
+  {
+    return(~(byte)(magic + minPWM + (byte)startMs + (byte)(startMs >> 8) +
+                   (byte)decel + (byte)(decel >> 8)));
+  }
+};
+
+#define CALIBRATION_RECORD_LEN sizeof(CalibrationRecord)
+
+template<class MOTOR, class ENC>
+class MotorCalibration
+{
+public:
+  MOTOR &Mot;
+  ENC &Enc;
+  int _addr;           // of the EEPROM record
+  byte _stage, _next;  // _next: stage to enter once settled
+  byte _pwm;           // driven now
+  byte _kick;          // ms, start pulse on trial
+  byte _trial;         // starts in a row at _kick
+  bool _snap;          // _count taken at half the step
+  Deadline _step;      // of the driving stages
+  long _count;         // encoder, at half the step, or when it last moved
+  uint32_t _moved;     // ticks, when the encoder last moved
+  uint32_t _braked;    // ticks, when the braking test braked
+  // the motor's settings before start(), for abort()
+  SHORT _minPWM0;
+  uint32_t _startup0;
+  unsigned short _decel0, _accel0, _decelRate0;
+
+  MotorCalibration(MOTOR &mot, ENC &enc, const int addr) : Mot(mot), Enc(enc), _addr(addr), _stage(CAL_IDLE) {}
+
+  inline bool running() const { return(_stage != CAL_IDLE); }
+
+  // Apply the record in EEPROM, if there is one.  true if there was
+  bool load()
+  {
+    CalibrationRecord r;
+    EEPROM.get(_addr,r);
+    if ((r.magic != CALIBRATION_MAGIC) || (r.check != r.sum())) return(false);
+    Mot._minPWM = r.minPWM;
+    Mot.setStartPulseDuration(r.startMs);
+    Mot._decel = r.decel;
+    return(true);
+  }
+
+  void start(const uint32_t t)
+  {
+    if (running()) return;
+    _minPWM0 = Mot._minPWM;
+    _startup0 = Mot._startupTime;
+    _decel0 = Mot._decel;
+    _accel0 = Mot._accelRate;
+    _decelRate0 = Mot._decelRate;
+    Mot._minPWM = 1;  // every PWM step drives
+    Mot._accelRate = Mot._decelRate = 0;
+    Mot.setStartPulseDuration(0);
+    settle(t,CAL_BREAKAWAY);
+  }
+
+  // stop, and put the motor's settings back
+  void abort()
+  {
+    if (!running()) return;
+    Tel.log(TEL_CAL_FAILED,Mot._id,_stage);
+    restore();
+    Mot._minPWM = _minPWM0;
+    Mot._startupTime = _startup0;
+    Mot._decel = _decel0;
+    if (Mot._mode & 1) Mot.stop();
+  }
+
+  // every motor tick, in place of Mot.update()
+  void update(const uint32_t t)
+  {
+    switch(_stage)
+      {
+      case CAL_IDLE :
+        Mot.update(t);
+        return;
+      case CAL_SETTLE :
+        Mot.update(t);
+        if (still(t) && stopped(t)) enter(_next,t);
+        return;
+      case CAL_STOP_BRAKE :
+        Mot.update(t);
+        if (still(t)) finish();
+        return;
+      }
+    if (!_step.reached(t))
+      {
+        if (!_snap && (_step.elapsed(t) >= _step.span / 2))
+          {
+            _count = Enc.count();
+            _snap = true;
+          }
+        drive(t);
+        return;
+      }
+    long n = Enc.count() - _count;
+    bool moving = (n >= CAL_MOVE_COUNTS) || (n <= -CAL_MOVE_COUNTS);
+    switch(_stage)
+      {
+      case CAL_BREAKAWAY :
+        if (moving)
+          {
+            Tel.log(TEL_CAL_BREAKAWAY,Mot._id,_pwm);
+            _stage = CAL_RUNNING;
+          }
+        else if (_pwm >= Mot._maxPWM) { abort(); return; }  // no encoder?
+        else _pwm++;
+        break;
+      case CAL_RUNNING :
+        if (moving && (_pwm > 1))
+          {
+            _pwm--;
+            break;
+          }
+        // stalled at _pwm: the step above kept it going
+        Mot._minPWM = _pwm + (moving ? 0 : 1) + CAL_MIN_MARGIN;
+        Tel.log(TEL_CAL_MIN_PWM,Mot._id,Mot._minPWM);
+        _kick = _trial = 0;
+        settle(t,CAL_KICK);
+        return;
+      case CAL_KICK :
+        if (!moving)
+          {
+            _trial = 0;
+            if (++_kick > CAL_KICK_MAX_MS) { abort(); return; }
+          }
+        else if (++_trial >= CAL_TRIALS)
+          {
+            Mot.setStartPulseDuration(_kick + (_kick + 1) / 2);
+            Tel.log(TEL_CAL_START,Mot._id,_kick + (_kick + 1) / 2);
+            settle(t,CAL_STOP_RUN);
+            return;
+          }
+        settle(t,CAL_KICK);
+        return;
+      case CAL_STOP_RUN :
+        Mot.stop();
+        _braked = _moved = t;
+        _count = Enc.count();
+        _stage = CAL_STOP_BRAKE;
+        return;
+      }
+    step(t,(_stage == CAL_RUNNING) ? CAL_SLOW_STEP_MS : CAL_STEP_MS);
+  }
+
+protected:
+  void settle(const uint32_t t, const byte next)
+  {
+    if (Mot._mode & 1) Mot.stop();
+    _stage = CAL_SETTLE;
+    _next = next;
+    _count = Enc.count();
+    _moved = t;
+  }
+
+  void enter(const byte stage, const uint32_t t)
+  {
+    _stage = stage;
+    switch(stage)
+      {
+      case CAL_BREAKAWAY :
+        _pwm = 1;
+        step(t,CAL_STEP_MS);
+        return;
+      case CAL_KICK :
+        Mot.setStartPulseDuration(_kick);
+        _pwm = Mot._minPWM;
+        step(t,CAL_TRIAL_MS);
+        return;
+      case CAL_STOP_RUN :
+        _pwm = Mot._maxPWM;
+        step(t,CAL_RUN_MS);
+        return;
+      }
+  }
+
+  void step(const uint32_t t, const unsigned short ms)
+  {
+    _step.set(t,(uint32_t)ms * MOTOR_TICKS_PER_MS);
+    _snap = false;
+    drive(t);
+  }
+
+  void drive(const uint32_t t)
+  {
+    Mot.setSpeed(_pwm,t);
+    if (Mot._mode & 4) Mot.setSpeed(_pwm,t);  // a 0 ms start pulse ends at once
+  }
+
+  // no encoder count for CAL_STILL_MS
+  bool still(const uint32_t t)
+  {
+    long c = Enc.count();
+    if (c != _count)
+      {
+        _count = c;
+        _moved = t;
+      }
+    return(t - _moved >= (uint32_t)CAL_STILL_MS * MOTOR_TICKS_PER_MS);
+  }
+
+  // braked, and setSpeed() would start it
+  bool stopped(const uint32_t t) const
+  {
+    return((Mot._mode == MOTOR_STOPPED) ||
+           ((Mot._mode == MOTOR_STOPPING) && Mot._done.reached(t)));
+  }
+
+  void finish()
+  {
+    uint32_t ms = (_moved - _braked) / MOTOR_TICKS_PER_MS;
+    Tel.log(TEL_CAL_STOP,Mot._id,ms);
+    // a quarter more than it took, from full speed
+    unsigned long q = ((unsigned long)ms * 320 + Mot._maxPWM - 1) / Mot._maxPWM;
+    Mot._decel = q ? q : 1;
+    restore();
+    CalibrationRecord r;
+    r.magic = CALIBRATION_MAGIC;
+    r.minPWM = Mot._minPWM;
+    r.startMs = Mot._startupTime / MOTOR_TICKS_PER_MS;
+    r.decel = Mot._decel;
+    r.check = r.sum();
+    EEPROM.put(_addr,r);
+  }
+
+  void restore()
+  {
+    Mot._accelRate = _accel0;
+    Mot._decelRate = _decelRate0;
+    _stage = CAL_IDLE;
+  }
+};
+
+#endif
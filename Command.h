@@ -3,14 +3,294 @@ $URL: svn+ssh://aaron@birenboim.com/home/svn/arduino/sketchbook/DalekDrive/Comma
 $Id: Command.h 142 2015-03-23 00:16:34Z aaron $
 
 Command interpreter for serial port
+
+Besides the ASCII commands, like "L-200,R180\n", the reader accepts
+compact binary frames.  ASCII never sets the high bit, so the
+sync byte cannot be mistaken for a command character:
+
+    byte 0 : COMMAND_SYNC
+    byte 1 : opcode<<4 | sign bits  (bit 0: left < 0, bit 1: right < 0)
+    byte 2 : |left|  speed, 0..255
+    byte 3 : |right| speed, 0..255
+    byte 4 : CRC-8 (poly 0x07, init 0) of bytes 1..3
+
+A drive frame is returned as an 'L' command, and the 'R' command
+from the same frame is returned by the next call to get().
+Frames with a bad CRC or unknown opcode are dropped, and counted.
+Long ASCII values saturate at COMMAND_VAL_MAX.
+
+Motor channels are addressed in groups, by bit mask (see MotorBank.h).
+'L' and 'R' set every channel in groupL and groupR (channel 0 and 1 by
+default), "M<mask>" selects a group, and "V<speed>" sets every channel
+in the selected group.  A group frame (COMMAND_OP_GROUP) is the same
+pair, 'M' then 'V':
+
+    byte 1 : opcode<<4 | sign bit (bit 0: speed < 0)
+    byte 2 : channel mask
+    byte 3 : |speed|, 0..255
+
+drain() collects the newest speed per channel in the CommandBatch.
+
+In arcade mode (arcade = true), 'T' (throttle) and 'S' (steer) are
+mixed on board into left and right speeds, which set groupL and groupR
+in the same batch, so both sides change in the same tick.  Each keeps
+its last value, so either may be sent alone; '!' zeroes both.  An
+arcade frame (COMMAND_OP_ARCADE) carries both:
+
+    byte 1 : opcode<<4 | sign bits  (bit 0: throttle < 0, bit 1: steer < 0)
+    byte 2 : |throttle|, 0..255
+    byte 3 : |steer|, 0..255
+
+and is returned as 'T', then 'S'.  See commandMix() for the mixing.
+
+Timed segments (see Segments.h): "J<left>" and "K<right>" set the
+speeds of the next segment, each keeping its last value, and "Q<ms>"
+queues it, to run for ms.  A 'Q' ends the batch, so the caller can
+append every segment, in order.  'F' flushes the queue, and 'q' asks
+for its depth.  commandEncodeSegment() gives the two frames of a
+segment: a segment frame (COMMAND_OP_SEGMENT), laid out as a drive
+frame and returned as 'J', then 'K', and a queue frame:
+
+    byte 1 : opcode<<4
+    byte 2 : ms, high 7 bits
+    byte 3 : ms, low 8 bits
+
+returned as 'Q'.
+
+'o' resets the dead-reckoning pose, and "O<ms>" sets how often it is
+sent, 0 for never (see Odometry.h).  Both are returned as codes.
+
+'k' calibrates the motors (see Calibrate.h), returned as a code.
+
+With PROFILE defined (see Profile.h), each CommandBatch carries the
+micros() time its oldest byte arrived, for latency profiling.
+
+Define COMMAND_RX_ISR before including this file to take received
+bytes straight from the USART RX interrupt into a larger ring buffer,
+instead of polling Serial.read().  The ISR flags an emergency '!' as
+soon as it arrives, even if the reader is behind.
+The Arduino core's HardwareSerial also claims USART_RX_vect, and the
+link fails with both.  This needs a core built without its RX handler
+(HardwareSerial0.cpp with its ISR(USART_RX_vect) taken out), and
+COMMAND_CORE_NO_RX_ISR defined to say so.
+
+A '!' takes effect at its place in a drain(): speeds before it in the
+batch are dropped, and speeds after it are kept, to apply after the
+stop.
 */
 
+#include "Telemetry.h"
+
+#define COMMAND_SYNC     0xA5
+#define COMMAND_OP_DRIVE 1     // left and right speed
+#define COMMAND_OP_GROUP 2     // channel mask and speed
+#define COMMAND_OP_ARCADE 3    // throttle and steer
+#define COMMAND_OP_SEGMENT 4   // left and right speed of the next segment
+#define COMMAND_OP_QUEUE 5     // queue it, for ms
+#define COMMAND_FRAME_LEN 5
+#define COMMAND_VAL_MAX   32767  // ASCII values saturate here (int on AVR)
+#define COMMAND_VAL_DIGITS 5      // digits counted, at most
+#define COMMAND_CHANNELS  8      // motor channels, one bit each in a mask
+
+inline byte commandCRC8(byte crc, byte c)
+{
+  crc ^= c;
+  for (byte b=0; b < 8; b++)
+    crc = (crc & 0x80) ? (byte)((crc << 1) ^ 0x07) : (byte)(crc << 1);
+  return(crc);
+}
+
+// Fill buf with a drive frame (COMMAND_FRAME_LEN bytes).  For the host side.
+// With op COMMAND_OP_ARCADE, left and right are throttle and steer
+inline byte commandEncodeDrive(byte *buf, int left, int right, byte op=COMMAND_OP_DRIVE)
+{
+  if (left  < -255) left  = -255;
+  if (left  >  255) left  =  255;
+  if (right < -255) right = -255;
+  if (right >  255) right =  255;
+  buf[0] = COMMAND_SYNC;
+  buf[1] = (op << 4) | ((left < 0) ? 1 : 0) | ((right < 0) ? 2 : 0);
+  buf[2] = (left  < 0) ? -left  : left;
+  buf[3] = (right < 0) ? -right : right;
+  byte crc = 0;
+  for (byte k=1; k < 4; k++) crc = commandCRC8(crc,buf[k]);
+  buf[4] = crc;
+  return(COMMAND_FRAME_LEN);
+}
+
+// Group frame (COMMAND_FRAME_LEN bytes): speed for the channels in mask
+inline byte commandEncodeGroup(byte *buf, byte mask, int speed)
+{
+  if (speed < -255) speed = -255;
+  if (speed >  255) speed =  255;
+  buf[0] = COMMAND_SYNC;
+  buf[1] = (COMMAND_OP_GROUP << 4) | ((speed < 0) ? 1 : 0);
+  buf[2] = mask;
+  buf[3] = (speed < 0) ? -speed : speed;
+  byte crc = 0;
+  for (byte k=1; k < 4; k++) crc = commandCRC8(crc,buf[k]);
+  buf[4] = crc;
+  return(COMMAND_FRAME_LEN);
+}
+
+// Segment frame and queue frame (2 * COMMAND_FRAME_LEN bytes): run at
+// left, right for ms, after the segments already queued
+inline byte commandEncodeSegment(byte *buf, int left, int right, int ms)
+{
+  commandEncodeDrive(buf,left,right,COMMAND_OP_SEGMENT);
+  if (ms < 0) ms = 0;
+  if (ms > COMMAND_VAL_MAX) ms = COMMAND_VAL_MAX;
+  buf += COMMAND_FRAME_LEN;
+  buf[0] = COMMAND_SYNC;
+  buf[1] = COMMAND_OP_QUEUE << 4;
+  buf[2] = ms >> 8;
+  buf[3] = ms;
+  byte crc = 0;
+  for (byte k=1; k < 4; k++) crc = commandCRC8(crc,buf[k]);
+  buf[4] = crc;
+  return(2 * COMMAND_FRAME_LEN);
+}
+
+// Arcade mix: left = throttle + steer, right = throttle - steer.  When
+// either is over full speed, both are scaled down by the same factor,
+// so the turn keeps its shape and the faster side is at full speed.
+// One 32 bit divide, for the reciprocal, and only when saturated.
+inline void commandMix(int throttle, int steer, int &left, int &right)
+{
+  if (throttle < -255) throttle = -255;
+  if (throttle >  255) throttle =  255;
+  if (steer < -255) steer = -255;
+  if (steer >  255) steer =  255;
+  int l = throttle + steer, r = throttle - steer;
+  unsigned int al = (l < 0) ? -l : l, ar = (r < 0) ? -r : r;
+  unsigned int m = (al > ar) ? al : ar;
+  if (m > 255)
+    {
+      unsigned long k = (255UL << 16) / m;  // Q16
+      al = ((unsigned long)al * k + 0x8000) >> 16;
+      ar = ((unsigned long)ar * k + 0x8000) >> 16;
+      l = (l < 0) ? -(int)al : (int)al;
+      r = (r < 0) ? -(int)ar : (int)ar;
+    }
+  left = l;
+  right = r;
+}
+
+// Everything that arrived since the last CommandReader::drain().
+// Only the newest speed for each channel is kept, so a backlog of
+// updates collapses to one set that can be applied in the same tick.
+struct CommandBatch
+{
+  byte newSpeed;                 // mask of channels with a new speed[]
+  int speed[COMMAND_CHANNELS];
+  bool newLeft, newRight;        // as sent, for logging
+  int left, right;
+  bool stop;  // emergency stop requested, before any new speed[]
+  bool flush;                    // 'F': drop the queued segments
+  bool queue;                    // 'Q': append this segment, after any flush
+  int segLeft, segRight, segMs;
+  char code;  // newest command other than L/R/M/V/J/K/Q/F (and T/S, arcade), 0 if none
+  int val;
+
+  inline void set(const byte mask, const int v)
+  {
+    for (byte k=0; k < COMMAND_CHANNELS; k++)
+      if (mask & (1 << k)) speed[k] = v;
+    newSpeed |= mask;
+  }
+#ifdef PROFILE
+  uint32_t rxTime;  // micros() when the oldest byte arrived
+#endif
+};
+
+#ifdef COMMAND_RX_ISR
+#ifndef COMMAND_CORE_NO_RX_ISR
+#error "COMMAND_RX_ISR needs a core without the HardwareSerial RX interrupt handler (see Command.h)"
+#endif
+#ifndef COMMAND_RING_SIZE
+#define COMMAND_RING_SIZE 128  // power of two, at most 128
+#endif
+
+// Single producer (ISR), single consumer (loop) byte ring.
+// head and tail run free and wrap at 256, so each is only ever written
+// by one side and no interrupt masking is needed.
+struct CommandRing
+{
+  static_assert((COMMAND_RING_SIZE & (COMMAND_RING_SIZE-1)) == 0,
+                "COMMAND_RING_SIZE must be a power of two");
+  static_assert(COMMAND_RING_SIZE <= 128, "COMMAND_RING_SIZE too large");
+
+  volatile byte head;        // next slot the ISR fills
+  volatile byte tail;        // next slot the reader takes
+  volatile byte emergency;   // set by ISR when '!' arrives
+  volatile unsigned int overflows;  // bytes dropped, ring was full
+  byte skip;                 // ISR only: binary frame bytes still to come
+#ifdef PROFILE
+  volatile uint32_t rxTime;  // micros() when the oldest unread byte arrived
+#endif
+  byte buf[COMMAND_RING_SIZE];
+
+  // called from the RX interrupt
+  inline void put(const byte c)
+  {
+    if (skip) skip--;  // frame payload may hold any byte value
+    else if (c == COMMAND_SYNC) skip = COMMAND_FRAME_LEN - 1;
+    else if (c == '!') emergency = 1;
+
+    if ((byte)(head - tail) >= COMMAND_RING_SIZE)
+      {
+        overflows++;
+        return;
+      }
+#ifdef PROFILE
+    if (head == tail) rxTime = micros();
+#endif
+    buf[head & (COMMAND_RING_SIZE-1)] = c;
+    head++;
+  }
+
+  inline byte available() const { return(head - tail); }
+
+  inline int read()
+  {
+    if (head == tail) return(-1);
+    byte c = buf[tail & (COMMAND_RING_SIZE-1)];
+    tail++;
+    return(c);
+  }
+};
+
+CommandRing CommandRx;
+
+ISR(USART_RX_vect)
+{
+  CommandRx.put(UDR0);
+}
+#endif
+
 class CommandReader
 {
 public:
-  int nDig,val;
-  bool neg;
-  char code;
+  int nDig = 0, val = 0;
+  bool neg = false;
+  char code = 0;
+
+  byte nFrame = 0;      // bytes of binary frame received so far, 0 when not in a frame
+  byte frame[COMMAND_FRAME_LEN];
+  char pendCode = 0;    // second command decoded from a frame, returned next
+  int  pendVal = 0;
+  unsigned int nBadFrame = 0;  // frames dropped for bad CRC or opcode
+  byte groupL = 1;      // channels set by 'L'
+  byte groupR = 2;      // and 'R'
+  byte group = 0;       // channels set by 'V', selected by 'M'
+  bool arcade = false;  // mix 'T' and 'S' into 'L' and 'R'
+  int throttle = 0;     // last 'T', 'S', in arcade mode
+  int steer = 0;
+  int segLeft = 0;      // last 'J', 'K': speeds of the next segment
+  int segRight = 0;
+#if defined(PROFILE) && !defined(COMMAND_RX_ISR)
+  uint32_t _polled = 0;    // micros() of the previous drain()
+#endif
 
   void begin(const char c=0)
   {
@@ -18,16 +298,101 @@ public:
     code=c;
     neg = false;
   }
+
+  // decode a complete binary frame.  true if it held a valid command
+  bool getFrame(char &cmdCode, int &cmdVal)
+  {
+    nFrame = 0;
+    byte crc = 0;
+    for (byte k=1; k < 4; k++) crc = commandCRC8(crc,frame[k]);
+    byte op = frame[1] >> 4;
+    if ((crc != frame[4]) || (op < COMMAND_OP_DRIVE) || (op > COMMAND_OP_QUEUE))
+      {
+        nBadFrame++;
+        return(false);
+      }
+    if (op == COMMAND_OP_GROUP)
+      {
+        cmdCode = 'M';
+        cmdVal  = frame[2];
+        pendCode = 'V';
+        pendVal  = (frame[1] & 1) ? -(int)frame[3] : frame[3];
+        return(true);
+      }
+    if (op == COMMAND_OP_QUEUE)
+      {
+        cmdCode = 'Q';
+        cmdVal = ((frame[2] & 0x7f) << 8) | frame[3];
+        return(true);
+      }
+    if (op == COMMAND_OP_ARCADE)
+      {
+        cmdCode = 'T';
+        pendCode = 'S';
+      }
+    else if (op == COMMAND_OP_SEGMENT)
+      {
+        cmdCode = 'J';
+        pendCode = 'K';
+      }
+    else
+      {
+        cmdCode = 'L';
+        pendCode = 'R';
+      }
+    cmdVal  = (frame[1] & 1) ? -(int)frame[2] : frame[2];
+    pendVal  = (frame[1] & 2) ? -(int)frame[3] : frame[3];
+    return(true);
+  }
+
+  inline int readByte()
+  {
+#ifdef COMMAND_RX_ISR
+    return(CommandRx.read());
+#else
+    return(Serial.read());
+#endif
+  }
+
+  inline int bytesAvailable()
+  {
+#ifdef COMMAND_RX_ISR
+    return(CommandRx.available());
+#else
+    return(Serial.available());
+#endif
+  }
+
   bool get(char &cmdCode, int &cmdVal)
   {
-    int i = Serial.read();
+    if (pendCode)
+      {  // right half of a binary drive frame
+        cmdCode = pendCode;
+        cmdVal = pendVal;
+        pendCode = 0;
+        return(true);
+      }
+    int i = readByte();
     if (i < 0) return(false);  // no command yet
+    if (nFrame)
+      {
+        frame[nFrame++] = i;
+        if (nFrame < COMMAND_FRAME_LEN) return(false);
+        return(getFrame(cmdCode,cmdVal));
+      }
+    if (i == COMMAND_SYNC)
+      {
+        begin();  // abandon any partial ASCII command
+        frame[0] = i;
+        nFrame = 1;
+        return(false);
+      }
     char c = i;
 //Serial.print('[');Serial.print(i);Serial.print(',');Serial.print(c);Serial.println(']');
     switch(c)
       {
       case '~' :
-        Serial.println(F("Command Stream RESET!"));
+        Tel.log(TEL_CMD_RESET);
         begin();
         return(false);
 
@@ -41,8 +406,10 @@ public:
       case '7':
       case '8':
       case '9':
-        val = val*10 + (i-((int)('0')));
-        nDig++;
+        // saturate, so a long run of digits can not wrap the 16 bit int
+        if (val > (COMMAND_VAL_MAX - (i-((int)('0'))))/10) val = COMMAND_VAL_MAX;
+        else val = val*10 + (i-((int)('0')));
+        if (nDig < COMMAND_VAL_DIGITS) nDig++;
         //Serial.print(nDig);Serial.print(")");Serial.println(val);
         return(false);
       case '-':
@@ -53,7 +420,7 @@ public:
           }
         else
           {
-            Serial.println(F("Not expecting a value.  '-' char ignored."));
+            Tel.log(TEL_CMD_BAD_NEG,code);  // '-' char ignored
             begin();  // clear bad entry
           }
         return(false);
@@ -63,6 +430,10 @@ public:
       case '^':
       case 'a':  // command to set Autonomous in manual mode
       case 'A':
+      case 'F':  // flush the segment queue
+      case 'q':  // segment queue depth
+      case 'o':  // reset the pose
+      case 'k':  // calibrate the motors
         cmdCode = c;  // return prev command code (if any)
         cmdVal = 0;
         return(true);
@@ -81,6 +452,12 @@ public:
       case 'g':
       case 'r':
       case 'd':
+      case 'M':
+      case 'V':
+      case 'J':
+      case 'K':
+      case 'Q':
+      case 'O':
         begin();  // clear old command, if any
         code = c; // remember command for wich the following value applies
         return(false);  // wait for value
@@ -111,5 +488,92 @@ public:
       }
   }
 
+  // Read every byte available now.  true if any command was completed.
+  bool drain(CommandBatch &b)
+  {
+    b.newSpeed = 0;
+    b.newLeft = b.newRight = b.stop = b.flush = b.queue = false;
+    b.code = 0;
+    bool any = false;
+#ifdef PROFILE
+ #ifdef COMMAND_RX_ISR
+    cli();  // 32 bit value written by the ISR
+    b.rxTime = CommandRx.rxTime;
+    sei();
+ #else
+    // the core buffer has no time stamps.  bytes came in since the last look
+    b.rxTime = _polled;
+    _polled = micros();
+ #endif
+#endif
+#ifdef COMMAND_RX_ISR
+    if (CommandRx.emergency)
+      {  // act on it now, even if a backlog is still ahead of it
+        CommandRx.emergency = 0;
+        b.stop = any = true;
+        throttle = steer = 0;
+      }
+#endif
+    char c;
+    int v;
+    while (pendCode || (bytesAvailable() > 0))
+      {
+        if (!get(c,v)) continue;
+        switch(c)
+          {
+          case 'L': b.left  = v; b.newLeft  = true; b.set(groupL,v); break;
+          case 'R': b.right = v; b.newRight = true; b.set(groupR,v); break;
+          case 'M': group = v; continue;  // selects, for the 'V's that follow
+          case 'V': b.set(group,v); break;
+          case 'J': segLeft  = v; continue;
+          case 'K': segRight = v; continue;
+          case 'F': b.flush = true; break;
+          case 'Q':
+            b.queue = true;
+            b.segLeft = segLeft;
+            b.segRight = segRight;
+            b.segMs = (v < 0) ? 0 : v;
+            return(true);  // rest next time, so each segment is appended
+          case '!':  // the speeds before it are void
+            b.stop = true;
+            b.newSpeed = 0;
+            b.newLeft = b.newRight = false;
+            throttle = steer = 0;
+            break;
+          case 'T':
+          case 'S':
+            if (!arcade)
+              {
+                b.code = c;
+                b.val = v;
+                break;
+              }
+            if (c == 'T') throttle = v;
+            else          steer = v;
+            commandMix(throttle,steer,b.left,b.right);
+            b.newLeft = b.newRight = true;
+            b.set(groupL,b.left);
+            b.set(groupR,b.right);
+            break;
+
+          // a separator with no command in progress
+          case 0:
+          case ' ':
+          case '\t':
+          case '\r':
+          case '\n':
+          case ',':
+          case ';':
+            continue;
+
+          default:
+            b.code = c;
+            b.val = v;
+          }
+        any = true;
+      }
+    return(any);
+  }
+
 };
 
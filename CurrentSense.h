@@ -0,0 +1,131 @@
+/*
+Background motor current sampling, with an overcurrent trip.
+
+analogRead() waits about 100us for each conversion.  Instead, the ADC
+runs from its own interrupt here, converting each current sense
+channel in turn, and keeps per channel:
+
+    average  -- low-passed over 2^CURRENT_FILTER_SHIFT samples, ADC counts
+    peak     -- highest sample since the last peak() call
+
+A sample above the channel's trip level calls the trip function from
+the interrupt, at once, and again for every sample that stays above
+it, so the trip is never more than one sample period behind.  The main
+loop never waits for a conversion.
+
+At the /128 ADC clock, a conversion is 104us, so with both motors'
+channels each one is sampled every 208us.
+
+Define CURRENT_SENSE before including the DBH1 driver, so its
+getCurrentCounts() reads the average here, not analogRead().
+Nothing else may use the ADC while the sampler runs.
+
+provided under LGPL license
+*/
+#ifndef CURRENT_SENSE_H
+#define CURRENT_SENSE_H
+
+#ifndef CURRENT_SENSE_CHANNELS
+#define CURRENT_SENSE_CHANNELS 2
+#endif
+#ifndef CURRENT_FILTER_SHIFT
+#define CURRENT_FILTER_SHIFT 4   // average over 16 samples
+#endif
+
+typedef void (*CurrentTripFn)(byte channel);  // called from the ADC interrupt
+
+class CurrentSense
+{
+public:
+  struct Channel
+  {
+    byte pin;                      // analog input, 0..7
+    unsigned short trip;           // ADC counts, 0 for no trip
+    volatile unsigned short avgQ;  // average, Q(CURRENT_FILTER_SHIFT)
+    volatile unsigned short pk;    // peak since last read
+    volatile unsigned short trips; // samples over the trip level
+  };
+  Channel ch[CURRENT_SENSE_CHANNELS];
+  byte nCh;
+  volatile byte cur;   // channel being converted
+  CurrentTripFn onTrip;
+
+  // returns channel index, or -1 when there is no room
+  int add(const byte analogPin, const unsigned short tripCounts=0)
+  {
+    if (nCh >= CURRENT_SENSE_CHANNELS) return(-1);
+    Channel &c = ch[nCh];
+    c.pin = analogPin;
+    c.trip = tripCounts;
+    c.avgQ = c.pk = c.trips = 0;
+    return(nCh++);
+  }
+
+  // start the ADC running.  Channels must have been add()ed
+  void begin(CurrentTripFn fn)
+  {
+    onTrip = fn;
+    if (!nCh) return;
+    cur = 0;
+    ADMUX  = _BV(REFS0) | ch[0].pin;   // AVcc reference
+    ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+    ADCSRA |= _BV(ADSC);
+  }
+
+  // from the ADC interrupt, with the finished conversion
+  inline void sample(const unsigned short v)
+  {
+    Channel &c = ch[cur];
+    c.avgQ += v - (c.avgQ >> CURRENT_FILTER_SHIFT);
+    if (v > c.pk) c.pk = v;
+    byte k = cur;
+
+    // next conversion first, so it runs while the trip is handled
+    if (++cur >= nCh) cur = 0;
+    ADMUX = (ADMUX & 0xf0) | ch[cur].pin;
+    ADCSRA |= _BV(ADSC);
+
+    if (c.trip && (v > c.trip))
+      {
+        c.trips++;
+        if (onTrip) onTrip(k);
+      }
+  }
+
+  void setTrip(const byte k, const unsigned short counts) { ch[k].trip = counts; }
+
+  // ADC counts.  16 bit values written by the ISR, so read with it held off
+  unsigned short average(const byte k)
+  {
+    cli();
+    unsigned short a = ch[k].avgQ;
+    sei();
+    return(a >> CURRENT_FILTER_SHIFT);
+  }
+
+  unsigned short peak(const byte k)  // and start over
+  {
+    cli();
+    unsigned short p = ch[k].pk;
+    ch[k].pk = 0;
+    sei();
+    return(p);
+  }
+
+  // average of the channel on analog pin, 0 if not sampled
+  unsigned short averageOf(const byte analogPin)
+  {
+    for (byte k=0; k < nCh; k++)
+      if (ch[k].pin == analogPin) return(average(k));
+    return(0);
+  }
+};
+
+CurrentSense Current;
+
+ISR(ADC_vect)
+{
+  Current.sample(ADC);
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+Wrap-safe deadlines, on millis() or micros().
+
+A Deadline is a start time and a span.  It is only ever tested by the
+time elapsed since the start, (now - start) in 32 bit unsigned
+arithmetic, so it stays right across the wrap of the clock (49.7 days
+for millis(), 71.6 minutes for micros()), where comparing absolute
+times fails.  Spans may be up to 2^32-1 ticks, and a deadline has to
+be tested within 2^32 ticks of its start.
+
+Times are uint32_t rather than unsigned long.  On the AVR they are the
+same type; on a 64 bit host (sim/) this keeps the arithmetic wrapping
+at 32 bits, as it does on the robot.
+
+A Deadline16 keeps only the low 16 bits of the time it falls due, in
+2 bytes rather than 8, for state kept per channel (see MotorBank.h).
+It is tested by the signed 16 bit difference from now, so spans must
+stay under 2^15 ticks, and it must be tested within 2^15 ticks of
+falling due to be seen as passed.
+
+provided under LGPL license
+*/
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+struct Deadline
+{
+  uint32_t start;  // clock ticks
+  uint32_t span;
+
+  inline void set(const uint32_t now, const uint32_t s) { start = now; span = s; }
+  inline void extend(const uint32_t s) { span += s; }
+  inline uint32_t elapsed(const uint32_t now) const { return(now - start); }
+  inline bool reached(const uint32_t now) const { return(now - start >= span); }
+  inline bool passed (const uint32_t now) const { return(now - start >  span); }
+  // ticks until reached, 0 if it is
+  inline uint32_t remaining(const uint32_t now) const
+  {
+    uint32_t e = now - start;
+    return((e < span) ? span - e : 0);
+  }
+};
+
+struct Deadline16
+{
+  unsigned short due;  // low 16 bits of the clock
+
+  inline void set(const uint32_t now, const uint32_t s) { due = (unsigned short)(now + s); }
+  inline void extend(const uint32_t s) { due += (unsigned short)s; }
+  inline bool reached(const uint32_t now) const { return((short)((unsigned short)now - due) >= 0); }
+  inline bool passed (const uint32_t now) const { return((short)((unsigned short)now - due) >  0); }
+  // ticks until reached, 0 if it is
+  inline uint32_t remaining(const uint32_t now) const
+  {
+    short left = (short)(due - (unsigned short)now);
+    return((left > 0) ? left : 0);
+  }
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+Quadrature wheel encoder, counted in an interrupt.
+
+QuadEncoder<A,B> keeps a signed count of A/B edges (4 per encoder
+line).  Call tick() from the pin change or external interrupt that
+covers the A and B pins; each call reads both pins with FastPin, so
+one ISR may tick several encoders sharing a port.  Forward is the
+sequence 00, 01, 11, 10 (as A<<1 | B), i.e. B leads A.
+
+    QuadEncoder<14,15> EncL;
+    ISR(PCINT1_vect) { EncL.tick(); }
+
+provided under LGPL license
+*/
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include "FastPin.h"
+
+// count step for (previous state << 2 | new state).  0 for no change,
+// or an invalid double step
+const signed char QuadStep[16] PROGMEM =
+  { 0, 1,-1, 0,
+   -1, 0, 0, 1,
+    1, 0, 0,-1,
+    0,-1, 1, 0 };
+
+template<byte A_PIN, byte B_PIN>
+class QuadEncoder
+{
+  volatile long _count;
+  volatile byte _state;  // A<<1 | B, as last seen
+
+  static inline byte pins()
+  {
+    return((FastPin<A_PIN>::get() << 1) | FastPin<B_PIN>::get());
+  }
+
+public:
+  void begin()
+  {
+    FastPin<A_PIN>::mode(INPUT_PULLUP);
+    FastPin<B_PIN>::mode(INPUT_PULLUP);
+    _state = pins();
+    _count = 0;
+  }
+
+  // from the interrupt.  cheap when the change was on some other pin
+  inline void tick()
+  {
+    byte s = pins();
+    if (s == _state) return;
+    _count += (signed char)pgm_read_byte(&QuadStep[(_state << 2) | s]);
+    _state = s;
+  }
+
+  // from loop().  a long can not be read in one instruction on AVR
+  long count()
+  {
+    cli();
+    long c = _count;
+    sei();
+    return(c);
+  }
+};
+
+#endif
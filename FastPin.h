@@ -0,0 +1,113 @@
+/*
+Compile-time pin access.
+
+FastPin<n> is a pin known at compile time.  On an ATmega168/328 each
+write() is a single sbi/cbi on the port register, get() a single read
+of the input register, and pwm() is a direct store to the timer's
+output compare register, instead of the table lookups and timer checks
+digitalWrite()/digitalRead()/analogWrite() do on every call.
+Other targets fall back to the Arduino calls.  The host simulation
+models the port and timer registers, so it runs the register path too.
+
+FastPin<NO_PIN> accepts every call and does nothing, for optional pins.
+
+provided under LGPL license
+*/
+#ifndef FAST_PIN_H
+#define FAST_PIN_H
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__)
+#define FASTPIN_AVR
+#endif
+
+#define NO_PIN 255
+
+template<byte PIN> struct FastPin
+{
+#ifdef FASTPIN_AVR
+  static inline decltype((PORTD)) port()
+  {
+    return((PIN < 8) ? PORTD : ((PIN < 14) ? PORTB : PORTC));
+  }
+  static inline decltype((PIND)) pinReg()
+  {
+    return((PIN < 8) ? PIND : ((PIN < 14) ? PINB : PINC));
+  }
+  static const byte mask = (PIN < 8)  ? (1 << PIN) :
+                           (PIN < 14) ? (1 << (PIN-8)) : (1 << (PIN-14));
+
+  // disconnect the timer from the pin, as digitalWrite() does
+  static inline void pwmOff()
+  {
+    switch(PIN)
+      {
+      case  3: TCCR2A &= ~_BV(COM2B1); break;
+      case  5: TCCR0A &= ~_BV(COM0B1); break;
+      case  6: TCCR0A &= ~_BV(COM0A1); break;
+      case  9: TCCR1A &= ~_BV(COM1A1); break;
+      case 10: TCCR1A &= ~_BV(COM1B1); break;
+      case 11: TCCR2A &= ~_BV(COM2A1); break;
+      }
+  }
+#endif
+
+  static inline void mode(const byte m) { pinMode(PIN,m); }
+
+  static inline void write(const byte v)
+  {
+#ifdef FASTPIN_AVR
+    pwmOff();
+    if (v) port() |= mask;
+    else   port() &= ~mask;
+#else
+    digitalWrite(PIN,v);
+#endif
+  }
+
+  // 0..255, same meaning as analogWrite()
+  static inline void pwm(const byte v)
+  {
+#ifdef FASTPIN_AVR
+    if ((v == 0) || (v == 255))
+      {
+        write(v);
+        return;
+      }
+    switch(PIN)
+      {
+      case  3: OCR2B = v; TCCR2A |= _BV(COM2B1); return;
+      case  5: OCR0B = v; TCCR0A |= _BV(COM0B1); return;
+      case  6: OCR0A = v; TCCR0A |= _BV(COM0A1); return;
+      case  9: OCR1A = v; TCCR1A |= _BV(COM1A1); return;
+      case 10: OCR1B = v; TCCR1A |= _BV(COM1B1); return;
+      case 11: OCR2A = v; TCCR2A |= _BV(COM2A1); return;
+      }
+    write(v >= 128);  // no timer on this pin
+#else
+    analogWrite(PIN,v);
+#endif
+  }
+
+  static inline int read() { return(analogRead(PIN)); }
+
+  // digital input level, 0 or 1
+  static inline byte get()
+  {
+#ifdef FASTPIN_AVR
+    return((pinReg() & mask) ? 1 : 0);
+#else
+    return(digitalRead(PIN) ? 1 : 0);
+#endif
+  }
+};
+
+template<> struct FastPin<NO_PIN>
+{
+  static inline void mode(const byte) {}
+  static inline void write(const byte) {}
+  static inline void pwm(const byte) {}
+  static inline int read() { return(0); }
+  static inline byte get() { return(0); }
+};
+
+#endif
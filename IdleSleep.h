@@ -0,0 +1,79 @@
+/*
+Idle sleep between deadlines, instead of spinning in loop().
+
+When loop() has nothing to do before the scheduler's next deadline
+(see Scheduler.h), sleep() puts the AVR in idle mode.  The timers, UART
+and ADC keep running, and any of their interrupts wakes it: the Timer0
+overflow behind millis() (every 1024 us), a USART RX byte, the ADC or a
+pin change.  The Timer0 tick is the only timed wake-up, so it only
+sleeps while the deadline is more than IDLE_WAKE_US off.  loop() spins
+out the last stretch, so no deadline runs later than it would without
+sleep.
+
+Call sleep() with interrupts disabled, after checking that no input is
+waiting.  It enables them on the instruction before SLEEP, which the
+AVR always runs, so a byte that arrives in between still wakes it.
+
+report() logs the time spent asleep since the previous report, per
+mille (TEL_SLEEP).
+
+provided under LGPL license
+*/
+#ifndef IDLE_SLEEP_H
+#define IDLE_SLEEP_H
+
+#include <avr/sleep.h>
+#include "Telemetry.h"
+
+#ifndef IDLE_WAKE_US
+#define IDLE_WAKE_US 1200UL  // a Timer0 tick, and time to get back to loop()
+#endif
+
+class IdleSleep
+{
+public:
+  uint32_t asleep;  // us since the last report
+  uint32_t since;   // micros() of the last report
+
+  void begin()
+  {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    asleep = 0;
+    since = micros();
+  }
+
+  // Sleep until an interrupt, if the deadline is far enough off.
+  // Interrupts are enabled on return.  true if it slept
+  bool sleep(const uint32_t deadline)
+  {
+    uint32_t t0 = micros();
+    if ((int32_t)(deadline - t0) <= (int32_t)IDLE_WAKE_US)
+      {
+        sei();
+        return(false);
+      }
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    asleep += micros() - t0;
+    return(true);
+  }
+
+  void report()
+  {
+    uint32_t now = micros();
+    uint32_t span = now - since;
+    uint32_t a = asleep;
+    while (span > 4000000UL)
+      {  // keep a * 1000 in 32 bits
+        span >>= 1;
+        a >>= 1;
+      }
+    Tel.log(TEL_SLEEP,0,span ? (short)(a * 1000 / span) : 0);
+    asleep = 0;
+    since = now;
+  }
+};
+
+#endif
@@ -0,0 +1,304 @@
+/*
+N H-bridge channels with L298 logic, for 4 or 6 motor skid-steer.
+
+A MotorDriveCore driver object keeps every parameter, and a 32 bit
+deadline and ramp time, for each motor: 40 bytes of SRAM each on an
+AVR, with its pins.  MotorBank<N> runs the same stop / start-pulse /
+deadman / ramp state machine on each of N channels (MotorStateMachine,
+see MotorDriveCore.h), with the state in one array per field, reached
+by the bank and the channel's index, and the parameters shared by all
+channels:
+
+    per channel   speed, command, ramp output (2 bytes each), mode,
+                  deadline, ramp time (low 16 bits of millis()),
+                  trip flag, EN, IN1, IN2, PWM pins, shared pin
+                  group                                     17 bytes
+    per bank      timing parameters, ramp rates, PWM limits,
+                  output map                                17 bytes
+
+CHANNEL_BYTES is the per channel cost.  Deadlines are Deadline16s
+(see Deadline.h), so every time span (deadman, stop lock-out, brake
+time) must stay under 32 s, and wrap-around is harmless.
+
+Channels are addressed in groups, by bit mask: setSpeed(),
+emergencyStop() and trip() take a mask, and update() runs every
+channel's deadlines and transitions in one pass.  Channels may share
+pins, e.g. the direction pins of one side of a skid-steer.  Each runs
+its own deadman and brake timers, so channels that share a pin are
+only ever commanded together: a command to any of them goes to all of
+them, with the same speed (setSpeeds() gives them the speed of the
+lowest numbered one in the mask).
+
+Each channel drives an L298, or with a PWM pin given, a WTH3615D
+(EN held on, speed on PWM), as L298Drive and WTH3615DDrive do.
+Speed is on analogWrite() resolution, or the pin's (see Pwm.h),
+through the output map if one is set (setOutputMap(), see MotorMap.h).
+
+State changes are logged to Tel, with the channel's id: the id given
+to setId(), plus the channel number.
+
+provided under LGPL license
+*/
+#ifndef MOTOR_BANK_H
+#define MOTOR_BANK_H
+
+#include "MotorDriveCore.h"
+#include "MotorPins.h"
+
+template<byte N>
+class MotorBank
+{
+  static_assert((N > 0) && (N <= 8), "MotorBank channels are addressed by a byte mask");
+
+public:
+  static const byte ALL = (byte)((1U << N) - 1);
+  static const byte CHANNEL_BYTES = 3 * sizeof(SHORT) + sizeof(BYTE) + sizeof(Deadline16) +
+                                    sizeof(unsigned short) + sizeof(BYTE) + 5 * sizeof(byte);
+
+  // per channel, one array per field
+  SHORT _speed[N];          // current speed
+  SHORT _speedCmd[N];       // commanded speed
+  SHORT _out[N];            // ramped output speed, Q7 (x128)
+  BYTE  _mode[N];
+  Deadline16 _due[N];       // of the next transition
+  unsigned short _rampTime[N];  // millis() (low 16 bits) of the last ramp step
+  volatile BYTE _tripped[N];    // set by trip(), from an interrupt
+  byte _en[N], _in1[N], _in2[N], _pwm[N];
+  byte _link[N];            // channels sharing a pin with this one, and itself
+
+  // shared by the bank
+  unsigned short _decel;     // time to allow to stop, in ms / PWM count, Q8
+  SHORT _deadTime;           // ms until deadman transition to emergency stop
+  SHORT _startupTime;        // ms of full-power pulse to start from dead stop
+  SHORT _stopTime;           // ms to lock-out commands after emergency stop
+  unsigned short _accelRate; // ramp up, PWM counts / ms, Q7.  0 == at once
+  unsigned short _decelRate; // ramp down, PWM counts / ms, Q7.  0 == at once
+  BYTE _maxPWM;              // clip PWM commands to this magnitude
+  BYTE _minPWM;              // motors won't move below this level
+  BYTE _id;                  // channel k logs as _id + k
+  const byte *_map;          // PROGMEM speed to PWM table, 0 for none
+
+  MotorBank(const float decel=2.0,
+            const int deadTime=500,
+            const int startupTime=50,
+            const int stopTime=3000,
+            const int maxPWM=255,
+            const int minPWM=1)
+  {
+    _deadTime = deadTime;
+    _maxPWM = maxPWM;
+    _minPWM = minPWM;
+    _startupTime = startupTime;
+    _stopTime = stopTime;
+    setDecelRate(decel);
+    _accelRate = _decelRate = 0;
+    _id = 0;
+    _map = 0;
+    for (byte k=0; k < N; k++)
+      {
+        _speed[k] = _speedCmd[k] = _out[k] = 0;
+        _mode[k] = MOTOR_STOPPED;
+        _due[k].due = 0;
+        _rampTime[k] = 0;
+        _tripped[k] = 0;
+        _en[k] = _in1[k] = _in2[k] = _pwm[k] = NO_PIN;
+        _link[k] = 1 << k;
+      }
+  }
+
+  // pins of channel k.  pwm: the WTH3615D's PWM input, if any
+  void setPins(const byte k, const byte en, const byte in1, const byte in2,
+               const byte pwm=NO_PIN)
+  {
+    _en[k] = en;
+    _in1[k] = in1;
+    _in2[k] = in2;
+    _pwm[k] = pwm;
+  }
+
+  // after setPins() for every channel
+  void begin()
+  {
+    for (byte k=0; k < N; k++)
+      {
+        _link[k] = 0;
+        for (byte j=0; j < N; j++)
+          if ((j == k) || sharesPin(j,k)) _link[k] |= 1 << j;
+        pinMode(_en[k] ,OUTPUT);
+        pinMode(_in1[k],OUTPUT);
+        pinMode(_in2[k],OUTPUT);
+        digitalWrite(_en[k],0);  // make sure we are disabled ASAP
+        if (_pwm[k] != NO_PIN)
+          {
+            pinMode(_pwm[k],OUTPUT);
+            analogWrite(_pwm[k],0);
+          }
+      }
+    emergencyStop(ALL);
+  }
+
+  void setCommandTimeout(const int ms) { _deadTime = ms; }
+  void setDecelRate(const float msPerCount) { _decel = (unsigned short)(msPerCount * 256 + 0.5f); }
+  // PWM counts per ms, up and down, each 0 for immediate speed changes,
+  // as MotorDriveCore::setRampRates()
+  void setRampRates(const float accel, const float decel)
+  {
+    _accelRate = (unsigned short)(accel * 128 + 0.5f);
+    _decelRate = (unsigned short)(decel * 128 + 0.5f);
+    unsigned long t = millis();
+    for (byte k=0; k < N; k++) Channel(*this,k).restartRamp(t);
+  }
+  void setStartPulseDuration(const int ms) { _startupTime=ms; }
+  void setStopTimeout(const int ms) { _stopTime=ms; }
+  void setId(const BYTE id) { _id=id; }
+  // 256 bytes in PROGMEM, PWM for each speed 0..255.  0 for none
+  void setOutputMap(const byte *map) { _map = map; }
+
+  void emergencyStop(const byte mask)
+  {
+    for (byte k=0; k < N; k++)
+      if (mask & _link[k]) Channel(*this,k).emergencyStop();
+  }
+
+  // Brake the channels in mask now.  Safe from an interrupt
+  void trip(const byte mask)
+  {
+    for (byte k=0; k < N; k++)
+      if (mask & _link[k]) Channel(*this,k).trip();
+  }
+
+  inline void setSpeed(const byte mask, const int spdReq) { setSpeed(mask,spdReq,millis()); }
+
+  // Every channel in mask to spdReq, -255..255
+  void setSpeed(const byte mask, const int spdReq, unsigned long t)
+  {
+    for (byte k=0; k < N; k++)
+      if (mask & _link[k]) Channel(*this,k).setSpeed(spdReq,t);
+  }
+
+  // Channel k in mask to spd[k]
+  void setSpeeds(const byte mask, const int *spd, unsigned long t)
+  {
+    for (byte k=0; k < N; k++)
+      {
+        byte from = mask & _link[k];  // of k's group, the channels sent a speed
+        if (!from) continue;
+        byte j = 0;
+        while (!(from & (1 << j))) j++;
+        Channel(*this,k).setSpeed(spd[j],t);
+      }
+  }
+
+  // ms after t until update() next has anything to do, at most maxMs.
+  // 0 if it has to run every tick (ramping, or a trip to handle)
+  unsigned long idleTime(unsigned long t, unsigned long maxMs)
+  {
+    for (byte k=0; (k < N) && maxMs; k++)
+      maxMs = Channel(*this,k).idleTime(t,maxMs);
+    return(maxMs);
+  }
+
+  // every channel's transitions, and ramp, in one pass
+  void update(unsigned long t)
+  {
+    for (byte k=0; k < N; k++) Channel(*this,k).update(t);
+  }
+
+protected:
+  inline bool sharesPin(const byte j, const byte k) const
+  {
+    const byte a[4] = { _en[j], _in1[j], _in2[j], _pwm[j] };
+    const byte b[4] = { _en[k], _in1[k], _in2[k], _pwm[k] };
+    for (byte x=0; x < 4; x++)
+      for (byte y=0; y < 4; y++)
+        if ((a[x] != NO_PIN) && (a[x] == b[y])) return(true);
+    return(false);
+  }
+
+  // channel k, as MotorStateMachine sees it: the bank and an index,
+  // and an accessor for each field, into the bank's arrays for k or its
+  // shared parameters.  Three bytes on the stack, with no copies
+  struct ChannelState
+  {
+    typedef unsigned short Tick;  // low 16 bits of millis()
+
+    ChannelState(MotorBank &b, const byte k) : _bank(b), _k(k) {}
+
+  protected:
+    MotorBank &_bank;
+    const byte _k;
+
+    inline SHORT &speed() const { return(_bank._speed[_k]); }
+    inline SHORT &speedCmd() const { return(_bank._speedCmd[_k]); }
+    inline BYTE &mode() const { return(_bank._mode[_k]); }
+    inline Deadline16 &done() const { return(_bank._due[_k]); }
+    inline SHORT &out() const { return(_bank._out[_k]); }
+    inline Tick &rampTime() const { return(_bank._rampTime[_k]); }
+    inline volatile BYTE &tripped() const { return(_bank._tripped[_k]); }
+    inline unsigned short decel() const { return(_bank._decel); }
+    inline unsigned short accelRate() const { return(_bank._accelRate); }
+    inline unsigned short decelRate() const { return(_bank._decelRate); }
+    inline SHORT deadTime() const { return(_bank._deadTime); }
+    inline SHORT maxPWM() const { return(_bank._maxPWM); }
+    inline SHORT minPWM() const { return(_bank._minPWM); }
+    inline uint32_t startupTime() const { return(_bank._startupTime); }
+    inline SHORT stopTime() const { return(_bank._stopTime); }
+    inline const byte *outMap() const { return(_bank._map); }
+    static inline BYTE pwmBits() { return(8); }  // new PWM on whole speed steps
+    inline BYTE id() const { return(_bank._id + _k); }
+  };
+
+  // ------------------------------------------ L298 / WTH3615D pins
+  class Channel : public MotorStateMachine<Channel,ChannelState>
+  {
+    inline byte en()  const { return(this->_bank._en[this->_k]); }
+    inline byte in1() const { return(this->_bank._in1[this->_k]); }
+    inline byte in2() const { return(this->_bank._in2[this->_k]); }
+    inline byte pwm() const { return(this->_bank._pwm[this->_k]); }
+
+    void setReverse(const bool rev)
+    {
+      if (rev) { digitalWrite(in2(),0); digitalWrite(in1(),1); }
+      else     { digitalWrite(in1(),0); digitalWrite(in2(),1); }
+    }
+
+  public:
+    static const bool passThrough = true;  // L298 logic
+
+    Channel(MotorBank &b, const byte k)
+      : MotorStateMachine<Channel,ChannelState>(b,k) {}
+
+    void hwBrake()
+    {
+      digitalWrite(en(),0);
+      digitalWrite(in1(),0);
+      digitalWrite(in2(),0);
+      if (pwm() != NO_PIN) analogWrite(pwm(),0);
+      digitalWrite(en(),1);
+    }
+    void hwHold()
+    {
+      digitalWrite(in1(),0);
+      digitalWrite(in2(),0);
+      digitalWrite(en(),1);  // brake
+    }
+    void hwKick(const bool rev)
+    {
+      setReverse(rev);  // don't worry about PWM, this is transistional state
+      if (pwm() != NO_PIN) analogWrite(pwm(),255);
+      digitalWrite(en(),1);
+    }
+    void hwDrive(const bool rev, const unsigned short duty)
+    {
+      setReverse(rev);
+      if (pwm() == NO_PIN) pwmWrite(en(),duty);
+      else
+        {
+          digitalWrite(en(),1);
+          pwmWrite(pwm(),duty);
+        }
+    }
+  };
+};
+
+#endif
@@ -14,18 +14,31 @@ It also provides a 5v-ish OUTPUT appropriate for running the MCU
 
 It was found that motors seemed to run a bit faster and more efficient
 with PWM on the Enable.
-Future versions of this driver may allow user to put the PWM
-on the direction pin which seems to provide a more constant-velocity
+L298Drive::setDirPwm(true) puts the PWM on the direction pin instead,
+which seems to provide a more constant-velocity
 response, where putting PWM on the enable is more like the accelerator
 input on a car.  (It has a peak velocity, but until it gets there
 is is closer related to acceleration)
+EN is held on, the other direction input low, and the off part of each
+cycle brakes, so speed follows duty nearly in a straight line, less a
+deadband.  An output map (setOutputMap(), see MotorMap.h) takes out
+the deadband.  IN1 and IN2 then need PWM pins, best on one timer, as
+setPwm() configures IN1's.
 
 Driver will apply electrical brake when stopping, but
 try to use freewheeling PWM mode when driving.
 
 I have a WTH3615D that claims L298 logic, but has an extra input labeled PWM.
-Define   WTH3615D to add the PWM pin number to the end of the begin() parameters,
-and try to use this motor driver.
+WTH3615DDrive takes the PWM pin number at the end of the begin() parameters.
+
+L298Drive<PINS> and WTH3615DDrive<PINS> are the hardware halves of
+MotorDriveCore (see MotorDriveCore.h).  With the default PINS, pins are
+given at run time, in begin().  With PINS=MotorPinsFast<EN,IN1,IN2[,PWM]>
+they are fixed at compile time, so every pin change is a single port
+register write (see FastPin.h), and begin() takes no arguments.
+
+For older sketches, MotorDrive and MotorDriveFast<> name the driver
+selected by defining DBH1 or WTH3615D (or neither, for a plain L298).
 
 Aaron Birenboim, http://boim.com    28jul2015
 provided under LGPL license
@@ -37,319 +50,176 @@ If you do use this code please retain credit to above as originator.
 
 */
 
-// motor states (I'm afraid of enum which might be 16 bit on 8-bit MCU)
-#define MOTOR_STOPPED   0     // 1's -- running bit
-#define MOTOR_FWD       1     // 2's -- direction (1==rev)
-#define MOTOR_REV       3
-#define MOTOR_START_FWD 5     // 4's -- start-up pulse
-#define MOTOR_START_REV 7
-#define MOTOR_STOPPING  8     // 8 -- electrical braking
+#ifndef MOTOR_DRIVE_298_H
+#define MOTOR_DRIVE_298_H
 
-#ifndef ABS
-#define ABS(x)  (((x)<0)?(-(x)):(x))
-#endif
+#include "MotorDriveCore.h"
+#include "MotorPins.h"
 
-typedef byte  BYTE;  // signed char, 8-bit
-typedef short SHORT; // signed int, 16-bit
-
-// ----------- Global state classes:
-#include "MotorDriveBase.h"
-class MotorDrive : public MotorDriveBase
+template<class PINS=MotorPins>
+class L298Drive : public MotorDriveCore< L298Drive<PINS> >
 {
-protected:
-  inline int clipPWM(int pwm)
-  {
-    if (ABS(pwm) > 255)
-      pwm = (pwm < 0) ? -255 : 255;
-    return(pwm);
-  }
-  inline int getPWM(int pwm)
-  {
-    return(ABS(clipPWM(pwm)));
-  }
+  typedef MotorDriveCore< L298Drive<PINS> > Core;
 
   void setReverse(bool rev) // true==set reverse direction, false==forward
   {
-    if (rev)
-      {
-        digitalWrite(Pin.IN2,0);
-#ifdef DBH1
-        analogWrite(Pin.IN1,250);
-#else
-        digitalWrite(Pin.IN1,1);
-#endif
-      }
-    else
-      {
-        digitalWrite(Pin.IN1,0);
-#ifdef DBH1
-        analogWrite(Pin.IN2,250);
-#else
-        digitalWrite(Pin.IN2,1);
-#endif
-      }
+    if (rev) { Pin.in2(0); Pin.in1(1); }
+    else     { Pin.in1(0); Pin.in2(1); }
   }
-  
-public:
-  struct {
-    // it does not seem to hurt to have IN1=IN2=1, but it doesn't seem
-    // to do anything different/useful, so try to avoid this state.
 
-    BYTE IN1, IN2;  // forward/reverse selectors.
-    BYTE EN;        // enable pin
-#ifdef DBH1
-    BYTE CS;
-#endif
-#ifdef WTH3615D
-    BYTE PWM;
-#endif
-  } Pin;
-  SHORT _speed;     // current speed
-  SHORT _speedCmd;  // commanded speed
+  bool _dirPwm = false;  // PWM on the direction input, not EN
 
-  float _decel; // time to allow to stop, in ms / PWM count
-  BYTE _mode;
-  unsigned long _doneTime;  // time when mode automatically transitions
-  SHORT _deadTime;    // ms until deadman transition to emergency stop
-  SHORT _maxPWM;      // clip PWM commands to this magnitude
-  SHORT _startupTime; // ms of full-power pulse to start from dead stop
-  SHORT _stopTime;    // ms to lock-out commands after emergency stop
+public:
+  PINS Pin;
+  static const bool passThrough = true;  // direction pins can flip at zero PWM
 
-  BYTE _msgCount;   // turn off diagnostics after this many messages
-  
-  MotorDrive(const float decel=2.0,
-             const int deadTime=500,
-             const int startupTime=50,
-             const int stopTime=3000,
-             const int maxPWM=255)
-  {
-    _deadTime = deadTime; // emergency stop if no command update in this time interval
-    _maxPWM = maxPWM;     // don't go over this PWM level.  driver can't do it
-    _startupTime = startupTime; // when starting from still, issue full power pulse this long to get motors started
-    _stopTime = stopTime;  // Pause at least this long after emergency stop before restarting
-    _decel = decel; // allow decel ms/speed_count to come to a full stop
+  using Core::Core;
+  using Core::begin;
 
-    _speed = _speedCmd = 0;
-    
-    _msgCount = 11;  // issue this many diagnostic messages before going quiet
-  }
+  // PWM the direction input, with EN held on, rather than EN.
+  // Set before begin(), or while stopped
+  void setDirPwm(const bool on) { _dirPwm = on; }
 
   // in Arduino, users may set up motor drivers global,
   // but typically initialize pins in start() routine.
   // so I have a seperate begin() to set up pins
-  void begin(const int en, const int in1, const int in2
-  #ifdef DBH1
-    , const int cs
-  #endif
-  #ifdef WTH3615D
-    , const int ppwm
-  #endif
-        )
+  void begin(const int en, const int in1, const int in2)
   {
-    pinMode(en,OUTPUT);
-    digitalWrite(en,0);   // make sure we are disabled ASAP
-    Pin.EN  =en;
-    Pin.IN1 =in1;
-    Pin.IN2 =in2;
-#ifdef DBH1
-    Pin.CS  =cs;
-#endif
-#ifdef WTH3615D
-    Pin.PWM=ppwm;
-    pinMode(Pin.PWM,OUTPUT);
-    analogWrite(Pin.PWM,0);
-#endif
-    pinMode(Pin.IN1,OUTPUT);
-    pinMode(Pin.IN2,OUTPUT);
-    
-    emergencyStop();
+    Pin.set(en,in1,in2);
+    begin();
   }
 
-  virtual void setCommandTimeout(const int ms) { _deadTime = ms; }
-  void setDecelRate(const float msPerCount) { _decel=msPerCount; }
-  void setStartPulseDuration(const int ms) { _startupTime=ms; }
-  void setStopTimeout(const int ms) { _stopTime=ms; }
-  void showDiagnostics(const int n) { _msgCount=n; }
-  void showState()
+  void hwInit()
   {
-    //BYTE IN1, IN2;  // forward/reverse selectors.
-    //BYTE EN;        // enable pin
-    //SHORT _speed;     // current speed
-    //SHORT _speedCmd;  // commanded speed
-    Serial.print(F("Decel "));Serial.print(_decel);Serial.println(F("ms/count"));
-    //BYTE _mode;
-    //unsigned long _doneTime;  // time when mode automatically transitions
-    Serial.print(F("Deadman Timeout "));Serial.print(_deadTime);Serial.println(F("ms"));
-  //SHORT _maxPWM;      // clip PWM commands to this magnitude
-  //SHORT _startupTime; // ms of full-power pulse to start from dead stop
-  //SHORT _stopTime;    // ms to lock-out commands after emergency stop
-
+    Pin.modes();
+    Pin.en(0);   // make sure we are disabled ASAP
   }
-  
-  virtual void stop()
+  void hwBrake()
   {
-    _speedCmd=0;
-    digitalWrite(Pin.EN , 0);
-    digitalWrite(Pin.IN1, 0);
-    digitalWrite(Pin.IN2, 0);
-#ifdef WTH3615D
-    analogWrite(Pin.PWM, 0);
-#endif
-    digitalWrite(Pin.EN , 1);
-    int stoppingTime = (int)ABS(_speed * _decel);
-if(_msgCount>0){_msgCount--;Serial.print(stoppingTime);Serial.println(" ms to stop.");}
-    _doneTime = millis() + stoppingTime;
-    //speed=0;  don't clobber command in case of direction change
-    _mode = MOTOR_STOPPING;
+    Pin.en(0);
+    Pin.in1(0);
+    Pin.in2(0);
+    Pin.en(1);
   }
-
-  virtual void emergencyStop()
+  void hwHold()
   {
-    Serial.print("Emergency ");
-    _msgCount = 11;  // turn on diagnostics for a few commands
-    stop();
-    _speedCmd=0;
-    _doneTime += _stopTime;
+    Pin.in1(0);
+    Pin.in2(0);
+    Pin.en(1);  // brake
   }
-
-
-  // Set speed -MAX_PWM for max reverse, MAX_PWM for max forward
-  virtual void setSpeed(const int spdReq, unsigned long t)
+  void hwKick(const bool rev)
   {
-    BYTE prevMode = _mode;
-    bool rev;
-    switch(prevMode)
-      {
-      case MOTOR_STOPPING :
-        _speedCmd = spdReq;
-        if ((unsigned long)t < _doneTime)
-          {  // make sure things are stopped
-            digitalWrite(Pin.IN1,0);
-            digitalWrite(Pin.IN2,0);
-            digitalWrite(Pin.EN ,1);  // brake
-            return;
-          }
-        // done stoping, continue to STOP mode
-        _speed = 0;
-        _mode = MOTOR_STOPPED;
-if(_msgCount>0){_msgCount--;Serial.println(F("stopped."));}
-      case MOTOR_STOPPED :
-        if (spdReq == 0) return;  // leave in full brake stop
-        _mode = (spdReq < 0) ? MOTOR_START_REV : MOTOR_START_FWD;
-        rev = (_mode == MOTOR_START_REV);
-        digitalWrite(rev?Pin.IN1:Pin.IN2,1); // don't worry about PWM
-        digitalWrite(rev?Pin.IN2:Pin.IN1,0); // this is transistional state
-#ifdef WTH3615D
-        analogWrite(Pin.PWM,255);
-#endif
-        digitalWrite(Pin.EN,1);   // hard kick to get started
-        _doneTime = t + _startupTime;
-        _speedCmd = spdReq;
-if(_msgCount>0){_msgCount--;
-Serial.print(F("Start "));
-Serial.println(rev ? F("REV") : F("FWD"));}
-        return;
-      case MOTOR_FWD :
-      case MOTOR_REV :
-        if (t > _doneTime) { emergencyStop(); return; } // deadman expired
-        if ( (spdReq == 0)  ||  // stop or change direction
-             ((spdReq < 0) && (prevMode == MOTOR_FWD)) ||
-             ((spdReq > 0) && (prevMode == MOTOR_REV)) )
-          {
-            stop();
-            _speedCmd = clipPWM(spdReq);
-            return;
-          }
-        setReverse(spdReq < 0);
-        _speed = _speedCmd = spdReq;
-#ifdef WTH3615D
-        digitalWrite(Pin.EN,1);
-        analogWrite(Pin.PWM,getPWM(_speed));
-#else
-        analogWrite(Pin.EN,getPWM(_speed));
-#endif
-        _doneTime = t + _deadTime;
-//if(_msgCount>0){_msgCount--;Serial.println(_speed);}
-        return;
-      case MOTOR_START_REV :
-      case MOTOR_START_FWD :
-        if (spdReq == 0)
-          {
-            _speed = 100;  // give it some time to decel, although just starting
-            stop();
-            return;
-          }
-        if ( ((spdReq < 0) && (_mode == MOTOR_START_FWD)) ||
-             ((spdReq > 0) && (_mode == MOTOR_START_REV)) )
-          { // direction change
-            _speed = 100;  // give it some time to decel, although just starting
-            stop();
-            _speedCmd = spdReq;  // go to this speed after coast-down period
-            return;
-          }
-        // same direction, but speed request change
-        _speed = _speedCmd = spdReq;
-        if (t >= _doneTime)
-          {
-            _mode = (_speedCmd > 0) ? MOTOR_FWD : MOTOR_REV;
-            _doneTime = t + _deadTime;
-            setReverse(_mode == MOTOR_REV);  // make sure direction is correct
-#ifdef WTH3615D
-            digitalWrite(Pin.EN,1);
-            analogWrite(Pin.PWM,getPWM(_speedCmd));
-#else
-            analogWrite(Pin.EN,getPWM(_speedCmd));
-#endif
-            if(_msgCount>0){_msgCount--;Serial.print(F("Started"));Serial.println(_speedCmd);}
-          }
+    setReverse(rev);  // don't worry about PWM, this is transistional state
+    Pin.en(1);
+  }
+  void hwDrive(const bool rev, const unsigned short duty)
+  {
+    if (_dirPwm)
+      {  // off part of the cycle has both inputs low: brake
+        if (rev) { Pin.in2(0); Pin.in1Duty(duty); }
+        else     { Pin.in1(0); Pin.in2Duty(duty); }
+        Pin.en(1);
         return;
       }
+    setReverse(rev);
+    Pin.enDuty(duty);
   }
+  byte hwPwmPin() const { return(_dirPwm ? Pin.in1Pin() : Pin.enPin()); }
+};
+
+// L298 logic, plus a PWM input.  EN is held on, and PWM sets the speed
+template<class PINS=MotorPins>
+class WTH3615DDrive : public MotorDriveCore< WTH3615DDrive<PINS> >
+{
+  typedef MotorDriveCore< WTH3615DDrive<PINS> > Core;
 
-  // update state, but no new command was received
-  // Check if previous command is complete,
-  //   and an automatic state transition is needed
-  virtual void update(unsigned long t)  // current time, from millis()
+  void setReverse(bool rev) // true==set reverse direction, false==forward
   {
-//Serial.print(F("Update "));  Serial.println(t);
-    if ((_doneTime > 0xfffff000) && (t < 999))
-      {  // time counter must have wrapped around
-        _doneTime = 0;
-        Serial.println(F("Clock wrap-around"));
-      }
+    if (rev) { Pin.in2(0); Pin.in1(1); }
+    else     { Pin.in1(0); Pin.in2(1); }
+  }
 
-    byte prevMode = _mode;
-    switch(prevMode)
-      {
-      case MOTOR_STOPPING : 
-      case MOTOR_STOPPED :
-        if ((t > _doneTime) && _speedCmd)
-          { // this was a temp stop in a direction change.  Command desired speed.
-if(_msgCount>0){_msgCount--;Serial.print(F("Restart "));Serial.println(_speedCmd);}
-            setSpeed(_speedCmd,t);
-          }
-//else Serial.println("stopped.");
-        return;
-      case MOTOR_FWD :
-      case MOTOR_REV :
-        if (t > _doneTime) emergencyStop(); // deadman expired
-        return;
-      case MOTOR_START_REV :
-      case MOTOR_START_FWD :
-        if (t > _doneTime)
-          {
-if(_msgCount>0){_msgCount--;Serial.println(F("moving"));}
-            setSpeed(_speedCmd,t);
-          }
-        return;
-      }
+public:
+  PINS Pin;
+  static const bool passThrough = true;  // direction pins can flip at zero PWM
+
+  using Core::Core;
+  using Core::begin;
+
+  void begin(const int en, const int in1, const int in2, const int ppwm)
+  {
+    Pin.set(en,in1,in2,ppwm);
+    begin();
   }
 
-#ifdef DBH1
-  int getCurrentCounts()
+  void hwInit()
   {
-    return(analogRead(Pin.CS));
+    Pin.modes();
+    Pin.en(0);   // make sure we are disabled ASAP
+    Pin.pwm(0);
   }
-#endif
+  void hwBrake()
+  {
+    Pin.en(0);
+    Pin.in1(0);
+    Pin.in2(0);
+    Pin.pwm(0);
+    Pin.en(1);
+  }
+  void hwHold()
+  {
+    Pin.in1(0);
+    Pin.in2(0);
+    Pin.en(1);  // brake
+  }
+  void hwKick(const bool rev)
+  {
+    setReverse(rev);
+    Pin.pwm(255);
+    Pin.en(1);
+  }
+  void hwDrive(const bool rev, const unsigned short duty)
+  {
+    setReverse(rev);
+    Pin.en(1);
+    Pin.pwmDuty(duty);
+  }
+  byte hwPwmPin() const { return(Pin.pwmPin()); }
+};
 
+// Driver selected by the DBH1 / WTH3615D defines, for older sketches
+#if defined(DBH1)
+#include "MotorDriveDBH1.h"
+// With DBH1, this driver used to be the L298 one with DBH1 pin changes,
+// so MotorDrive keeps the L298 defaults: 500 ms deadman, 50 ms start
+// pulse, PWM up to 255 with no minimum, and the direction input at 250.
+// DBH1Drive<> keeps those of the old stand-alone DBH1 driver
+template<class PINS=MotorPins>
+class DBH1Drive298 : public DBH1Drive<PINS>
+{
+public:
+  DBH1Drive298(const float decel=2.0,
+               const int deadTime=500,
+               const int startupTime=50,
+               const int stopTime=3000,
+               const int maxPWM=255,
+               const int minPWM=1)
+    : DBH1Drive<PINS>(decel,deadTime,startupTime,stopTime,maxPWM,minPWM)
+  {
+    this->_dirPWM = 250;
+  }
 };
+typedef DBH1Drive298<> MotorDrive;
+template<byte EN, byte IN1, byte IN2, byte CS>
+using MotorDriveFast = DBH1Drive298< MotorPinsFast<EN,IN1,IN2,NO_PIN,CS> >;
+#elif defined(WTH3615D)
+typedef WTH3615DDrive<> MotorDrive;
+template<byte EN, byte IN1, byte IN2, byte PWM>
+using MotorDriveFast = WTH3615DDrive< MotorPinsFast<EN,IN1,IN2,PWM> >;
+#else
+typedef L298Drive<> MotorDrive;
+template<byte EN, byte IN1, byte IN2>
+using MotorDriveFast = L298Drive< MotorPinsFast<EN,IN1,IN2> >;
+#endif
+
+#endif
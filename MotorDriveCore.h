@@ -0,0 +1,568 @@
+/*
+Stop / start-pulse / deadman state machine shared by the H-bridge drivers.
+
+MotorDriveCore<HW> holds the motor state and its parameters (a
+MotorState), and runs the mode transitions (MotorStateMachine, which
+MotorBank.h runs on each of its channels too).  The hardware specific
+part is the HW class, which derives from MotorDriveCore<HW> (CRTP) and
+supplies these hooks:
+
+    void hwInit()                   -- set up pins, motor disabled
+    void hwBrake()                  -- electrical brake, from any state
+    void hwHold()                   -- keep braking, already in brake
+    void hwKick(bool rev)           -- full power start-up pulse
+    void hwDrive(bool rev, unsigned short duty)
+                                    -- run at duty in given direction, in
+                                       PWM counts, Q7 (0..255<<7)
+    byte hwPwmPin()                 -- the pin that carries the speed PWM
+
+and may declare  static const bool passThrough = true;  if it is safe to
+flip direction while driving, with no brake in between.
+
+Speed changes take effect at once, unless a ramp is set with
+setRampRates().  Then update() slews the output toward the commanded
+speed in fixed point (Q7, 1/128 count) at the accel rate when speeding
+up, and the decel rate when slowing down.  A direction change ramps
+down through zero, and straight on up the other way if the driver
+allows it, or brakes briefly at zero if not.
+
+setPwm() sets the PWM frequency and resolution of the speed pin (see
+Pwm.h).  With more than 8 bits, the ramp's Q7 output goes to the pin
+at full resolution, so low speeds are no longer 8 bit steps.  Speeds
+stay -255..255 at any resolution.
+
+setOutputMap() gives the motor a 256 entry table in PROGMEM, speed to
+PWM, applied after the _minPWM test and before the _maxPWM clip.  It
+lifts low speeds over the motor's deadband, and straightens out its
+response (see MotorMap.h).  Between entries the Q7 output is
+interpolated, so a lookup is a fixed few instructions at any speed.
+
+All calls are resolved at compile time, so there is no vtable, and drivers
+for different H-bridges can be mixed freely on one robot.
+
+Motor drives take speed commands from -255..255, with negative
+numbers for reverse.  If commands are not updated reguarly, the
+motor is commanded to stop.
+
+State changes are logged to Tel (see Telemetry.h), tagged with the
+id given to setId().
+
+Times (t) are ticks of MOTOR_CLOCK(): millis(), or with MOTOR_MICROS
+defined before including this, micros(), for sub-millisecond start-up
+pulses (setStartPulseUs()) and brake windows.  Other parameters stay
+in ms.  Every deadline is a Deadline (see Deadline.h), tested by time
+elapsed since it was set, so the clock's wrap-around is harmless.
+
+trip() is for an interrupt, e.g. an overcurrent (see CurrentSense.h):
+it brakes at once, and the emergencyStop() follows, outside the
+interrupt, on the next setSpeed() or update().  A trip in the middle of
+a drive or start pulse pin sequence is braked again at its end, as the
+rest of the sequence drove the bridge again.
+
+provided under LGPL license
+*/
+#ifndef MOTOR_DRIVE_CORE_H
+#define MOTOR_DRIVE_CORE_H
+
+// motor states (I'm afraid of enum which might be 16 bit on 8-bit MCU)
+#define MOTOR_STOPPED   0     // 1's -- running bit
+#define MOTOR_FWD       1     // 2's -- direction (1==rev)
+#define MOTOR_REV       3
+#define MOTOR_START_FWD 5     // 4's -- start-up pulse
+#define MOTOR_START_REV 7
+#define MOTOR_STOPPING  8     // 8 -- electrical braking
+
+#ifndef ABS
+#define ABS(x)  (((x)<0)?(-(x)):(x))
+#endif
+
+typedef byte  BYTE;  // signed char, 8-bit
+typedef short SHORT; // signed int, 16-bit
+
+#include "Telemetry.h"
+#include "Pwm.h"
+#include "Deadline.h"
+
+#ifdef MOTOR_MICROS
+#define MOTOR_CLOCK() micros()
+#define MOTOR_TICKS_PER_MS 1000UL
+#else
+#define MOTOR_CLOCK() millis()
+#define MOTOR_TICKS_PER_MS 1UL
+#endif
+
+// A driver object's state and parameters, for MotorStateMachine
+struct MotorState
+{
+  typedef uint32_t Tick;  // of MOTOR_CLOCK(), as kept
+
+  SHORT _speed;     // current speed
+  SHORT _speedCmd;  // commanded speed
+
+  unsigned short _decel; // time to allow to stop, in ms / PWM count, Q8 (x256)
+  BYTE _mode;
+  Deadline _done;           // mode automatically transitions when passed
+  SHORT _out;               // ramped output speed, Q7 (x128)
+  Tick _rampTime;           // of last ramp step
+  unsigned short _accelRate;  // ramp up, PWM counts / ms, Q7.  0 == at once
+  unsigned short _decelRate;  // ramp down, PWM counts / ms, Q7.  0 == at once
+  SHORT _deadTime;    // ms until deadman transition to emergency stop
+  SHORT _maxPWM;      // clip PWM commands to this magnitude
+  SHORT _minPWM;      // motors won't move below this level
+  uint32_t _startupTime; // ticks of full-power pulse to start from dead stop
+  SHORT _stopTime;    // ms to lock-out commands after emergency stop
+  const byte *_map;   // PROGMEM speed to PWM table, 0 for none
+
+  BYTE _pwmBits;    // speed pin PWM resolution, see setPwm()
+  BYTE _id;         // tags this motor's telemetry records
+  volatile BYTE _tripped;  // set by trip(), from an interrupt
+
+  MotorState(const float decel=2.0,
+             const int deadTime=500,
+             const int startupTime=50,
+             const int stopTime=3000,
+             const int maxPWM=255,
+             const int minPWM=1)
+  {
+    _deadTime = deadTime; // emergency stop if no command update in this time interval
+    _maxPWM = maxPWM;     // don't go over this PWM level.  driver can't do it
+    _minPWM = minPWM;     // below this, treat command as a stop
+    _startupTime = startupTime * MOTOR_TICKS_PER_MS; // when starting from still, issue full power pulse this long to get motors started
+    _stopTime = stopTime;  // Pause at least this long after emergency stop before restarting
+    _decel = (unsigned short)(decel * 256 + 0.5f); // allow decel ms/speed_count to come to a full stop
+    _accelRate = _decelRate = 0;  // no ramp, speed changes take effect at once
+
+    _speed = _speedCmd = _out = 0;
+    _map = 0;
+    _pwmBits = 8;
+    _id = 0;
+    _tripped = 0;
+  }
+
+protected:
+  // MotorStateMachine reaches the state through these, so that a
+  // MotorBank channel can give its own from the bank's arrays
+  inline SHORT &speed() { return(_speed); }
+  inline SHORT &speedCmd() { return(_speedCmd); }
+  inline BYTE &mode() { return(_mode); }
+  inline SHORT speed() const { return(_speed); }
+  inline SHORT speedCmd() const { return(_speedCmd); }
+  inline BYTE mode() const { return(_mode); }
+  inline Deadline &done() { return(_done); }
+  inline SHORT &out() { return(_out); }
+  inline Tick &rampTime() { return(_rampTime); }
+  inline volatile BYTE &tripped() { return(_tripped); }
+  // parameters, read only
+  inline unsigned short decel() const { return(_decel); }
+  inline unsigned short accelRate() const { return(_accelRate); }
+  inline unsigned short decelRate() const { return(_decelRate); }
+  inline SHORT deadTime() const { return(_deadTime); }
+  inline SHORT maxPWM() const { return(_maxPWM); }
+  inline SHORT minPWM() const { return(_minPWM); }
+  inline uint32_t startupTime() const { return(_startupTime); }
+  inline SHORT stopTime() const { return(_stopTime); }
+  inline const byte *outMap() const { return(_map); }
+  inline BYTE pwmBits() const { return(_pwmBits); }
+  inline BYTE id() const { return(_id); }
+};
+
+// The stop / start-pulse / deadman / ramp transitions of one motor, on
+// the state STATE's accessors give (a MotorState's own fields, or one
+// channel's entries in a MotorBank's arrays), driving the hardware
+// through HW's hooks
+template<class HW, class STATE>
+class MotorStateMachine : public STATE
+{
+public:
+  using STATE::STATE;
+
+protected:
+  using STATE::speed;
+  using STATE::speedCmd;
+  using STATE::mode;
+  using STATE::done;
+  using STATE::out;
+  using STATE::rampTime;
+  using STATE::tripped;
+  using STATE::decel;
+  using STATE::accelRate;
+  using STATE::decelRate;
+  using STATE::deadTime;
+  using STATE::maxPWM;
+  using STATE::minPWM;
+  using STATE::startupTime;
+  using STATE::stopTime;
+  using STATE::outMap;
+  using STATE::pwmBits;
+  using STATE::id;
+
+  inline HW &hw() { return(*static_cast<HW *>(this)); }
+
+  inline int clipPWM(int pwm)
+  {
+    if (ABS(pwm) > maxPWM())
+      pwm = (pwm < 0) ? -maxPWM() : maxPWM();
+    return(pwm);
+  }
+  // Q7 speed to Q7 duty: through the output map, clipped to maxPWM(),
+  // 0 below minPWM()
+  inline unsigned short getDuty(long q)
+  {
+    q = ABS(q);
+    if ((q >> 7) < minPWM()) return(0);
+    if (outMap()) q = mapDuty(q);
+    if (q > ((long)maxPWM() << 7)) q = (long)maxPWM() << 7;
+    return((unsigned short)q);
+  }
+  // Q7 speed to Q7 duty, interpolating between output map entries
+  inline long mapDuty(const long q)
+  {
+    if (q >= Q7MAX) return((long)pgm_read_byte(outMap() + 255) << 7);
+    byte i = q >> 7;
+    long a = pgm_read_byte(outMap() + i);
+    long b = pgm_read_byte(outMap() + i + 1);
+    return((a << 7) + (b - a) * (q & 127));
+  }
+  inline uint32_t deadTicks() { return((uint32_t)deadTime() * MOTOR_TICKS_PER_MS); }
+  // too slow to move counts as a stop
+  inline bool isStop(const int spd) { return(ABS(spd) < minPWM()); }
+
+  // after a pin sequence that drives the bridge: a trip() that came in
+  // the middle of it was undone by the rest, so brake again
+  inline void tripCheck() { if (tripped()) hw().hwBrake(); }
+
+  void tripStop()
+  {
+    tripped() = 0;
+    Tel.log(TEL_OVERCURRENT,id());
+    emergencyStop();
+  }
+
+  // ticks of electrical brake to stop from current speed
+  inline uint32_t stoppingTime()
+  {
+    return(((uint32_t)ABS(speed()) * decel() * MOTOR_TICKS_PER_MS) >> 8);
+  }
+
+  static const SHORT Q7MAX = 255 << 7;  // full speed, Q7
+
+  // Q7 speed change at rate (Q7 per ms) over ticks, at most full speed
+  static inline uint32_t rampStep(const unsigned short rate, const uint32_t ticks)
+  {
+    uint32_t ms = ticks / MOTOR_TICKS_PER_MS;
+    if (ms >= (uint32_t)Q7MAX) return(Q7MAX);  // rate is at least 1
+    uint32_t q = rate * ms + rate * (ticks % MOTOR_TICKS_PER_MS) / MOTOR_TICKS_PER_MS;
+    return((q > (uint32_t)Q7MAX) ? Q7MAX : q);
+  }
+
+  // Slew out() toward speedCmd(), for the ticks since the last call.
+  void ramp(const uint32_t t)
+  {
+    uint32_t dt = (typename STATE::Tick)(t - rampTime());
+    rampTime() = t;
+    long cur = out();
+    long target = (long)speedCmd() * 128;
+    if (cur == target) return;
+
+    bool up = (cur == 0) || ((cur > 0) ? (target > cur) : (target < cur));
+    unsigned short rate = up ? accelRate() : decelRate();
+    uint32_t step = rate ? rampStep(rate,dt) : (uint32_t)Q7MAX;  // 0: at once
+    long next = (target > cur) ? cur + (long)step : cur - (long)step;
+    if ((target > cur) ? (next > target) : (next < target)) next = target;
+    if (((cur > 0) && (next < 0)) || ((cur < 0) && (next > 0)))
+      next = 0;  // direction changes happen at zero
+    out() = next;
+
+    int spd = next / 128;
+    if (!up && isStop(spd))
+      {  // slowed to a stop, on the way to zero or through it
+        if (HW::passThrough && speedCmd())
+          {  // carry on up the other way, no brake
+            if (next == 0) mode() = (speedCmd() < 0) ? MOTOR_REV : MOTOR_FWD;
+          }
+        else
+          {
+            SHORT cmd = speedCmd();
+            speed() = spd;
+            stop();  // brief brake.  update() restarts toward cmd, if any
+            speedCmd() = cmd;
+            return;
+          }
+      }
+    if ((spd != speed()) || (pwmBits() > 8))
+      {
+        speed() = spd;
+        hw().hwDrive(mode() == MOTOR_REV, getDuty(next));
+        tripCheck();
+      }
+  }
+
+public:
+  // HW may override: true if direction can flip while driving
+  static const bool passThrough = false;
+
+  // either way
+  inline bool ramping() const { return(accelRate() || decelRate()); }
+  // ramp on from the speed driven now, at t
+  void restartRamp(const uint32_t t)
+  {
+    out() = ((mode() == MOTOR_FWD) || (mode() == MOTOR_REV)) ? speed() * 128 : 0;
+    rampTime() = t;
+  }
+
+  void stop()
+  {
+    speedCmd()=0;
+    hw().hwBrake();
+    uint32_t ticks = stoppingTime();
+    Tel.log(TEL_STOP,id(),ticks / MOTOR_TICKS_PER_MS);
+    done().set(MOTOR_CLOCK(),ticks);
+    out() = 0;
+    //speed=0;  don't clobber command in case of direction change
+    mode() = MOTOR_STOPPING;
+  }
+
+  void emergencyStop()
+  {
+    Tel.log(TEL_EMERGENCY,id());
+    stop();
+    speedCmd()=0;
+    done().extend((uint32_t)stopTime() * MOTOR_TICKS_PER_MS);
+  }
+
+  // Brake now.  Safe from an interrupt
+  inline void trip()
+  {
+    hw().hwBrake();
+    tripped() = 1;
+  }
+
+  // speed the motor is driven at now, signed.  0 braking or stopped, and
+  // the speed to come during a start pulse.  For dead reckoning with no
+  // encoders (see Odometry.h)
+  inline int driveSpeed() const
+  {
+    if (!(mode() & 1)) return(0);
+    return((mode() & 4) ? speedCmd() : speed());
+  }
+
+  inline void setSpeed(const int spdReq) { setSpeed(spdReq,MOTOR_CLOCK()); }
+
+  // Set speed -MAX_PWM for max reverse, MAX_PWM for max forward
+  void setSpeed(const int spdReq, const uint32_t t)
+  {
+    if (tripped()) { tripStop(); return; }
+    BYTE prevMode = mode();
+    bool rev;
+    switch(prevMode)
+      {
+      case MOTOR_STOPPING :
+        speedCmd() = isStop(spdReq) ? 0 : spdReq;
+        if (!done().reached(t))
+          {  // make sure things are stopped
+            hw().hwHold();
+            return;
+          }
+        // done stoping, continue to STOP mode
+        speed() = 0;
+        mode() = MOTOR_STOPPED;
+        Tel.log(TEL_STOPPED,id());
+      case MOTOR_STOPPED :
+        if (isStop(spdReq)) return;  // leave in full brake stop
+        mode() = (spdReq < 0) ? MOTOR_START_REV : MOTOR_START_FWD;
+        rev = (mode() == MOTOR_START_REV);
+        hw().hwKick(rev);   // hard kick to get started
+        tripCheck();
+        done().set(t,startupTime());
+        speedCmd() = spdReq;
+        Tel.log(TEL_START,id(),spdReq);
+        return;
+      case MOTOR_FWD :
+      case MOTOR_REV :
+        if (done().passed(t)) { emergencyStop(); return; } // deadman expired
+        if (ramping())
+          {  // update() ramps toward the new speed
+            speedCmd() = isStop(spdReq) ? 0 : clipPWM(spdReq);
+            done().set(t,deadTicks());
+            ramp(t);
+            return;
+          }
+        if ( isStop(spdReq)  ||  // stop or change direction
+             ((spdReq < 0) && (prevMode == MOTOR_FWD)) ||
+             ((spdReq > 0) && (prevMode == MOTOR_REV)) )
+          {
+            stop();
+            // go to this speed after coast-down
+            speedCmd() = isStop(spdReq) ? 0 : clipPWM(spdReq);
+            return;
+          }
+        speed() = speedCmd() = spdReq;
+        hw().hwDrive(spdReq < 0, getDuty((long)speed() << 7));
+        tripCheck();
+        done().set(t,deadTicks());
+        return;
+      case MOTOR_START_REV :
+      case MOTOR_START_FWD :
+        if (isStop(spdReq))
+          {
+            speed() = 100;  // give it some time to decel, although just starting
+            stop();
+            return;
+          }
+        if ( ((spdReq < 0) && (mode() == MOTOR_START_FWD)) ||
+             ((spdReq > 0) && (mode() == MOTOR_START_REV)) )
+          { // direction change
+            speed() = 100;  // give it some time to decel, although just starting
+            stop();
+            speedCmd() = spdReq;  // go to this speed after coast-down period
+            return;
+          }
+        // same direction, but speed request change
+        speed() = speedCmd() = spdReq;
+        if (done().reached(t))
+          {
+            mode() = (speedCmd() > 0) ? MOTOR_FWD : MOTOR_REV;
+            done().set(t,deadTicks());
+            if (ramping())
+              {  // ramp on from where the kick would have got us
+                long cmd = (long)ABS(speedCmd()) << 7;
+                uint32_t q = accelRate() ? rampStep(accelRate(),startupTime()) : (uint32_t)cmd;
+                out() = (q < (uint32_t)cmd) ? (SHORT)q : (SHORT)cmd;
+                if (speedCmd() < 0) out() = -out();
+                speed() = out() / 128;
+                rampTime() = t;
+              }
+            hw().hwDrive(mode() == MOTOR_REV, getDuty(ramping() ? out() : (long)speed() << 7));
+            tripCheck();
+            Tel.log(TEL_STARTED,id(),speed());
+          }
+        return;
+      }
+  }
+
+  // ms after t until update() next has anything to do, at most maxMs.
+  // 0 if it has to run every tick (ramping, or a trip to handle).
+  // For callers that can sleep between updates.
+  unsigned long idleTime(const uint32_t t, unsigned long maxMs)
+  {
+    if (tripped()) return(0);
+    switch(mode())
+      {
+      case MOTOR_STOPPING :
+      case MOTOR_STOPPED :
+        if (!speedCmd()) return(maxMs);  // stays braked until a command
+        break;
+      case MOTOR_FWD :
+      case MOTOR_REV :
+        if (ramping() && (out() != (long)speedCmd() * 128)) return(0);
+        break;
+      }
+    if (done().passed(t)) return(0);  // transition due now
+    unsigned long ms = done().remaining(t) / MOTOR_TICKS_PER_MS + 1;
+    return((ms < maxMs) ? ms : maxMs);
+  }
+
+  // update state, but no new command was received
+  // Check if previous command is complete,
+  //   and an automatic state transition is needed
+  void update(const uint32_t t)  // current time, from MOTOR_CLOCK()
+  {
+    if (tripped()) { tripStop(); return; }
+//Serial.print(F("Update "));  Serial.println(t);
+
+    BYTE prevMode = mode();
+    switch(prevMode)
+      {
+      case MOTOR_STOPPING :
+      case MOTOR_STOPPED :
+        if (!done().passed(t)) return;
+        if (speedCmd())
+          { // this was a temp stop in a direction change.  Command desired speed.
+            Tel.log(TEL_RESTART,id(),speedCmd());
+            setSpeed(speedCmd(),t);
+          }
+        else if (prevMode == MOTOR_STOPPING)
+          {  // done, while the deadline is still in reach of the clock
+            speed() = 0;
+            mode() = MOTOR_STOPPED;
+            Tel.log(TEL_STOPPED,id());
+          }
+//else Serial.println("stopped.");
+        return;
+      case MOTOR_FWD :
+      case MOTOR_REV :
+        if (done().passed(t)) emergencyStop(); // deadman expired
+        else if (ramping()) ramp(t);
+        return;
+      case MOTOR_START_REV :
+      case MOTOR_START_FWD :
+        if (done().passed(t))
+          {
+            Tel.log(TEL_MOVING,id());
+            setSpeed(speedCmd(),t);
+          }
+        return;
+      }
+  }
+};
+
+template<class HW>
+class MotorDriveCore : public MotorStateMachine<HW,MotorState>
+{
+  typedef MotorStateMachine<HW,MotorState> Machine;
+
+public:
+  using Machine::Machine;
+  using Machine::_decel;
+  using Machine::_startupTime;
+  using Machine::_deadTime;
+  using Machine::_stopTime;
+  using Machine::_accelRate;
+  using Machine::_decelRate;
+  using Machine::_id;
+  using Machine::_map;
+  using Machine::_pwmBits;
+
+  // for drivers whose pins are fixed at compile time
+  void begin()
+  {
+    this->hw().hwInit();
+    this->emergencyStop();
+  }
+
+  void setCommandTimeout(const int ms) { _deadTime = ms; }
+  void setDecelRate(const float msPerCount) { _decel = (unsigned short)(msPerCount * 256 + 0.5f); }
+  // PWM counts per ms, up and down, each 0 for immediate speed changes:
+  // e.g. (0, d) for soft stops only.  A ramp starts from the speed
+  // driven now
+  void setRampRates(const float accel, const float decel)
+  {
+    _accelRate = (unsigned short)(accel * 128 + 0.5f);
+    _decelRate = (unsigned short)(decel * 128 + 0.5f);
+    this->restartRamp(MOTOR_CLOCK());
+  }
+  void setStartPulseDuration(const int ms) { _startupTime = ms * MOTOR_TICKS_PER_MS; }
+  // finer than 1 ms with MOTOR_MICROS, else rounded down to whole ms
+  void setStartPulseUs(const unsigned long us) { _startupTime = us / (1000UL / MOTOR_TICKS_PER_MS); }
+  void setStopTimeout(const int ms) { _stopTime=ms; }
+  void setId(const BYTE id) { _id=id; }
+  // 256 bytes in PROGMEM, PWM for each speed 0..255.  0 for none
+  void setOutputMap(const byte *map) { _map = map; }
+
+  // PWM frequency and resolution of the speed pin, after begin().
+  // PWM_OK, or why not (see Pwm.h), leaving the pin as it was.
+  // The other pin on the same timer changes too
+  byte setPwm(const unsigned long hz, const byte bits)
+  {
+    byte r = pwmConfigure(this->hw().hwPwmPin(),hz,bits);
+    if (r == PWM_OK) _pwmBits = bits;
+    return(r);
+  }
+  void showState()
+  {
+    Serial.print(F("Decel "));Serial.print(_decel);Serial.println(F("/256 ms/count"));
+    Serial.print(F("Deadman Timeout "));Serial.print(_deadTime);Serial.println(F("ms"));
+  }
+};
+
+#endif
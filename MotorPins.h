@@ -0,0 +1,108 @@
+/*
+Pin sets for the H-bridge motor drivers.
+
+A driver only touches its pins through one of these, so the same
+driver logic runs with pins given at run time (MotorPins, filled in
+by begin()) or fixed at compile time (MotorPinsFast, see FastPin.h).
+
+provided under LGPL license
+*/
+#ifndef MOTOR_PINS_H
+#define MOTOR_PINS_H
+
+#include "FastPin.h"
+#include "Pwm.h"
+
+// pins chosen at run time.  Every access goes through digitalWrite/analogWrite
+struct MotorPins
+{
+  // it does not seem to hurt to have IN1=IN2=1, but it doesn't seem
+  // to do anything different/useful, so try to avoid this state.
+
+  byte IN1, IN2;  // forward/reverse selectors.
+  byte EN;        // enable pin
+  byte PWM;       // extra PWM input (WTH3615D), NO_PIN if none
+  byte CS;        // current sense analog input (DBH1), NO_PIN if none
+
+  MotorPins() : IN1(NO_PIN), IN2(NO_PIN), EN(NO_PIN), PWM(NO_PIN), CS(NO_PIN) {}
+
+  inline void set(const byte en, const byte in1, const byte in2,
+                  const byte pwm=NO_PIN, const byte cs=NO_PIN)
+  {
+    EN = en;
+    IN1 = in1;
+    IN2 = in2;
+    PWM = pwm;
+    CS = cs;
+  }
+
+  inline void modes()
+  {
+    pinMode(EN ,OUTPUT);
+    pinMode(IN1,OUTPUT);
+    pinMode(IN2,OUTPUT);
+    if (PWM != NO_PIN) pinMode(PWM,OUTPUT);
+  }
+  inline void en (const byte v) { digitalWrite(EN ,v); }
+  inline void in1(const byte v) { digitalWrite(IN1,v); }
+  inline void in2(const byte v) { digitalWrite(IN2,v); }
+  inline void in1PWM(const byte v) { analogWrite(IN1,v); }
+  inline void in2PWM(const byte v) { analogWrite(IN2,v); }
+  inline void pwm(const byte v) { analogWrite(PWM,v); }
+  // duty in PWM counts, Q7, at the resolution set with pwmConfigure()
+  inline void enDuty (const unsigned short d) { pwmWrite(EN ,d); }
+  inline void in1Duty(const unsigned short d) { pwmWrite(IN1,d); }
+  inline void in2Duty(const unsigned short d) { pwmWrite(IN2,d); }
+  inline void pwmDuty(const unsigned short d) { pwmWrite(PWM,d); }
+  inline int current() { return(analogRead(CS)); }
+  inline byte enPin()  const { return(EN); }
+  inline byte in1Pin() const { return(IN1); }
+  inline byte pwmPin() const { return(PWM); }
+  inline byte csPin()  const { return(CS); }
+};
+
+// pins fixed at compile time
+template<byte EN_PIN, byte IN1_PIN, byte IN2_PIN, byte PWM_PIN=NO_PIN, byte CS_PIN=NO_PIN>
+struct MotorPinsFast
+{
+  inline void modes()
+  {
+    FastPin<EN_PIN >::mode(OUTPUT);
+    FastPin<IN1_PIN>::mode(OUTPUT);
+    FastPin<IN2_PIN>::mode(OUTPUT);
+    FastPin<PWM_PIN>::mode(OUTPUT);
+  }
+  inline void en (const byte v) { FastPin<EN_PIN >::write(v); }
+  inline void in1(const byte v) { FastPin<IN1_PIN>::write(v); }
+  inline void in2(const byte v) { FastPin<IN2_PIN>::write(v); }
+  inline void in1PWM(const byte v) { FastPin<IN1_PIN>::pwm(v); }
+  inline void in2PWM(const byte v) { FastPin<IN2_PIN>::pwm(v); }
+  inline void pwm(const byte v) { FastPin<PWM_PIN>::pwm(v); }
+  inline void enDuty(const unsigned short d)
+  {
+    if (pwmHighRes(EN_PIN)) pwmWrite(EN_PIN,d);
+    else FastPin<EN_PIN>::pwm(pwmByte(d));
+  }
+  inline void in1Duty(const unsigned short d)
+  {
+    if (pwmHighRes(IN1_PIN)) pwmWrite(IN1_PIN,d);
+    else FastPin<IN1_PIN>::pwm(pwmByte(d));
+  }
+  inline void in2Duty(const unsigned short d)
+  {
+    if (pwmHighRes(IN2_PIN)) pwmWrite(IN2_PIN,d);
+    else FastPin<IN2_PIN>::pwm(pwmByte(d));
+  }
+  inline void pwmDuty(const unsigned short d)
+  {
+    if (pwmHighRes(PWM_PIN)) pwmWrite(PWM_PIN,d);
+    else FastPin<PWM_PIN>::pwm(pwmByte(d));
+  }
+  inline int current() { return(FastPin<CS_PIN>::read()); }
+  inline byte enPin()  const { return(EN_PIN); }
+  inline byte in1Pin() const { return(IN1_PIN); }
+  inline byte pwmPin() const { return(PWM_PIN); }
+  inline byte csPin()  const { return(CS_PIN); }
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+Dead-reckoning odometry: track travel integrated into an (x, y, heading)
+pose, on board, in fixed point.
+
+Each side's travel comes in as ticks: encoder counts (addCounts()), or
+without encoders the driven speed times the ms it ran (addSpeeds(), see
+MotorDriveCore::driveSpeed()), which is only as good as the speed's
+calibration to the battery and ground.  begin() takes the mm per tick,
+and the effective track width: on skid steer the tracks slip sideways
+in a turn, so the robot turns slower than the track speeds say, as if
+the tracks were further apart.
+
+Per update, with the travel dl, dr of each side:
+
+    heading += (dr - dl) / track
+    x += (dl + dr) / 2 * cos(heading at the middle of the step)
+    y += (dl + dr) / 2 * sin(...)
+
+x and y are kept in 1/256 mm, and the heading as a binary angle, 2^32
+to the turn, so it wraps by itself.  sin and cos come from a quarter
+wave table in PROGMEM, interpolated: a few multiplies, where float trig
+takes a millisecond or more on the AVR.  Update often enough that no
+side moves 128 mm between updates.
+
+The pose goes out as a frame of its own in the telemetry stream, every
+setRate() ms, when there is room for the whole frame:
+
+    TELEMETRY_POSE_SYNC, time (ms, low 16 bits), x (mm, 24 bit signed),
+    y (mm, 24 bit signed), heading (16 bit, 65536 to the turn)
+
+little-endian.  x is ahead at reset, y to the left, and the heading
+counts anticlockwise.  'o' resets the pose, and "O<ms>" sets the rate,
+0 for none (see Command.h).
+
+provided under LGPL license
+*/
+#ifndef ODOMETRY_H
+#define ODOMETRY_H
+
+#include "Telemetry.h"
+#include "Deadline.h"
+
+// sin over the quarter turn, in 64 steps, Q15
+const short OdometrySin[65] PROGMEM = {
+      0,  804, 1608, 2411, 3212, 4011, 4808, 5602, 6393, 7180, 7962, 8740, 9512,10279,11039,11793,
+  12540,13279,14010,14733,15447,16151,16846,17531,18205,18868,19520,20160,20788,21403,22006,22595,
+  23170,23732,24279,24812,25330,25833,26320,26791,27246,27684,28106,28511,28899,29269,29622,29957,
+  30274,30572,30853,31114,31357,31581,31786,31972,32138,32286,32413,32522,32610,32679,32729,32758,
+  32767 };
+
+// sin of a binary angle (65536 to the turn), Q15
+inline int odometrySin(const unsigned short a)
+{
+  unsigned short p = a & 0x3fff;
+  if (a & 0x4000) p = 0x4000 - p;  // second and fourth quarters mirror
+  byte i = p >> 8, f = p;
+  int s = pgm_read_word(&OdometrySin[i]);
+  if (f) s += ((long)((int)pgm_read_word(&OdometrySin[i+1]) - s) * f) >> 8;
+  return((a & 0x8000) ? -s : s);
+}
+
+inline int odometryCos(const unsigned short a) { return(odometrySin(a + 0x4000)); }
+
+class Odometry
+{
+public:
+  long _x, _y;          // 1/256 mm
+  uint32_t _heading;    // 2^32 to the turn
+  long _scale;          // 1/256 mm per tick, Q16
+  long _turn;           // heading per 1/256 mm of track difference
+  unsigned short _remL, _remR;  // fractions of 1/256 mm, carried
+  long _prevL, _prevR;  // counts at the last addCounts()
+  uint32_t _prevMs;     // time of the last addSpeeds()
+  unsigned short _frameMs;  // pose frame period, 0 for none
+  Deadline _frame;      // ms, next pose frame due
+
+  // mmPerTick : mm of track per encoder count, or per speed count per ms
+  // trackMm   : effective track width, mm
+  // frameMs   : pose frame period
+  void begin(const float mmPerTick, const float trackMm, const unsigned short frameMs=100)
+  {
+    _scale = (long)(mmPerTick * 256 * 65536 + 0.5f);
+    _turn = (long)(4294967296.0f / (6.2831853f * trackMm * 256) + 0.5f);
+    _prevL = _prevR = 0;
+    _prevMs = millis();
+    setRate(frameMs);
+    reset();
+  }
+
+  void reset()
+  {
+    _x = _y = 0;
+    _heading = 0;
+    _remL = _remR = 0;
+    _frame.set(millis(),0);  // send the new pose now
+  }
+
+  void setRate(const unsigned short ms)
+  {
+    _frameMs = ms;
+    _frame.set(millis(),0);
+  }
+
+  // mm, and 65536 to the turn
+  inline long x() const { return((_x + 128) >> 8); }
+  inline long y() const { return((_y + 128) >> 8); }
+  inline unsigned short heading() const { return((_heading + 0x8000) >> 16); }
+
+  // travel of each side, in ticks, since the last call
+  void add(const long ticksL, const long ticksR)
+  {
+    long dl = distance(ticksL,_remL);
+    long dr = distance(ticksR,_remR);
+    long turn = (dr - dl) * _turn;
+    unsigned short mid = (_heading + (turn >> 1) + 0x8000) >> 16;
+    _heading += turn;
+    long sum = dl + dr;  // twice the travel of the centre
+    _x += ((sum * odometryCos(mid)) + 0x8000) >> 16;
+    _y += ((sum * odometrySin(mid)) + 0x8000) >> 16;
+  }
+
+  // encoder positions, counts
+  void addCounts(const long countL, const long countR)
+  {
+    add(countL - _prevL,countR - _prevR);
+    _prevL = countL;
+    _prevR = countR;
+  }
+
+  // speeds driven since the last call, until ms (millis())
+  void addSpeeds(const int speedL, const int speedR, const uint32_t ms)
+  {
+    long dt = ms - _prevMs;
+    _prevMs = ms;
+    add((long)speedL * dt,(long)speedR * dt);
+  }
+
+  // Send a pose frame if one is due, and all of it fits in the TX buffer
+  // now.  Never waits.  Call between whole telemetry records
+  void send(const uint32_t ms)
+  {
+    if (!_frameMs || !_frame.reached(ms)) return;
+    if (Serial.availableForWrite() < TELEMETRY_POSE_LEN) return;  // next time
+    _frame.set(ms,_frameMs);
+    long x = this->x(), y = this->y();
+    unsigned short h = heading();
+    byte buf[TELEMETRY_POSE_LEN] = {
+      TELEMETRY_POSE_SYNC, (byte)ms, (byte)(ms >> 8),
+      (byte)x, (byte)(x >> 8), (byte)(x >> 16),
+      (byte)y, (byte)(y >> 8), (byte)(y >> 16),
+      (byte)h, (byte)(h >> 8) };
+    Serial.write(buf,TELEMETRY_POSE_LEN);
+  }
+
+protected:
+  // ticks to 1/256 mm, carrying the fraction in rem
+  inline long distance(const long ticks, unsigned short &rem) const
+  {
+    long q = ticks * _scale + rem;
+    rem = q & 0xffff;
+    return(q >> 16);
+  }
+};
+
+#endif
@@ -0,0 +1,138 @@
+/*
+Loop-time and command latency profiling.
+
+Define PROFILE before including this file (and Command.h) to keep a
+log2 histogram, max and count of:
+
+    PROFILE_LOOP       -- us between the starts of successive loop() passes
+    PROFILE_LATENCY_L  -- us from a left speed command's arrival
+    PROFILE_LATENCY_R     until its setSpeed() has written the pins, per motor
+
+Arrival is stamped by the RX interrupt when COMMAND_RX_ISR is set.
+Polling Serial, the bytes are only known to have come in since the
+previous drain(), so that time is used, and latency is an upper bound,
+high by at most one loop() pass.
+
+Bin k holds values with k significant bits (bin 0: 0, bin 1: 1,
+bin 2: 2..3, bin 3: 4..7 ...), and the last bin takes everything above.
+Bin counts stick at 65535.
+
+dump() (sent on '?') queues the histograms to Tel, as they fit, one
+record each for count and max, and one per non-empty bin:
+
+    TEL_PROF_COUNT  motor: histogram        value: count (unsigned, saturated)
+    TEL_PROF_MAX    motor: histogram        value: max us (unsigned, saturated)
+    TEL_PROF_BIN    motor: histogram<<5|bin value: count (unsigned)
+
+Without PROFILE the PROFILE_* macros expand to nothing, and no
+profiling code or RAM is left in the build.
+
+provided under LGPL license
+*/
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifdef PROFILE
+
+#include "Telemetry.h"
+
+#ifndef PROFILE_BINS
+#define PROFILE_BINS 16   // at most 32
+#endif
+
+#define PROFILE_LOOP      0
+#define PROFILE_LATENCY_L 1
+#define PROFILE_LATENCY_R 2
+#define PROFILE_HISTOGRAMS 3
+
+#define PROFILE_RECORDS (PROFILE_HISTOGRAMS * (PROFILE_BINS + 2))
+#define PROFILE_IDLE 0xff  // no dump in progress
+
+struct Histogram
+{
+  unsigned short bin[PROFILE_BINS];
+  unsigned long max;
+  unsigned long count;
+
+  // number of significant bits, without a 32 bit shift loop
+  static inline byte log2bin(unsigned long v)
+  {
+    byte k = 0;
+    if (v >> 16) { k  = 16; v >>= 16; }
+    if (v >>  8) { k +=  8; v >>=  8; }
+    byte b = v;
+    while (b) { b >>= 1; k++; }
+    return((k < PROFILE_BINS) ? k : PROFILE_BINS-1);
+  }
+
+  inline void add(const unsigned long v)
+  {
+    unsigned short &n = bin[log2bin(v)];
+    if (n != 0xffff) n++;
+    if (v > max) max = v;
+    count++;
+  }
+};
+
+class Profile
+{
+  static inline short sat16(const unsigned long v)
+  {
+    return((short)((v > 0xffff) ? 0xffff : v));
+  }
+
+public:
+  Histogram hist[PROFILE_HISTOGRAMS];
+  uint32_t _loopStart;
+  bool _running;  // _loopStart is valid
+  byte _dump;     // next dump record, PROFILE_IDLE when none
+
+  Profile() { _dump = PROFILE_IDLE; }
+
+  inline void loopMark(const uint32_t us)
+  {
+    if (_running) hist[PROFILE_LOOP].add(us - _loopStart);
+    _loopStart = us;
+    _running = true;
+  }
+
+  void dump() { _dump = 0; }  // sent by poll()
+
+  // Log as much of a requested dump as Tel has room for.  Never waits.
+  // One slot is left free for motor events.
+  void poll()
+  {
+    while ((_dump < PROFILE_RECORDS) && (Tel.room() > 1))
+      {
+        byte h = _dump / (PROFILE_BINS + 2);
+        byte k = _dump % (PROFILE_BINS + 2);
+        _dump++;
+        const Histogram &g = hist[h];
+        if (k == 0)
+          Tel.log(TEL_PROF_COUNT,h,sat16(g.count));
+        else if (k == 1)
+          Tel.log(TEL_PROF_MAX,h,sat16(g.max));
+        else if (g.bin[k-2])
+          Tel.log(TEL_PROF_BIN,(h << 5) | (k-2),(short)g.bin[k-2]);
+      }
+    if (_dump >= PROFILE_RECORDS) _dump = PROFILE_IDLE;
+  }
+};
+
+Profile Prof;
+
+#define PROFILE_LOOP_MARK()          Prof.loopMark(micros())
+#define PROFILE_LATENCY(h,rxTime)    Prof.hist[h].add((uint32_t)(micros() - (rxTime)))
+#define PROFILE_DUMP()               Prof.dump()
+#define PROFILE_POLL()               Prof.poll()
+
+#else
+
+#define PROFILE_LOOP_MARK()
+#define PROFILE_LATENCY(h,rxTime)
+#define PROFILE_DUMP()
+#define PROFILE_POLL()
+
+#endif  // PROFILE
+
+#endif
@@ -0,0 +1,140 @@
+/*
+PWM frequency and resolution for the motor speed pins (ATmega168/328).
+
+pwmConfigure(pin, hz, bits) sets up the timer behind a PWM pin, in place
+of the TCCRnB recipes that used to be commented out in setup():
+
+    Timer0  pins 5, 6    refused (PWM_TIMER0): millis(), micros() and
+                         delay() count its overflows
+    Timer1  pins 9, 10   phase correct, TOP in ICR1: at least bits
+                         (8..16) of resolution, as many more as the
+                         frequency leaves room for
+    Timer2  pins 3, 11   phase correct, 8 bits only, at the nearest
+                         prescaler's frequency (31.4 kHz .. 30.6 Hz)
+
+Both pins of a timer share its frequency and resolution.
+
+Resolution is F_CPU / (2 * prescaler * hz) steps, so e.g. 10 bits
+allows up to 7.8 kHz, and 20 kHz gives 400 steps (~8.6 bits).
+
+pwmWrite(pin, duty) takes a duty cycle in PWM counts, Q7 (0..255<<7,
+the motor drivers' ramp output), and scales it to the pin's timer: the
+full 0..TOP on a reconfigured Timer1, analogWrite() on anything else.
+Full scale is full on at any resolution.
+
+provided under LGPL license
+*/
+#ifndef PWM_H
+#define PWM_H
+
+#define PWM_OK       0
+#define PWM_TIMER0   1  // on Timer0, which runs millis()
+#define PWM_NO_TIMER 2  // not a PWM pin
+#define PWM_BITS     3  // resolution not available on this timer
+#define PWM_FREQ     4  // frequency out of range, at that resolution
+
+#define PWM_Q7_FULL  (255U << 7)
+
+unsigned short PwmScale1;  // Timer1 OCR per Q7 duty count, Q15
+
+// 0, 1 or 2, or 255 if the pin has no PWM timer
+inline byte pwmTimer(const byte pin)
+{
+  switch(pin)
+    {
+    case  5: case  6: return(0);
+    case  9: case 10: return(1);
+    case  3: case 11: return(2);
+    }
+  return(255);
+}
+
+// Q7 duty at analogWrite()'s 8 bit scale
+inline byte pwmByte(const unsigned short duty)
+{
+  return((duty >= PWM_Q7_FULL) ? 255 : duty >> 7);
+}
+
+// pin is on Timer1, and pwmConfigure() has set its TOP
+inline bool pwmHighRes(const byte pin)
+{
+  return(((pin == 9) || (pin == 10)) && (TCCR1B & _BV(WGM13)));
+}
+
+byte pwmConfigure(const byte pin, const unsigned long hz, const byte bits)
+{
+  byte timer = pwmTimer(pin);
+  if (timer == 0) return(PWM_TIMER0);
+  if (timer > 2)  return(PWM_NO_TIMER);
+  if (hz == 0)    return(PWM_FREQ);
+
+  if (timer == 2)
+    {  // f = F_CPU / (510 * div).  take the nearest, within a factor of 2
+      static const unsigned short Div[7] = { 1, 8, 32, 64, 128, 256, 1024 };
+      if (bits != 8) return(PWM_BITS);
+      byte best = 0;
+      unsigned long bestErr = 0xffffffffUL;
+      for (byte k=0; k < 7; k++)
+        {
+          unsigned long f = F_CPU / 510 / Div[k];
+          unsigned long err = (f > hz) ? f - hz : hz - f;
+          if (err < bestErr)
+            {
+              bestErr = err;
+              best = k;
+            }
+        }
+      unsigned long f = F_CPU / 510 / Div[best];
+      if ((f > 2 * hz) || (2 * f < hz)) return(PWM_FREQ);
+      TCCR2A = (TCCR2A & (_BV(COM2A1) | _BV(COM2B1))) | _BV(WGM20);
+      TCCR2B = best + 1;
+      return(PWM_OK);
+    }
+
+  // Timer1, mode 10: phase correct, TOP = ICR1.  f = F_CPU / (2 * div * TOP).
+  // the smallest prescaler that fits gives the most resolution
+  static const unsigned short Div1[5] = { 1, 8, 64, 256, 1024 };
+  if ((bits < 8) || (bits > 16)) return(PWM_BITS);
+  unsigned long top = 0;
+  byte cs;
+  for (cs=0; cs < 5; cs++)
+    {
+      top = F_CPU / 2 / Div1[cs] / hz;
+      if (top <= 0xffff) break;
+    }
+  if ((cs == 5) || (top < (1UL << bits) - 1)) return(PWM_FREQ);
+  PwmScale1 = (top << 15) / PWM_Q7_FULL;
+  TCCR1B = 0;  // stop the timer while changing TOP
+  ICR1 = top;
+  TCCR1A = (TCCR1A & (_BV(COM1A1) | _BV(COM1B1))) | _BV(WGM11);
+  TCCR1B = _BV(WGM13) | (cs + 1);
+  return(PWM_OK);
+}
+
+// duty: PWM counts, Q7.  0 is off, PWM_Q7_FULL (or more) full on
+inline void pwmWrite(const byte pin, const unsigned short duty)
+{
+  if (pwmHighRes(pin))
+    {
+      if ((duty == 0) || (duty >= PWM_Q7_FULL))
+        {
+          digitalWrite(pin,duty ? HIGH : LOW);
+          return;
+        }
+      unsigned short ocr = ((unsigned long)duty * PwmScale1) >> 15;
+      if (pin == 9)
+        {
+          OCR1A = ocr;
+          TCCR1A |= _BV(COM1A1);
+        }
+      else
+        {
+          OCR1B = ocr;
+          TCCR1A |= _BV(COM1B1);
+        }
+      return;
+    }
+  analogWrite(pin,pwmByte(duty));
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+Small cooperative scheduler for fixed-rate tasks.
+
+Each task has a period in us.  run() dispatches every task whose
+deadline has passed, earliest deadline first, and schedules it again
+one period after the deadline it was due at, so the rate does not
+drift with dispatch delays.  All time comparisons are differences,
+so micros() wrap-around is harmless.  Times are uint32_t, so the
+differences wrap at 32 bits on a 64 bit host too (see Deadline.h).
+
+A task with nothing to do for a while can defer() its next deadline,
+e.g. so the CPU can sleep (see IdleSleep.h), and be woken back to its
+rate when there is work.
+
+Per task, it keeps the worst dispatch lateness (jitter) and the number
+of whole periods missed (overruns).  report() logs them to Tel, and
+starts the worst case over.
+
+provided under LGPL license
+*/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "Telemetry.h"
+
+#ifndef SCHEDULER_TASKS
+#define SCHEDULER_TASKS 4
+#endif
+
+typedef void (*TaskFn)(uint32_t us);  // called with current micros()
+
+class Scheduler
+{
+public:
+  struct Task
+  {
+    TaskFn fn;
+    uint32_t period;          // us
+    uint32_t next;            // deadline, us
+    uint32_t maxLate;         // worst dispatch lateness since last report, us
+    unsigned short overruns;  // periods skipped because the task ran too late
+  };
+  Task task[SCHEDULER_TASKS];
+  byte nTask;
+
+  void begin() { nTask = 0; }
+
+  // returns task index, or -1 when the table is full
+  int add(TaskFn fn, const uint32_t periodUs, const uint32_t now)
+  {
+    if (nTask >= SCHEDULER_TASKS) return(-1);
+    Task &k = task[nTask];
+    k.fn = fn;
+    k.period = periodUs;
+    k.next = now + periodUs;
+    k.maxLate = 0;
+    k.overruns = 0;
+    return(nTask++);
+  }
+
+  // Task i has nothing to do before untilUs: push its deadline out to
+  // then, without counting it late.  wake() undoes it.
+  void defer(const byte i, const uint32_t untilUs)
+  {
+    if ((int32_t)(untilUs - task[i].next) > 0) task[i].next = untilUs;
+  }
+
+  // Run task i at its normal rate again, from now
+  void wake(const byte i, const uint32_t now)
+  {
+    if ((int32_t)(task[i].next - now) > (int32_t)task[i].period) task[i].next = now + task[i].period;
+  }
+
+  // earliest deadline of any task
+  uint32_t nextDeadline() const
+  {
+    uint32_t t = task[0].next;
+    for (byte i=1; i < nTask; i++)
+      if ((int32_t)(task[i].next - t) < 0) t = task[i].next;
+    return(t);
+  }
+
+  // Dispatch every task that is due, earliest deadline first.
+  // Returns number of tasks run.
+  byte run()
+  {
+    byte n = 0;
+    for(;;)
+      {
+        uint32_t now = micros();
+        int due = -1;
+        int32_t dueLate = -1;
+        for (byte i=0; i < nTask; i++)
+          {
+            int32_t late = (int32_t)(now - task[i].next);
+            if (late > dueLate)
+              {
+                due = i;
+                dueLate = late;
+              }
+          }
+        if (due < 0) return(n);
+
+        Task &k = task[due];
+        if ((uint32_t)dueLate > k.maxLate) k.maxLate = dueLate;
+        if ((uint32_t)dueLate >= k.period)
+          {  // missed whole periods.  skip them, rather than run in a burst
+            uint32_t skip = dueLate / k.period;
+            k.overruns += skip;
+            k.next += skip * k.period;
+          }
+        k.next += k.period;
+        k.fn(now);
+        n++;
+      }
+  }
+
+  // log one record per task : jitter (us, saturated) and overrun count
+  void report()
+  {
+    for (byte i=0; i < nTask; i++)
+      {
+        Tel.log(TEL_TASK_JITTER ,i,(task[i].maxLate > 32767) ? 32767 : (short)task[i].maxLate);
+        Tel.log(TEL_TASK_OVERRUN,i,(short)task[i].overruns);
+        task[i].maxLate = 0;
+      }
+  }
+};
+
+#endif
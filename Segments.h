@@ -0,0 +1,139 @@
+/*
+Timed setpoint queue: (left, right, ms) segments, streamed ahead by the
+host and run on schedule on board, so link latency and jitter do not
+reach the motors.
+
+Each segment starts on the motor clock tick the one before it ends (see
+Deadline.h), so a script keeps its timing however its bytes arrive, as
+long as the queue does not run dry.  A segment appended to an idle
+queue starts at the next update().
+
+update() says when to set the motors to the running segment's speeds:
+as it starts, every SEGMENT_REFRESH_MS while it runs, and once more as
+the last one ends.  The drives' deadman then runs from the moment the
+queue ran dry, as it would from the last command of a live link, so a
+queue that stops being fed stops the motors.  End a script with a zero
+speed segment to stop at once.
+
+flush() drops every segment, the running one too, and leaves the
+motors to the next command, or the deadman.
+
+The commands are in Command.h ('J', 'K', 'Q', 'F' and 'q').
+N segments of 6 bytes, plus 23.
+
+provided under LGPL license
+*/
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include "MotorDriveCore.h"
+
+#ifndef SEGMENT_REFRESH_MS
+#define SEGMENT_REFRESH_MS 100  // well under the deadman timeout
+#endif
+
+template<byte N>
+class SegmentQueue
+{
+public:
+  struct Segment
+  {
+    SHORT left, right;
+    unsigned short ms;
+  };
+
+  Segment _seg[N];
+  byte _head;        // oldest segment, the running one if _running
+  byte _n;           // segments queued, with the running one
+  bool _running;
+  Deadline _end;     // of the running segment
+  Deadline _refresh; // next refresh of its speeds
+  SHORT _left, _right;  // speeds of the running (or last) segment
+
+  SegmentQueue() : _head(0), _n(0), _running(false), _left(0), _right(0) {}
+
+  // false if the queue is full
+  bool append(const int left, const int right, const unsigned short ms)
+  {
+    if (_n >= N) return(false);
+    Segment &s = _seg[(byte)(_head + _n) % N];
+    s.left = left;
+    s.right = right;
+    s.ms = ms;
+    _n++;
+    return(true);
+  }
+
+  void flush()
+  {
+    _n = 0;
+    _running = false;
+  }
+
+  inline byte depth() const { return(_n); }
+  inline bool running() const { return(_running); }
+
+  // ms of segments still to run, the rest of the running one too
+  unsigned long msQueued(const uint32_t t) const
+  {
+    unsigned long ms = 0;
+    for (byte k = _running ? 1 : 0; k < _n; k++) ms += _seg[(byte)(_head + k) % N].ms;
+    if (_running) ms += _end.remaining(t) / MOTOR_TICKS_PER_MS;
+    return(ms);
+  }
+
+  // true if the motors are to be set to left, right now
+  bool update(const uint32_t t, int &left, int &right)
+  {
+    if (!_running)
+      {
+        if (!_n) return(false);
+        start(t,t);
+      }
+    else if (_end.reached(t))
+      {
+        do
+          {  // the next one starts where this one ended, so no drift
+            uint32_t at = _end.start + _end.span;
+            _head = (byte)(_head + 1) % N;
+            if (!--_n)
+              {  // ran dry.  Last speeds once more: the deadman runs from now
+                _running = false;
+                Tel.log(TEL_QUEUE_DRY);
+                break;
+              }
+            start(at,t);
+          }
+        while (_end.reached(t));
+      }
+    else if (_refresh.reached(t)) _refresh.set(t,SEGMENT_REFRESH_MS * MOTOR_TICKS_PER_MS);
+    else return(false);
+    left = _left;
+    right = _right;
+    return(true);
+  }
+
+  // ms after t until update() next has anything to do, at most maxMs
+  unsigned long idleTime(const uint32_t t, unsigned long maxMs) const
+  {
+    if (!_running) return(_n ? 0 : maxMs);
+    uint32_t r = _end.remaining(t);
+    uint32_t rr = _refresh.remaining(t);
+    unsigned long ms = ((rr < r) ? rr : r) / MOTOR_TICKS_PER_MS;
+    return((ms < maxMs) ? ms : maxMs);
+  }
+
+protected:
+  // run _seg[_head] from at, refreshing its speeds from t
+  void start(const uint32_t at, const uint32_t t)
+  {
+    const Segment &s = _seg[_head];
+    _end.set(at,(uint32_t)s.ms * MOTOR_TICKS_PER_MS);
+    _refresh.set(t,SEGMENT_REFRESH_MS * MOTOR_TICKS_PER_MS);
+    _left = s.left;
+    _right = s.right;
+    _running = true;
+  }
+};
+
+#endif
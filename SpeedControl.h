@@ -0,0 +1,168 @@
+/*
+Closed-loop wheel speed control, from a quadrature encoder.
+
+PWM on the enable pin acts more like an accelerator than a speed
+setting, so the speed a command gives changes with battery voltage,
+load and terrain.  SpeedControl<MOTOR,ENC> wraps a motor driver and a
+QuadEncoder (see Encoder.h), takes setpoints in encoder counts per
+second, and runs a PI loop with feed-forward in update():
+
+    pwm = kf * setpoint  +  kp * error  +  ki * integral(error)
+
+all in fixed point: gains Q8, measured speed low-passed over
+SPEED_FILTER_SHIFT updates, and the integral clamped so the I term
+alone can just reach full PWM.  The integral only runs while the
+motor is driving, so the start-up pulse and stop lock-outs do not
+wind it up.  The output keeps the sign of the setpoint, and at least
+minPWM, so the loop never brakes or restarts the motor on its own.
+
+One update() is a few 32 bit multiplies and no divides when called
+every 1 or 2 ms, well inside a 1 kHz budget on a 16 MHz Nano.
+
+The motor is fed a new speed on every update, so the deadman is kept
+here instead: with no setSpeed() for the motor's command timeout,
+while the setpoint is not 0, the motor gets an emergencyStop().
+
+provided under LGPL license
+*/
+#ifndef SPEED_CONTROL_H
+#define SPEED_CONTROL_H
+
+#include "MotorDriveCore.h"
+#include "Encoder.h"
+
+#ifndef SPEED_FILTER_SHIFT
+#define SPEED_FILTER_SHIFT 3   // speed low-pass over 2^n updates
+#endif
+
+template<class MOTOR, class ENC>
+class SpeedControl
+{
+public:
+  MOTOR &Mot;
+  ENC &Enc;
+
+  long _setpoint;   // counts / s
+  long _velQ;       // measured speed, counts / s, Q(SPEED_FILTER_SHIFT)
+  long _integ;      // integral of speed error, counts/s * ms
+  long _iMax;       // |_integ| limit
+  long _prevCount;
+  uint32_t _prevTime;       // ticks (see MOTOR_CLOCK()), of last update, in whole ms
+  uint32_t _cmdTime;        // ticks of last setSpeed()
+  SHORT _kp, _ki, _kf;      // gains, Q8.  _ki per 1.024 s, see setGains()
+  SHORT _pwm;               // last output, -255..255
+  bool _active;             // a non-zero setpoint has been given
+
+  SpeedControl(MOTOR &mot, ENC &enc) : Mot(mot), Enc(enc)
+  {
+    _kp = _ki = _kf = 0;
+    _iMax = 0;
+  }
+
+  void begin()
+  {
+    Enc.begin();
+    _prevCount = Enc.count();
+    _prevTime = MOTOR_CLOCK();
+    _setpoint = _velQ = _integ = 0;
+    _pwm = 0;
+    _active = false;
+  }
+
+  // kp : PWM counts per count/s of error
+  // ki : PWM counts per count of accumulated error (count/s * s)
+  // kf : PWM counts per count/s of setpoint, feed-forward
+  void setGains(const float kp, const float ki, const float kf)
+  {
+    _kp = (SHORT)(kp * 256 + 0.5f);
+    _ki = (SHORT)(ki * 262.144f + 0.5f);  // integral is in ms, 1024 per shift
+    _kf = (SHORT)(kf * 256 + 0.5f);
+    _iMax = _ki ? (255L << 18) / _ki : 0;
+  }
+
+  inline long speed() const { return(_velQ >> SPEED_FILTER_SHIFT); }  // counts / s
+
+  void setSpeed(long cps, const uint32_t t)
+  {
+    if (cps >  32767) cps =  32767;
+    if (cps < -32767) cps = -32767;
+    if ((cps > 0) != (_setpoint > 0)) _integ = 0;  // start over on a direction change
+    _setpoint = cps;
+    _cmdTime = t;
+    if (cps) _active = true;
+  }
+
+  void emergencyStop()
+  {
+    _setpoint = _integ = 0;
+    _pwm = 0;
+    _active = false;
+    Mot.emergencyStop();
+  }
+
+  // see MotorDriveCore::idleTime().  the loop runs every tick while active
+  unsigned long idleTime(const uint32_t t, unsigned long maxMs)
+  {
+    if ((_setpoint && _active) || _pwm) return(0);
+    return(Mot.idleTime(t,maxMs));
+  }
+
+  void update(const uint32_t t)  // current time, from MOTOR_CLOCK()
+  {
+    uint32_t dt = (t - _prevTime) / MOTOR_TICKS_PER_MS;  // whole ms
+    if (dt == 0) return;
+    _prevTime += dt * MOTOR_TICKS_PER_MS;  // the rest counts next time
+
+    long c = Enc.count();
+    long raw = (c - _prevCount) * 1000;
+    _prevCount = c;
+    if (dt == 2) raw >>= 1;
+    else if (dt > 2) raw /= (long)dt;
+    _velQ += raw - (_velQ >> SPEED_FILTER_SHIFT);
+
+    if (!_setpoint || !_active)
+      {
+        _integ = 0;
+        if (_pwm)
+          {
+            _pwm = 0;
+            Mot.setSpeed(0,t);
+          }
+        else Mot.update(t);
+        return;
+      }
+    if (t - _cmdTime > (uint32_t)Mot._deadTime * MOTOR_TICKS_PER_MS)
+      {  // deadman expired
+        emergencyStop();
+        return;
+      }
+
+    long e = _setpoint - speed();
+    if (e >  32767) e =  32767;
+    if (e < -32767) e = -32767;
+    if ((Mot._mode == MOTOR_FWD) || (Mot._mode == MOTOR_REV))
+      {
+        _integ += e * (long)dt;
+        if (_integ >  _iMax) _integ =  _iMax;
+        if (_integ < -_iMax) _integ = -_iMax;
+      }
+    long u = (((long)_kf * _setpoint) >> 8) +
+             (((long)_kp * e) >> 8) +
+             (((long)_ki * _integ) >> 18);
+    long lo = Mot._minPWM;
+    if (_setpoint > 0)
+      {
+        if (u < lo) u = lo;
+        if (u > 255) u = 255;
+      }
+    else
+      {
+        if (u > -lo) u = -lo;
+        if (u < -255) u = -255;
+      }
+    _pwm = (SHORT)u;
+    Mot.setSpeed(_pwm,t);
+  }
+};
+
+#endif
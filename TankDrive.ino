@@ -1,7 +1,8 @@
 /*
 Main Tank-tread style drive control loop.
 
-Two H-bridge motor drives, on left and right side
+Two H-bridge motor drives, on left and right side,
+or with MOTOR_BANK, 4 or 6 (see MotorBank.h)
 
 Motor drives take speed commands from -255..255,
 with negative numbers for reverse.
@@ -23,19 +24,103 @@ If you do use this code please retain credit to above as originator.
 
 const char TAB = '\t';  // forces #include<Arduino.h> here, needed for following #include's
 
+// A build that picks its own driver defines on the command line (see
+// avrbench/) also defines TANKDRIVE_CONFIG, and leaves out the defaults
+#ifndef TANKDRIVE_CONFIG
 #define L298  // use L298 motor driver
+#endif
 //#define DBH1  // use DBH1 modifications of 298 driver
+// With DBH1, sample motor current in the background, and emergency stop
+// a motor as soon as its current goes over CURRENT_TRIP ADC counts
+//#define CURRENT_SENSE
+#define CURRENT_TRIP 800
 
 // www.wljtech.com WTH3615D motor driver claims to use "L298 logic", but it has
 // in1, in2, en AND a PWM input.  Set this to use the 298 driver,
 // but with extra logic for the extra PWM pin
+#ifndef TANKDRIVE_CONFIG
 #define WTH3615D
+#endif
+
+// PWM the plain L298's direction inputs, with EN held on, rather than EN.
+// Speed then follows the command more closely, and an output map takes
+// out the deadband (see MotorDrive298.h, MotorMap.h).  The direction
+// inputs move to PWM pins, in setup()
+//#define DIR_PWM
+
+// Fix the L298 pins at compile time, so each pin change is a single
+// port register write.  Pin numbers are then given here, not in setup()
+//#define FAST_PINS
 
-#ifdef L298
+// 4 or 6 motor skid-steer: MOTOR_BANK L298 (or WTH3615D) channels, left
+// side first, in place of MotL and MotR.  'L' and 'R' drive each side,
+// and group commands any set of channels (see Command.h)
+//#define MOTOR_BANK 4
+
+// Run the motor drives on micros() rather than millis(), for start
+// pulses finer than 1 ms (setStartPulseUs()).  Either clock is wrap-safe
+//#define MOTOR_MICROS
+
+#ifdef MOTOR_BANK
+  #if !defined(L298) || defined(DBH1)
+  #error MOTOR_BANK channels have L298 logic
+  #endif
+  #ifdef MOTOR_MICROS
+  #error MOTOR_BANK deadlines are 16 bit millis()
+  #endif
+  #include "MotorBank.h"
+  MotorBank<MOTOR_BANK> Motors(0.5f);
+  #define BANK_L ((1 << (MOTOR_BANK/2)) - 1)       // first half of the channels
+  #define BANK_R (MotorBank<MOTOR_BANK>::ALL & ~BANK_L)
+
+  // EN, IN1, IN2, PWM, left side first.  With 6 channels there are
+  // not enough pins, so each side's channels share their direction
+  // (and WTH3615D EN) pins.  The bank then only drives a side's
+  // channels together, whatever group a command names
+  const byte BankPins[MOTOR_BANK][4] = {
+  #if (MOTOR_BANK == 4) && defined(WTH3615D)
+    { 9, 7, 8,11}, {12,14,15,10},  { 5, 2, 4, 3}, {16,17,18, 6}
+  #elif MOTOR_BANK == 4
+    {11, 7, 8,NO_PIN}, {10,12,14,NO_PIN},  { 3, 2, 4,NO_PIN}, { 9,15,16,NO_PIN}
+  #elif defined(WTH3615D)
+    {12, 7, 8,11}, {12, 7, 8,10}, {12, 7, 8, 9},  {14, 2, 4, 3}, {14, 2, 4, 5}, {14, 2, 4, 6}
+  #else
+    {11, 7, 8,NO_PIN}, {10, 7, 8,NO_PIN}, { 9, 7, 8,NO_PIN},
+    { 3, 2, 4,NO_PIN}, { 5, 2, 4,NO_PIN}, { 6, 2, 4,NO_PIN}
+  #endif
+  };
+#elif defined(L298)
+  #if defined(DIR_PWM) && (defined(WTH3615D) || defined(DBH1) || defined(FAST_PINS))
+  #error DIR_PWM is for the plain L298, with pins given in setup()
+  #endif
   #include "MotorDrive298.h"
+  #ifdef DIR_PWM
+  #include "MotorMap.h"
+  #endif
 // params are decelRate, deadmanTimeout, startupPulseDuration, stopTimeout, maxPWM
+//
+// The two sides need not use the same driver.  e.g. for an L298 on the
+// left and a DBH1 (#include "MotorDriveDBH1.h") on the right:
+//   L298Drive<> MotL(0.5f);
+//   DBH1Drive<> MotR;
+ #ifdef FAST_PINS
+  #ifdef WTH3615D
+  // template params : EN, IN1, IN2, PWM
+  MotorDriveFast<9,7,8,11> MotL(0.5f);
+  MotorDriveFast<5,2,4,3>  MotR(0.5f);
+  #elif defined(DBH1)
+  // template params : EN, IN1, IN2, CS
+  MotorDriveFast<10,6,11,2> MotL(0.5f);
+  MotorDriveFast<9,5,3,1>   MotR(0.5f);
+  #else
+  // template params : EN, IN1, IN2
+  MotorDriveFast<11,7,8> MotL(0.5f);
+  MotorDriveFast<3,2,4>  MotR(0.5f);
+  #endif
+ #else
   MotorDrive MotL(0.5f);
   MotorDrive MotR(0.5f);
+ #endif
 #else
   //#include "MotorDriveDBH1.h"  // depricated DBH1 specific driver
   #include "MotorDriveC.h"  // vicky tan driver module
@@ -48,8 +133,199 @@ const char TAB = '\t';  // forces #include<Arduino.h> here, needed for following
   MotorDrive MotR(250,50,3000,15);
 #endif
 
+// Take serial bytes straight from the RX interrupt into a larger buffer.
+// Needs a core without HardwareSerial's own RX interrupt handler, and
+// COMMAND_CORE_NO_RX_ISR defined to say so (see Command.h)
+//#define COMMAND_RX_ISR
+//#define COMMAND_CORE_NO_RX_ISR
+#ifdef CURRENT_SENSE
+  #if !defined(L298) || !defined(DBH1) || defined(MOTOR_BANK)
+  #error CURRENT_SENSE needs the DBH1 current outputs
+  #endif
+// from the ADC interrupt.  channels in the order add()ed in setup()
+void overcurrent(byte channel)
+{
+  if (channel) MotL.trip();
+  else         MotR.trip();
+}
+#endif
+
+// Closed-loop wheel speed from quadrature encoders on A0,A3 (left) and
+// A4,A5 (right), counted in the pin change interrupt.  L/R commands are
+// then wheel speeds, ENCODER_CPS encoder counts/s per command count.
+//#define ENCODERS
+#ifdef ENCODERS
+  #ifdef MOTOR_BANK
+  #error ENCODERS are for the two motor build
+  #endif
+  #include "SpeedControl.h"
+  #define ENCODER_CPS 8
+  QuadEncoder<14,17> EncL;  // A1, A2 are current sense on DBH1
+  QuadEncoder<18,19> EncR;
+  ISR(PCINT1_vect)
+  {
+    EncL.tick();
+    EncR.tick();
+  }
+  SpeedControl<decltype(MotL),decltype(EncL)> DriveL(MotL,EncL);
+  SpeedControl<decltype(MotR),decltype(EncR)> DriveR(MotR,EncR);
+#elif !defined(MOTOR_BANK)
+  #define ENCODER_CPS 1
+  #define DriveL MotL   // open loop, commands are PWM
+  #define DriveR MotR
+#endif
+
+// Calibrate each motor's minimum PWM, start pulse and braking time from
+// its encoder on 'k', and keep them in EEPROM, over the constructor's
+// values above from the next boot (see Calibrate.h).  The robot drives
+// itself forward for a few seconds: give it room
+//#define CALIBRATE
+#ifdef CALIBRATE
+  #ifndef ENCODERS
+  #error CALIBRATE needs ENCODERS
+  #endif
+  #include "Calibrate.h"
+  MotorCalibration<decltype(MotL),decltype(EncL)> CalL(MotL,EncL,0);  // EEPROM addresses
+  MotorCalibration<decltype(MotR),decltype(EncR)> CalR(MotR,EncR,CALIBRATION_RECORD_LEN);
+#endif
+
+// Keep loop time and command latency histograms, dumped on '?'
+//#define PROFILE
+#include "Profile.h"
 #include "Command.h"  // can re-use Command from DalekDrive
 CommandReader Command;
+// Arcade drive: mix 'T' throttle and 'S' steer into left and right
+// speeds on board, instead of the app sending 'L' and 'R' (see Command.h)
+//#define ARCADE_DRIVE
+
+// Timed segments: the host streams (left, right, ms) segments ahead, and
+// they run on schedule on board, whatever the link's latency and jitter
+// (see Segments.h).  Queue capacity, in segments
+//#define SEGMENT_QUEUE 16
+#ifdef SEGMENT_QUEUE
+  #include "Segments.h"
+  SegmentQueue<SEGMENT_QUEUE> Segs;
+#endif
+
+// Dead reckoning: integrate the tracks' travel into an (x, y, heading)
+// pose, from the encoders, or without them from the driven speeds, and
+// send it in the telemetry stream (see Odometry.h)
+//#define ODOMETRY
+#ifdef ODOMETRY
+  #ifdef MOTOR_BANK
+  #error ODOMETRY is for the two motor build
+  #endif
+  #include "Odometry.h"
+  Odometry Odo;
+  #ifdef ENCODERS
+  #define ODOMETRY_MM_PER_TICK 0.1745f  // per count: 80 mm wheel, 1440 counts a turn
+  #else
+  #define ODOMETRY_MM_PER_TICK 0.0033f  // per speed count per ms, on a full battery
+  #endif
+  #define ODOMETRY_TRACK_MM 375.0f  // 250 mm apart, times 1.5 for slip in a turn
+  #define ODOMETRY_FRAME_MS 100     // pose frame period, "O<ms>" changes it
+#endif
+
+#include "Scheduler.h"
+Scheduler Sched;
+
+// Sleep between deadlines, rather than spin in loop(), to save battery.
+// Motor updates are skipped while neither motor has a transition due.
+//#define IDLE_SLEEP
+#ifdef IDLE_SLEEP
+  #include "IdleSleep.h"
+  IdleSleep Idle;
+  #define IDLE_MAX_MS 250UL   // longest gap between motor updates
+#endif
+
+#define MOTOR_DT     1000UL   // us between motor state updates
+#define FLASH_DT   800000UL   // us between heartbeat LED toggles
+#define TELEMETRY_DT 5000UL   // us between telemetry sends
+#define ODOMETRY_DT 10000UL   // us between pose updates
+byte MotorTask;               // Sched index
+
+#ifdef MOTOR_BANK
+void motorTask(uint32_t us)
+{
+  uint32_t t = MOTOR_CLOCK();
+#ifdef SEGMENT_QUEUE
+  int l, r;
+  if (Segs.update(t,l,r))
+    {
+      Motors.setSpeed(Command.groupL,l,t);
+      Motors.setSpeed(Command.groupR,r,t);
+    }
+#endif
+  Motors.update(t);  // every channel, in one pass
+#ifdef IDLE_SLEEP
+  unsigned long ms = Motors.idleTime(t,IDLE_MAX_MS);
+ #ifdef SEGMENT_QUEUE
+  unsigned long msQ = Segs.idleTime(t,IDLE_MAX_MS);
+  if (msQ < ms) ms = msQ;
+ #endif
+  if (ms > 1) Sched.defer(MotorTask,us + (ms-1)*MOTOR_DT);
+#endif
+}
+#else
+void motorTask(uint32_t us)
+{
+  uint32_t t = MOTOR_CLOCK();
+#ifdef CALIBRATE
+  if (CalL.running() || CalR.running())
+    {  // calibration has the motors, every tick.  The rest waits
+      CalL.update(t);
+      CalR.update(t);
+      return;
+    }
+#endif
+#ifdef SEGMENT_QUEUE
+  int l, r;
+  if (Segs.update(t,l,r))
+    {  // next segment, or keep the running one's speeds fresh
+      DriveL.setSpeed(l*ENCODER_CPS,t);
+      DriveR.setSpeed(r*ENCODER_CPS,t);
+    }
+#endif
+  DriveL.update(t);
+  DriveR.update(t);
+#ifdef IDLE_SLEEP
+  // nothing for update() to do for ms: skip the task until the ms before
+  unsigned long ms = DriveL.idleTime(t,IDLE_MAX_MS);
+  unsigned long msR = DriveR.idleTime(t,IDLE_MAX_MS);
+  if (msR < ms) ms = msR;
+ #ifdef SEGMENT_QUEUE
+  msR = Segs.idleTime(t,IDLE_MAX_MS);
+  if (msR < ms) ms = msR;
+ #endif
+  if (ms > 1) Sched.defer(MotorTask,us + (ms-1)*MOTOR_DT);
+#endif
+}
+#endif
+
+void heartbeatTask(uint32_t)
+{ // Flash standard LED to show things are running
+  digitalWrite(13,digitalRead(13)?LOW:HIGH);  // toggle heartbeat
+}
+
+#ifdef ODOMETRY
+void odometryTask(uint32_t)
+{
+ #ifdef ENCODERS
+  Odo.addCounts(EncL.count(),EncR.count());
+ #else
+  Odo.addSpeeds(MotL.driveSpeed(),MotR.driveSpeed(),millis());
+ #endif
+}
+#endif
+
+void telemetryTask(uint32_t)
+{
+  PROFILE_POLL();
+#ifdef ODOMETRY
+  if (!Tel.sending()) Odo.send(millis());  // between records
+#endif
+  Tel.drain();  // send diagnostics, as far as TX buffer room allows
+}
 
 void setup()
 {
@@ -57,8 +333,24 @@ void setup()
   // Timer2 for pins 3,11 : Timer 0 for pins 6,5 : Timer 1 for 9,10
   // Mega has PWM on on pins 2 through 13.
 
-#ifdef L298
- #ifdef DBH1
+#ifdef MOTOR_BANK
+  Motors.setId('0');  // tag telemetry records: channel numbers
+  for (byte k=0; k < MOTOR_BANK; k++)
+    Motors.setPins(k,BankPins[k][0],BankPins[k][1],BankPins[k][2],BankPins[k][3]);
+  Motors.begin();
+  Command.groupL = BANK_L;
+  Command.groupR = BANK_R;
+#else
+  MotL.setId('L');  // tag telemetry records
+  MotR.setId('R');
+#endif
+
+#ifdef MOTOR_BANK
+#elif defined(L298)
+ #ifdef FAST_PINS
+  MotR.begin();  // pins are template parameters, above
+  MotL.begin();
+ #elif defined(DBH1)
   // DBH1 needs PWM on all three inputs, and a current-sense output pin
 // 9,10 are 16-bit timer, Timer1.  Changing freq on these messes up Servo
 // 3,11 are Timer2, changing freq changes tone() function
@@ -71,12 +363,25 @@ void setup()
   // params : EN, IN1, IN2, PWM
   MotR.begin(5,2,4,3);
   MotL.begin(9,7,8,11);
+  #elif defined(DIR_PWM)
+  // params: EN, IN1, IN2.  Each side's IN1, IN2 on one timer
+  MotR.setDirPwm(true);
+  MotL.setDirPwm(true);
+  MotR.begin(7,3,11);
+  MotL.begin(8,9,10);
+  MotR.setOutputMap(MotorMapDir);  // fitted to sim/Plant.h's motor
+  MotL.setOutputMap(MotorMapDir);
   #else
   // params: EN, IN1, IN2
   MotR.begin(3,2,4);
   MotL.begin(11,7,8);
   #endif
  #endif
+ #if defined(DBH1) && defined(CURRENT_SENSE)
+  Current.add(1,CURRENT_TRIP);  // MotR cs, with either pin mode
+  Current.add(2,CURRENT_TRIP);  // MotL cs
+  Current.begin(overcurrent);
+ #endif
 #else
     // depricated DBH1 specific driver
     //MotR.begin( 9,5, 3,1,1.0);
@@ -86,79 +391,157 @@ void setup()
   MotL.begin(8,11,2);
 #endif
 
+#ifdef ARCADE_DRIVE
+  Command.arcade = true;
+#endif
+
   //Serial.begin(9600);
   Serial.begin(57600);  // nano
   //Serial.begin(115200);  # uno
 
+#ifdef ENCODERS
+  DriveL.begin();
+  DriveR.begin();
+  // params : kp, ki, feed-forward.  Full PWM at 255 * ENCODER_CPS
+  DriveL.setGains(0.1f,1.0f,1.0f/ENCODER_CPS);
+  DriveR.setGains(0.1f,1.0f,1.0f/ENCODER_CPS);
+  PCMSK1 |= _BV(0) | _BV(3) | _BV(4) | _BV(5);
+  PCICR  |= _BV(PCIE1);
+#endif
+#ifdef CALIBRATE
+  Tel.log(TEL_CAL_LOADED,'L',CalL.load());
+  Tel.log(TEL_CAL_LOADED,'R',CalR.load());
+#endif
+#ifdef ODOMETRY
+  Odo.begin(ODOMETRY_MM_PER_TICK,ODOMETRY_TRACK_MM,ODOMETRY_FRAME_MS);
+#endif
+
+  pinMode(13,OUTPUT);  // heartbeat LED
+  uint32_t now = micros();
+  Sched.begin();
+  MotorTask = Sched.add(motorTask,MOTOR_DT,now);
+  Sched.add(heartbeatTask,FLASH_DT    ,now);
+  Sched.add(telemetryTask,TELEMETRY_DT,now);
+#ifdef ODOMETRY
+  Sched.add(odometryTask,ODOMETRY_DT ,now);
+#endif
+#ifdef IDLE_SLEEP
+  Idle.begin();
+#endif
+
   // When doing diagnostics, we may want to increase deadman time
   //MotL.setCommandTimeout(16000);
   //MotR.setCommandTimeout(16000);
 
-//---------------------------------------------- Set PWM frequency for D3 & D11 ------------------------------  
-//TCCR2B = TCCR2B & B11111000 | B00000001;    // set timer 2 divisor to     1 for PWM frequency of 31372.55 Hz
-//TCCR2B = TCCR2B & B11111000 | B00000010;    // set timer 2 divisor to     8 for PWM frequency of  3921.16 Hz
-//TCCR2B = TCCR2B & B11111000 | B00000011;    // set timer 2 divisor to    32 for PWM frequency of   980.39 Hz
-//TCCR2B = TCCR2B & B11111000 | B00000100;    // set timer 2 divisor to    64 for PWM frequency of   490.20 Hz
-//TCCR2B = TCCR2B & B11111000 | B00000101;    // set timer 2 divisor to   128 for PWM frequency of   245.10 Hz
-//TCCR2B = TCCR2B & B11111000 | B00000110;    // set timer 2 divisor to   256 for PWM frequency of   122.55 Hz
-//TCCR2B = TCCR2B & B11111000 | B00000111;    // set timer 2 divisor to  1024 for PWM frequency of    30.64 Hz
-//TCCR2A |= B00000011;  // Fast PWM (default for Arduino)
-//TCCR2A = (TCCR2A & B11111100) | B00000001;  // timer 2, phase corrected PWM, which is 1/2 rate of Fast
-
-//---------------------------------------------- Set PWM frequency for D9 & D10 ------------------------------
- 
-//TCCR1B = TCCR1B & B11111000 | B00000001;    // set timer 1 divisor to     1 for PWM frequency of 31372.55 Hz
-//TCCR1B = TCCR1B & B11111000 | B00000010;    // set timer 1 divisor to     8 for PWM frequency of  3921.16 Hz
-//TCCR1B = TCCR1B & B11111000 | B00000011;    // set timer 1 divisor to    64 for PWM frequency of   490.20 Hz (The DEFAULT)
-//TCCR1B = TCCR1B & B11111000 | B00000100;    // set timer 1 divisor to   256 for PWM frequency of   122.55 Hz
-//TCCR1B = TCCR1B & B11111000 | B00000101;    // set timer 1 divisor to  1024 for PWM frequency of    30.64 Hz
+  // PWM frequency and resolution of a motor's speed pin (see Pwm.h).
+  // Timer2 (pins 3, 11) is 8 bits, 31.4 kHz .. 30.6 Hz.  Timer1 (pins
+  // 9, 10) takes up to 16 bits, e.g. 10 bits at 7.8 kHz, out of the
+  // audible range with the EN pins moved there.  Both pins of a timer
+  // change together.  Timer0 (pins 5, 6) runs millis(), and is refused.
+  //MotL.setPwm(31372,8);
+  //MotL.setPwm(7800,10);
 }
 
-unsigned long prevCommandTime = 0;
-
-#define FLASH_DT 800
-unsigned long tFlash = 0;
-
-// for diagnostics, just print a few messages, then be quiet to improve
-// performance when in actual use.
-int nMsg = 9;
-
 void loop()
 {
-  unsigned long t = millis();
+  PROFILE_LOOP_MARK();
+  uint32_t t = MOTOR_CLOCK();
 
-  char code;
-  int val;
-  if (Command.get(code,val))
+  // Take every command that is waiting, so a burst from the app can not
+  // starve housekeeping, and both sides change speed in the same tick.
+  CommandBatch cmd;
+  if (Command.drain(cmd))
     {
-      prevCommandTime = t;
-if (nMsg>0){nMsg--;Serial.print('>');Serial.print(code);Serial.println(val);}
-      switch(code)
+      if (cmd.newLeft)  Tel.log(TEL_COMMAND,'L',cmd.left);
+      if (cmd.newRight) Tel.log(TEL_COMMAND,'R',cmd.right);
+      if (cmd.code)     Tel.log(TEL_COMMAND,cmd.code,cmd.val);
+#ifdef CALIBRATE
+      if (cmd.stop || cmd.newSpeed)
+        {  // the app takes over
+          CalL.abort();
+          CalR.abort();
+        }
+      if (cmd.code == 'k')
         {
-        case 'L': MotL.setSpeed(val,t); break;
-        case 'R': MotR.setSpeed(val,t); break;
-        /* app may send bad commands.  just ignore them or they can clog the serial port
-        default : 
-          MotL.setSpeed(0,t);  // odd command.  just stop
-          MotR.setSpeed(0,t);
-          Serial.println("<stop");
-        */
+          DriveL.setSpeed(0,t);
+          DriveR.setSpeed(0,t);
+          CalL.start(t);
+          CalR.start(t);
         }
-    }
-  else
-    { // no command, do housekeeping (misc state update stuff)
-      MotL.update(t);
-      MotR.update(t);
-
-      if ((prevCommandTime > 0xfffff000) && (t < 999))
-        {  // time counter must have wrapped around
-          prevCommandTime = tFlash = 0;
+#endif
+#ifdef MOTOR_BANK
+      if (cmd.stop) Motors.emergencyStop(Motors.ALL);
+      if (cmd.newSpeed)  // sent after any stop
+        {
+          Motors.setSpeeds(cmd.newSpeed,cmd.speed,t);
+          PROFILE_LATENCY(PROFILE_LATENCY_L,cmd.rxTime);
+        }
+#else
+      if (cmd.stop)
+        {
+          DriveL.emergencyStop();
+          DriveR.emergencyStop();
+        }
+      // sent after any stop.  channel 0 is left, 1 right
+      if (cmd.newSpeed & 1)
+        {
+          DriveL.setSpeed(cmd.speed[0]*ENCODER_CPS,t);
+          PROFILE_LATENCY(PROFILE_LATENCY_L,cmd.rxTime);
+        }
+      if (cmd.newSpeed & 2)
+        {
+          DriveR.setSpeed(cmd.speed[1]*ENCODER_CPS,t);
+          PROFILE_LATENCY(PROFILE_LATENCY_R,cmd.rxTime);
+        }
+#endif
+#ifdef SEGMENT_QUEUE
+      // a live command, or a stop, takes over from the queue
+      if (cmd.stop || cmd.newSpeed || cmd.flush) Segs.flush();
+      if (cmd.queue && !Segs.append(cmd.segLeft,cmd.segRight,cmd.segMs))
+        Tel.log(TEL_QUEUE_FULL,0,cmd.segMs);
+      if (cmd.code == 'q')
+        {
+          unsigned long ms = Segs.msQueued(t);
+          Tel.log(TEL_QUEUE,Segs.depth(),(ms > 32767) ? 32767 : ms);
+        }
+#endif
+#ifdef ODOMETRY
+      if (cmd.code == 'o') Odo.reset();
+      if (cmd.code == 'O') Odo.setRate((cmd.val < 0) ? 0 : cmd.val);
+#endif
+#ifdef IDLE_SLEEP
+      Sched.wake(MotorTask,micros());  // new state to run
+#endif
+      if (cmd.code == '?')
+        {  // task jitter and overruns, and profile and current if enabled
+          Sched.report();
+          PROFILE_DUMP();
+#ifdef IDLE_SLEEP
+          Idle.report();
+#endif
+#ifdef CURRENT_SENSE
+          for (byte k=0; k < Current.nCh; k++)
+            {
+              Tel.log(TEL_CURRENT     ,k,Current.average(k));
+              Tel.log(TEL_CURRENT_PEAK,k,Current.peak(k));
+            }
+#endif
         }
-        
-      if (t - tFlash > FLASH_DT)
-        { // Flash standard LED to show things are running
-          tFlash = t;
-          digitalWrite(13,digitalRead(13)?LOW:HIGH);  // toggle heartbeat
+      /* app may send bad commands.  just ignore them or they can clog the serial port
+      if (cmd.code)
+        {
+          MotL.setSpeed(0,t);  // odd command.  just stop
+          MotR.setSpeed(0,t);
         }
+      */
     }
+
+  Sched.run();  // housekeeping, each task at its own rate
+
+#ifdef IDLE_SLEEP
+  // nothing more to do before the next deadline, unless a byte comes in
+  cli();
+  if (Command.bytesAvailable() > 0) sei();
+  else Idle.sleep(Sched.nextDeadline());
+#endif
 }
@@ -0,0 +1,133 @@
+/*
+Non-blocking diagnostic event log.
+
+The drivers used to Serial.print their diagnostics.  Once the 64 byte
+TX buffer fills, print blocks the control loop until the UART catches
+up, which is exactly when timing matters most.  Instead, events go
+into a small ring of fixed-size binary records here, and drain() sends
+whole records only while there is room in the TX buffer.  When the
+ring is full new records are dropped, and counted.
+
+On the wire each record is 7 bytes:
+
+    TELEMETRY_SYNC, id, motor, time (ms, low 16 bits), value (16 bit signed)
+
+with multi-byte fields little-endian.  sim/teldecode turns a captured
+stream back into text.  With ODOMETRY, pose frames (TELEMETRY_POSE_SYNC)
+go out between records (see Odometry.h).
+
+provided under LGPL license
+*/
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#define TELEMETRY_SYNC 0xA6
+#define TELEMETRY_RECORD_LEN 7
+#define TELEMETRY_POSE_SYNC 0xA7  // pose frame, see Odometry.h
+#define TELEMETRY_POSE_LEN 11
+
+#ifndef TELEMETRY_SIZE
+#define TELEMETRY_SIZE 16   // records, power of two
+#endif
+
+// event ids.  motor is the driver's id, or the command code
+#define TEL_STOP        1   // value: ms of brake to stop
+#define TEL_EMERGENCY   2
+#define TEL_STOPPED     3
+#define TEL_START       4   // value: commanded speed
+#define TEL_STARTED     5   // value: speed
+#define TEL_RESTART     6   // value: speed
+#define TEL_MOVING      7
+#define TEL_CLOCK_WRAP  8   // no longer logged: deadlines are wrap-safe
+#define TEL_CMD_RESET   9   // '~' received
+#define TEL_CMD_BAD_NEG 10  // '-' where no value was expected
+#define TEL_COMMAND     11  // motor: command code, value: command value
+#define TEL_DROPPED     12  // value: records dropped since last report
+#define TEL_TASK_JITTER 13  // motor: task index, value: worst lateness, us
+#define TEL_TASK_OVERRUN 14 // motor: task index, value: periods skipped
+#define TEL_PROF_COUNT  15  // profile dump, see Profile.h
+#define TEL_PROF_MAX    16
+#define TEL_PROF_BIN    17
+#define TEL_OVERCURRENT 18  // trip() from the current sampler
+#define TEL_CURRENT     19  // motor: current channel, value: average, ADC counts
+#define TEL_CURRENT_PEAK 20 // motor: current channel, value: peak since last report
+#define TEL_SLEEP       21  // value: time asleep since last report, per mille
+#define TEL_QUEUE       22  // motor: segments queued, value: ms queued (see Segments.h)
+#define TEL_QUEUE_FULL  23  // value: ms of the segment not queued
+#define TEL_QUEUE_DRY   24  // the last queued segment ended
+#define TEL_CAL_BREAKAWAY 25 // value: PWM the motor first moved at (see Calibrate.h)
+#define TEL_CAL_MIN_PWM 26  // value: calibrated _minPWM
+#define TEL_CAL_START   27  // value: calibrated start pulse, ms
+#define TEL_CAL_STOP    28  // value: ms to brake to a stop from full speed
+#define TEL_CAL_FAILED  29  // value: stage it failed or was aborted in
+#define TEL_CAL_LOADED  30  // value: 1 calibration loaded from EEPROM, 0 none
+
+class TelemetryLog
+{
+  struct Record
+  {
+    byte id, motor;
+    unsigned short t;
+    short value;
+  };
+  Record _rec[TELEMETRY_SIZE];
+  byte _head, _tail;    // free running, wrap at 256
+  byte _sent;           // bytes of the _tail record already sent
+  unsigned short _unreported;  // drops not yet reported with TEL_DROPPED
+
+public:
+  unsigned short dropped;  // total records dropped, ring was full
+
+  void log(const byte id, const byte motor=0, const short value=0)
+  {
+    if ((byte)(_head - _tail) >= TELEMETRY_SIZE)
+      {
+        dropped++;
+        _unreported++;
+        return;
+      }
+    Record &r = _rec[_head & (TELEMETRY_SIZE-1)];
+    r.id = id;
+    r.motor = motor;
+    r.t = (unsigned short)millis();
+    r.value = value;
+    _head++;
+  }
+
+  inline byte pending() const { return(_head - _tail); }
+  inline byte room() const { return(TELEMETRY_SIZE - pending()); }
+  // part of a record is out.  Other frames must wait for the rest
+  inline bool sending() const { return(_sent != 0); }
+
+  // Send what fits in the TX buffer now.  Never waits.
+  void drain()
+  {
+    if (_unreported && ((byte)(_head - _tail) < TELEMETRY_SIZE))
+      {
+        unsigned short n = _unreported;
+        _unreported = 0;
+        log(TEL_DROPPED,0,(short)n);
+      }
+    int room = Serial.availableForWrite();
+    while ((_head != _tail) && (room > 0))
+      {
+        const Record &r = _rec[_tail & (TELEMETRY_SIZE-1)];
+        byte buf[TELEMETRY_RECORD_LEN] = {
+          TELEMETRY_SYNC, r.id, r.motor,
+          (byte)r.t, (byte)(r.t >> 8),
+          (byte)r.value, (byte)((unsigned short)r.value >> 8) };
+        while ((_sent < TELEMETRY_RECORD_LEN) && (room > 0))
+          {
+            Serial.write(buf[_sent++]);
+            room--;
+          }
+        if (_sent < TELEMETRY_RECORD_LEN) return;  // rest next time
+        _sent = 0;
+        _tail++;
+      }
+  }
+};
+
+TelemetryLog Tel;
+
+#endif
@@ -0,0 +1,57 @@
+/*
+Shared between the AVR side of the benchmarks (bench.cpp) and the
+simavr runner (run.c): the ids of the timed cases, and the command
+stream the runner feeds the parser.
+
+bench.cpp writes a case id to GPIOR0 just before each timed call, and
+BENCH_END just after, with interrupts off.  The runner watches that
+register, and takes the cycles between the two writes, less the
+BENCH_EMPTY case (the writes themselves), as one sample of the case.
+
+provided under LGPL license
+*/
+#ifndef BENCH_H
+#define BENCH_H
+
+#define BENCH_MARK_ADDR 0x3e  // GPIOR0, in data space
+
+enum
+{
+  BENCH_END = 0,       // between cases
+  BENCH_EMPTY,         // nothing: the cost of the marks
+  BENCH_GET,           // CommandReader::get(), one call: at most one byte
+  BENCH_SET_START,     // setSpeed(): STOPPED -> START, the start pulse
+  BENCH_SET_KICK,      // START, within the pulse
+  BENCH_SET_STARTED,   // START -> FWD, pulse over
+  BENCH_SET_SPEED,     // FWD, new speed
+  BENCH_SET_REVERSE,   // FWD -> STOPPING, for a reverse
+  BENCH_SET_HOLD,      // STOPPING, within the brake window
+  BENCH_SET_RESTART,   // STOPPING -> START reverse, window over
+  BENCH_SET_STOP,      // REV -> STOPPING, on 0
+  BENCH_UPD_RUN,       // update(): FWD, nothing due
+  BENCH_UPD_RAMP,      // FWD, ramping to the command
+  BENCH_UPD_BRAKE,     // STOPPING, window not over
+  BENCH_UPD_STOPPED,   // STOPPING -> STOPPED
+  BENCH_UPD_IDLE,      // STOPPED
+  BENCH_LOOP,          // loop(), one idle pass
+  BENCH_CASES
+};
+
+#define BENCH_SAMPLES 8  // of each motor case
+
+// ASCII commands, a '!', and a binary drive frame (L100, R-50).  Short
+// enough for the core's 64 byte RX buffer
+#define BENCH_STREAM "L-200,R180\nL12,R-7\nM3,V-100\n!\n" \
+                     "\xa5\x12\x64\x32\x4b" "T120,S-40\n"
+#define BENCH_STREAM_LEN (sizeof(BENCH_STREAM) - 1)
+
+#ifndef __AVR__
+static const char *const BenchNames[BENCH_CASES] = {
+  0, "empty", "CommandReader::get",
+  "setSpeed start", "setSpeed kick", "setSpeed started", "setSpeed speed",
+  "setSpeed reverse", "setSpeed hold", "setSpeed restart", "setSpeed stop",
+  "update run", "update ramp", "update brake", "update stopped", "update idle",
+  "loop" };
+#endif
+
+#endif
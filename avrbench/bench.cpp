@@ -0,0 +1,113 @@
+/*
+AVR side of the cycle benchmarks: the sketch, built for one driver
+configuration (see Makefile), with a setup() of its own that times the
+parser, the motor state transitions and loop() on the chip, for run.c
+to count under simavr (see Bench.h).
+
+Each case is timed with interrupts off, so the counts are the code's
+own, the same from run to run; a Timer0 or UART interrupt adds its own
+time on top on the robot.  The sketch's setup() runs first, as on the
+robot, with no power-on lock-out to wait out.  At the end the chip
+sleeps with interrupts off, which ends the simulation.
+
+provided under LGPL license
+*/
+#include <Arduino.h>
+#define setup sketchSetup
+#define loop sketchLoop
+#include "../TankDrive.ino"
+#undef setup
+#undef loop
+#include <avr/sleep.h>
+#include "Bench.h"
+
+// time one call of expr as case id
+#define BENCH(id,expr) do { cli(); GPIOR0 = (id); expr; GPIOR0 = BENCH_END; sei(); } while(0)
+
+// ms, keeping telemetry going out
+static void wait(const unsigned long ms)
+{
+  unsigned long t0 = millis();
+  while (millis() - t0 < ms) Tel.drain();
+}
+
+// the parser on BENCH_STREAM, fed by the runner.  One case per get()
+static void benchParser()
+{
+  unsigned long t0 = millis();
+  while ((Serial.available() < (int)BENCH_STREAM_LEN) && (millis() - t0 < 1000)) ;
+  char c;
+  int v;
+  while (Serial.available() || Command.pendCode)
+    BENCH(BENCH_GET,Command.get(c,v));
+}
+
+// MotL through each state transition, n times
+static void benchMotor(const byte n)
+{
+  unsigned long pulse = MotL._startupTime / MOTOR_TICKS_PER_MS + 2;
+  unsigned long brake = ((unsigned long)MotL._maxPWM * MotL._decel >> 8) + 2;
+  wait(brake);
+  MotL.update(MOTOR_CLOCK());  // power-on stop over
+  for (byte k=0; k < n; k++)
+    {
+      BENCH(BENCH_UPD_IDLE,MotL.update(MOTOR_CLOCK()));
+      BENCH(BENCH_SET_START,MotL.setSpeed(100));
+      BENCH(BENCH_SET_KICK,MotL.setSpeed(100));
+      wait(pulse);
+      BENCH(BENCH_SET_STARTED,MotL.setSpeed(100));
+      BENCH(BENCH_UPD_RUN,MotL.update(MOTOR_CLOCK()));
+      BENCH(BENCH_SET_SPEED,MotL.setSpeed(150));
+      BENCH(BENCH_SET_REVERSE,MotL.setSpeed(-100));
+      BENCH(BENCH_SET_HOLD,MotL.setSpeed(-100));
+      BENCH(BENCH_UPD_BRAKE,MotL.update(MOTOR_CLOCK()));
+      wait(brake);
+      BENCH(BENCH_SET_RESTART,MotL.setSpeed(-100));
+      wait(pulse);
+      MotL.setSpeed(-100);  // REV
+      BENCH(BENCH_SET_STOP,MotL.setSpeed(0));
+      wait(brake);
+      BENCH(BENCH_UPD_STOPPED,MotL.update(MOTOR_CLOCK()));
+    }
+
+  // ramping, 1 count per ms each way
+  MotL.setRampRates(1.0f,1.0f);
+  MotL.setSpeed(100);
+  wait(pulse);
+  MotL.setSpeed(100);
+  MotL.setSpeed(200);
+  for (byte k=0; k < n; k++)
+    {
+      wait(1);
+      BENCH(BENCH_UPD_RAMP,MotL.update(MOTOR_CLOCK()));
+    }
+  MotL.setRampRates(0,0);
+  MotL.setSpeed(0);
+  wait(brake);
+  MotL.update(MOTOR_CLOCK());
+}
+
+void setup()
+{
+  MotL.setStopTimeout(0);
+  MotR.setStopTimeout(0);
+  sketchSetup();
+  for (byte k=0; k < BENCH_SAMPLES; k++) BENCH(BENCH_EMPTY,);
+  benchParser();
+  benchMotor(BENCH_SAMPLES);
+
+  // loop() as it comes: mostly idle, now and then a task due
+  for (byte k=0; k < 4 * BENCH_SAMPLES; k++)
+    {
+      BENCH(BENCH_LOOP,sketchLoop());
+      delayMicroseconds(230);
+    }
+
+  wait(20);  // telemetry out
+  cli();
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sleep_cpu();
+}
+
+void loop() {}
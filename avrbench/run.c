@@ -0,0 +1,179 @@
+/*
+Run a bench ELF (bench.cpp, one driver configuration) under simavr, and
+print its results as one JSON object:
+
+  {"config": "L298", "mcu": "atmega328p", "f_cpu": 16000000,
+   "flash": 9876, "sram": 1012,
+   "cycles": {"CommandReader::get": {"n": 49, "worst": 140, "typical": 38}, ...}}
+
+flash and sram are the sketch's own (text + data, and data + bss, as
+avr-size gives them), from the sketch ELF given with -s.  Cycles are
+per call, less the cost of the marks (see Bench.h): worst is the
+highest sample, typical the median.
+
+  run [-c config] [-s sketch.elf] [-m mcu] [-f hz] bench.elf
+
+Exits non-zero if the firmware crashed, never finished, or left a case
+without samples.
+
+provided under LGPL license
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "avr_uart.h"
+#include "Bench.h"
+
+#define MAX_CYCLES 2000000000ULL  /* about two minutes of chip time */
+
+static struct
+{
+  unsigned long *v;
+  int n, size;
+} Samples[BENCH_CASES];
+
+static uint8_t Mark;          /* case being timed, BENCH_END if none */
+static avr_cycle_count_t T0;  /* cycle it started */
+static avr_irq_t *Rx;         /* UART 0 input */
+static int Fed;
+
+static void sample(const int id, const unsigned long cycles)
+{
+  if (Samples[id].n == Samples[id].size)
+    {
+      Samples[id].size = Samples[id].size ? 2 * Samples[id].size : 64;
+      Samples[id].v = realloc(Samples[id].v,Samples[id].size * sizeof(unsigned long));
+      if (!Samples[id].v) { perror("run"); exit(2); }
+    }
+  Samples[id].v[Samples[id].n++] = cycles;
+}
+
+/* GPIOR0 written */
+static void mark(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+  (void)addr; (void)param;
+  if (v != BENCH_END)
+    {
+      Mark = v;
+      T0 = avr->cycle;
+      if (!Fed)
+        {  /* Serial is up by the first mark.  The whole stream fits the
+              UART's input FIFO, which hands it on at the baud rate */
+          for (unsigned k=0; k < BENCH_STREAM_LEN; k++)
+            avr_raise_irq(Rx,(uint8_t)BENCH_STREAM[k]);
+          Fed = 1;
+        }
+      return;
+    }
+  if ((Mark > BENCH_END) && (Mark < BENCH_CASES)) sample(Mark,avr->cycle - T0);
+  Mark = BENCH_END;
+}
+
+static int ascending(const void *a, const void *b)
+{
+  unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+  return((x > y) - (x < y));
+}
+
+static unsigned long median(const int id)
+{
+  return(Samples[id].v[Samples[id].n / 2]);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *config = "", *sketch = 0, *mcu = "atmega328p";
+  unsigned long hz = 16000000;
+  int c;
+  while ((c = getopt(argc,argv,"c:s:m:f:")) != -1)
+    switch(c)
+      {
+      case 'c' : config = optarg; break;
+      case 's' : sketch = optarg; break;
+      case 'm' : mcu = optarg; break;
+      case 'f' : hz = strtoul(optarg,0,0); break;
+      default :
+        fprintf(stderr,"usage: %s [-c config] [-s sketch.elf] [-m mcu] [-f hz] bench.elf\n",argv[0]);
+        return(2);
+      }
+  if (optind != argc - 1)
+    {
+      fprintf(stderr,"%s: no bench ELF\n",argv[0]);
+      return(2);
+    }
+
+  unsigned long flash = 0, sram = 0;
+  elf_firmware_t f;
+  if (sketch)
+    {
+      memset(&f,0,sizeof(f));
+      if (elf_read_firmware(sketch,&f))
+        {
+          fprintf(stderr,"%s: can not read %s\n",argv[0],sketch);
+          return(2);
+        }
+      flash = f.flashsize;
+      sram = f.datasize + f.bsssize;
+    }
+
+  memset(&f,0,sizeof(f));
+  if (elf_read_firmware(argv[optind],&f))
+    {
+      fprintf(stderr,"%s: can not read %s\n",argv[0],argv[optind]);
+      return(2);
+    }
+  avr_t *avr = avr_make_mcu_by_name(mcu);
+  if (!avr)
+    {
+      fprintf(stderr,"%s: no simavr core for %s\n",argv[0],mcu);
+      return(2);
+    }
+  avr_init(avr);
+  avr_load_firmware(avr,&f);
+  avr->frequency = hz;
+
+  /* telemetry is binary: keep it off stdout */
+  uint32_t flags = 0;
+  avr_ioctl(avr,AVR_IOCTL_UART_GET_FLAGS('0'),&flags);
+  flags &= ~AVR_UART_FLAG_STDIO;
+  avr_ioctl(avr,AVR_IOCTL_UART_SET_FLAGS('0'),&flags);
+  Rx = avr_io_getirq(avr,AVR_IOCTL_UART_GETIRQ('0'),UART_IRQ_INPUT);
+  avr_register_io_write(avr,BENCH_MARK_ADDR,mark,0);
+
+  int state = cpu_Running;
+  while ((state != cpu_Done) && (state != cpu_Crashed) && (avr->cycle < MAX_CYCLES))
+    state = avr_run(avr);
+  if (state != cpu_Done)
+    {
+      fprintf(stderr,"%s: %s %s\n",argv[0],argv[optind],
+              (state == cpu_Crashed) ? "crashed" : "did not finish");
+      return(1);
+    }
+  for (int id=BENCH_EMPTY; id < BENCH_CASES; id++)
+    {
+      if (!Samples[id].n)
+        {
+          fprintf(stderr,"%s: no samples of %s\n",argv[0],BenchNames[id]);
+          return(1);
+        }
+      qsort(Samples[id].v,Samples[id].n,sizeof(unsigned long),ascending);
+    }
+
+  unsigned long marks = median(BENCH_EMPTY);
+  printf("{\"config\": \"%s\", \"mcu\": \"%s\", \"f_cpu\": %lu,\n",config,mcu,hz);
+  printf(" \"flash\": %lu, \"sram\": %lu,\n",flash,sram);
+  printf(" \"cycles\": {");
+  for (int id=BENCH_EMPTY+1; id < BENCH_CASES; id++)
+    {
+      unsigned long worst = Samples[id].v[Samples[id].n - 1], typical = median(id);
+      printf("%s\n  \"%s\": {\"n\": %d, \"worst\": %lu, \"typical\": %lu}",
+             (id > BENCH_EMPTY+1) ? "," : "",BenchNames[id],Samples[id].n,
+             (worst > marks) ? worst - marks : 0,(typical > marks) ? typical - marks : 0);
+    }
+  printf("}}\n");
+  return(0);
+}
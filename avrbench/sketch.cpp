@@ -0,0 +1,8 @@
+/*
+The sketch alone, as the IDE would build it, for its flash and SRAM in
+each configuration (see Makefile)
+
+provided under LGPL license
+*/
+#include <Arduino.h>
+#include "../TankDrive.ino"
@@ -0,0 +1,636 @@
+/*
+Host-side stand-in for the Arduino core.  See Arduino.h
+
+provided under LGPL license
+*/
+#include "Arduino.h"
+#include <stdio.h>
+#include <deque>
+
+void loop();
+
+HardwareSerial Serial;
+volatile uint8_t UDR0, GPIOR0;
+volatile uint8_t PCICR, PCMSK0, PCMSK1, PCMSK2;
+volatile uint8_t ADMUX, ADCSRA;
+volatile uint16_t ADC;
+sim::TimerReg<uint8_t,0> TCCR0A, OCR0A, OCR0B;
+sim::TimerReg<uint8_t,2> TCCR2A, OCR2A, OCR2B;
+volatile uint8_t TCCR0B, TCCR2B;
+sim::TimerReg<uint8_t>  TCCR1A, TCCR1B;
+sim::TimerReg<uint16_t> OCR1A, OCR1B, ICR1;
+sim::PortReg PORTB(8), PORTC(14), PORTD(0);
+sim::PinReg  PINB(8), PINC(14), PIND(0);
+
+namespace
+{
+  struct RxByte { uint64_t t; uint8_t c; };
+
+  uint64_t Now;
+  unsigned long Baud;
+
+  std::deque<RxByte> RxLine;      // bytes still "on the wire"
+  uint8_t  RxBuf[SERIAL_RX_BUFFER_SIZE];
+  unsigned RxHead, RxCount;
+  uint32_t RxLost;
+
+  std::deque<uint64_t> TxDone;    // completion time of each queued TX byte
+  std::string TxLog;
+
+  int PinDig[NUM_DIGITAL_PINS];
+  int PinPWM[NUM_DIGITAL_PINS];
+  int PinModes[NUM_DIGITAL_PINS];
+  int PinIn[NUM_DIGITAL_PINS];
+  int AnalogIn[NUM_DIGITAL_PINS];
+  double PinDutyV[NUM_DIGITAL_PINS];
+  bool PinTimer[NUM_DIGITAL_PINS];  // a timer's compare output drives it
+
+  sim::PinHook Hook;
+  void *HookCtx;
+
+  sim::TickHook Tick;
+  void *TickCtx;
+  uint32_t TickUs;
+  uint64_t NextTick;
+
+  uint32_t Irqs;     // ISRs run, so sleepCpu() knows to wake
+
+  bool AdcBusy;      // conversion in progress
+  uint64_t AdcDone;  // when it completes
+  sim::Counters Count;
+
+  void deliverRx()
+  {
+    while (!RxLine.empty() && RxLine.front().t <= Now)
+      {
+        if (sim_USART_RX_vect)
+          {  // firmware has its own RX interrupt handler
+            UDR0 = RxLine.front().c;
+            sim_USART_RX_vect();
+          }
+        else if (RxCount < SERIAL_RX_BUFFER_SIZE)
+          {
+            RxBuf[(RxHead + RxCount) % SERIAL_RX_BUFFER_SIZE] = RxLine.front().c;
+            RxCount++;
+          }
+        else
+          RxLost++;
+        RxLine.pop_front();
+        Irqs++;
+      }
+  }
+
+  void drainTx()
+  {
+    while (!TxDone.empty() && TxDone.front() <= Now) TxDone.pop_front();
+  }
+
+  inline bool validPin(uint8_t pin) { return(pin < NUM_DIGITAL_PINS); }
+
+  void pinChanged(uint8_t pin)
+  {
+    if (Hook) Hook(pin,PinPWM[pin],HookCtx);
+  }
+
+  // Timer1 TOP, 0 when not in a PWM mode.  pc: phase correct (up and down)
+  uint16_t timer1Top(bool *pc)
+  {
+    int wgm = (TCCR1A & 3) | ((TCCR1B >> 1) & 0x0c);
+    *pc = (wgm < 4) || (wgm > 7 && wgm < 12);
+    switch(wgm)
+      {
+      case 1: case 5: return(255);
+      case 2: case 6: return(511);
+      case 3: case 7: return(1023);
+      case 8: case 10: case 14: return(ICR1);
+      case 9: case 11: case 15: return(OCR1A);
+      }
+    return(0);
+  }
+
+  // port register and bit of a pin
+  sim::PortReg &port(uint8_t pin) { return((pin < 8) ? PORTD : ((pin < 14) ? PORTB : PORTC)); }
+  inline uint8_t portBit(uint8_t pin) { return(1 << ((pin < 8) ? pin : ((pin < 14) ? pin-8 : pin-14))); }
+
+  // pin driven at level, by the port
+  void portDrive(uint8_t pin, bool level)
+  {
+    PinTimer[pin] = false;
+    PinDig[pin] = level ? HIGH : LOW;
+    PinPWM[pin] = level ? 255 : 0;
+    PinDutyV[pin] = level ? 1.0 : 0;
+    pinChanged(pin);
+  }
+
+  // timer compare output connected or not: once not, the port drives the pin
+  bool timerConnected(uint8_t pin, bool on)
+  {
+    if (!on && PinTimer[pin]) portDrive(pin,port(pin) & portBit(pin));
+    return(on);
+  }
+
+  // output of OC1A/OC1B, if the timer is connected to the pin
+  void timer1Pin(uint8_t pin, uint8_t com, uint16_t ocr, bool always)
+  {
+    if (!timerConnected(pin,TCCR1A & _BV(com))) return;  // the port drives it
+    if (!PinTimer[pin]) always = true;
+    PinTimer[pin] = true;
+    bool pc;
+    uint16_t top = timer1Top(&pc);
+    double d = 0;
+    if (top) d = (ocr >= top) ? 1.0 : (pc ? (double)ocr / top : (ocr + 1.0) / (top + 1.0));
+    if (!always && (d == PinDutyV[pin])) return;
+    PinDutyV[pin] = d;
+    PinPWM[pin] = (int)(d * 255 + 0.5);
+    PinDig[pin] = (PinPWM[pin] >= 128) ? HIGH : LOW;
+    pinChanged(pin);
+  }
+
+  // output of OC0x/OC2x, if the timer is connected to the pin: OCR of 255
+  template<class REG> void timer8Pin(uint8_t pin, REG &tccr, uint8_t com, uint8_t ocr)
+  {
+    if (!timerConnected(pin,tccr & _BV(com))) return;
+    if (PinTimer[pin] && (PinPWM[pin] == ocr)) return;
+    PinTimer[pin] = true;
+    PinPWM[pin] = ocr;
+    PinDutyV[pin] = ocr / 255.0;
+    PinDig[pin] = (ocr >= 128) ? HIGH : LOW;
+    pinChanged(pin);
+  }
+
+  // the core's digitalWrite()/analogWrite(0 or 255) disconnect the timer
+  void timerOff(uint8_t pin)
+  {
+    switch(pin)
+      {
+      case  3: TCCR2A.set(TCCR2A & ~_BV(COM2B1)); break;
+      case  5: TCCR0A.set(TCCR0A & ~_BV(COM0B1)); break;
+      case  6: TCCR0A.set(TCCR0A & ~_BV(COM0A1)); break;
+      case  9: TCCR1A.set(TCCR1A & ~_BV(COM1A1)); break;
+      case 10: TCCR1A.set(TCCR1A & ~_BV(COM1B1)); break;
+      case 11: TCCR2A.set(TCCR2A & ~_BV(COM2A1)); break;
+      }
+    PinTimer[pin] = false;
+  }
+
+  // and analogWrite() in between connects it, at val
+  void timerOn(uint8_t pin, uint8_t val)
+  {
+    switch(pin)
+      {
+      case  3: OCR2B.set(val); TCCR2A.set(TCCR2A | _BV(COM2B1)); break;
+      case  5: OCR0B.set(val); TCCR0A.set(TCCR0A | _BV(COM0B1)); break;
+      case  6: OCR0A.set(val); TCCR0A.set(TCCR0A | _BV(COM0A1)); break;
+      case 11: OCR2A.set(val); TCCR2A.set(TCCR2A | _BV(COM2A1)); break;
+      default: return;
+      }
+    PinTimer[pin] = true;
+  }
+
+  // the port's level on pin, as a digitalWrite() leaves it
+  void portSet(uint8_t pin, bool level)
+  {
+    sim::PortReg &p = port(pin);
+    p.set(level ? (p | portBit(pin)) : (p & ~portBit(pin)));
+  }
+
+  uint32_t prescale(uint8_t cs, bool timer2)
+  {
+    static const uint32_t Div[8]  = { 0, 1, 8,  64, 256, 1024, 0, 0 };
+    static const uint32_t Div2[8] = { 0, 1, 8,  32,  64,  128, 256, 1024 };
+    return(timer2 ? Div2[cs & 7] : Div[cs & 7]);
+  }
+
+  // firmware set ADSC: start a conversion, 13 ADC clocks at 16 MHz / prescaler
+  void adcPoll()
+  {
+    if (AdcBusy || !(ADCSRA & _BV(ADEN)) || !(ADCSRA & _BV(ADSC))) return;
+    uint32_t div = 1u << (ADCSRA & 7);
+    if (div < 2) div = 2;
+    AdcBusy = true;
+    AdcDone = Now + 13 * div / 16;
+  }
+
+  void adcComplete()
+  {
+    AdcBusy = false;
+    int v = AnalogIn[ADMUX & 0x0f];
+    ADC = (v < 0) ? 0 : ((v > 1023) ? 1023 : v);
+    ADCSRA &= ~_BV(ADSC);
+    if ((ADCSRA & _BV(ADIE)) && sim_ADC_vect)
+      {
+        sim_ADC_vect();  // clears ADIF
+        Irqs++;
+      }
+    else ADCSRA |= _BV(ADIF);
+  }
+
+  // input pin changed level.  run its pin change ISR, if enabled
+  void pinChangeIrq(uint8_t pin)
+  {
+    void (*vect)(void) = 0;
+    if (pin < 8)
+      {
+        if ((PCICR & _BV(PCIE2)) && (PCMSK2 & _BV(pin))) vect = sim_PCINT2_vect;
+      }
+    else if (pin < 14)
+      {
+        if ((PCICR & _BV(PCIE0)) && (PCMSK0 & _BV(pin-8))) vect = sim_PCINT0_vect;
+      }
+    else if ((PCICR & _BV(PCIE1)) && (PCMSK1 & _BV(pin-14))) vect = sim_PCINT1_vect;
+    if (vect)
+      {
+        vect();
+        Irqs++;
+      }
+  }
+}
+
+// ------------------------------------------------------------- time
+unsigned long millis() { return((unsigned long)(uint32_t)(Now / 1000)); }
+unsigned long micros() { return((unsigned long)(uint32_t)Now); }
+void delay(unsigned long ms) { sim::advance(ms*1000); }
+void delayMicroseconds(unsigned int us) { sim::advance(us); }
+
+// ------------------------------------------------------------- pins
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (validPin(pin)) PinModes[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  Count.digitalWrites++;
+  if (!validPin(pin)) return;
+  timerOff(pin);
+  portSet(pin,val);
+  PinDig[pin] = val ? HIGH : LOW;
+  PinPWM[pin] = val ? 255 : 0;
+  PinDutyV[pin] = val ? 1.0 : 0;
+  pinChanged(pin);
+}
+
+int digitalRead(uint8_t pin)
+{
+  Count.digitalReads++;
+  if (!validPin(pin)) return(LOW);
+  return((PinModes[pin] == OUTPUT) ? PinDig[pin] : PinIn[pin]);
+}
+
+void analogWrite(uint8_t pin, int val)
+{
+  Count.analogWrites++;
+  if (!validPin(pin)) return;
+  if (val < 0) val = 0;
+  if (val > 255) val = 255;
+  if (((pin == 9) || (pin == 10)) && (val > 0) && (val < 255))
+    {  // the core stores val in OCR1x: the duty is val / Timer1's TOP
+      if (pin == 9) OCR1A.set(val);
+      else          OCR1B.set(val);
+      TCCR1A.set(TCCR1A | _BV((pin == 9) ? COM1A1 : COM1B1));
+      timer1Pin(pin,(pin == 9) ? COM1A1 : COM1B1,val,true);
+      return;
+    }
+  if ((val > 0) && (val < 255)) timerOn(pin,val);
+  else
+    {
+      timerOff(pin);
+      portSet(pin,val);
+    }
+  PinPWM[pin] = val;
+  PinDutyV[pin] = val / 255.0;
+  PinDig[pin] = (val >= 128) ? HIGH : LOW;
+  pinChanged(pin);
+}
+
+int analogRead(uint8_t pin)
+{
+  Count.analogReads++;
+  sim::advance(100);  // a conversion takes ~100us, and blocks
+  return(validPin(pin) ? AnalogIn[pin] : 0);
+}
+
+// ------------------------------------------------------------- Print
+size_t Print::print(long n, int base)
+{
+  if (n < 0 && base == DEC)
+    {
+      size_t k = write('-');
+      return(k + print((unsigned long)(-n),base));
+    }
+  return(print((unsigned long)n,base));
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  char buf[8*sizeof(long)+1];
+  char *p = buf + sizeof(buf) - 1;
+  *p = 0;
+  if (base < 2) base = 10;
+  do {
+    int d = n % base;
+    *--p = (char)((d < 10) ? ('0' + d) : ('A' + d - 10));
+    n /= base;
+  } while (n);
+  return(write(p));
+}
+
+size_t Print::print(double x, int digits)
+{
+  char buf[48];
+  snprintf(buf,sizeof(buf),"%.*f",digits,x);
+  return(write(buf));
+}
+
+// ------------------------------------------------------------- Serial
+void HardwareSerial::begin(unsigned long baud) { Baud = baud; }
+
+int HardwareSerial::available()
+{
+  deliverRx();
+  return(RxCount);
+}
+
+int HardwareSerial::peek()
+{
+  deliverRx();
+  return(RxCount ? RxBuf[RxHead] : -1);
+}
+
+int HardwareSerial::read()
+{
+  deliverRx();
+  if (!RxCount) return(-1);
+  int c = RxBuf[RxHead];
+  RxHead = (RxHead + 1) % SERIAL_RX_BUFFER_SIZE;
+  RxCount--;
+  return(c);
+}
+
+int HardwareSerial::availableForWrite()
+{
+  drainTx();
+  return(SERIAL_TX_BUFFER_SIZE - (int)TxDone.size());
+}
+
+void HardwareSerial::flush()
+{
+  if (!TxDone.empty() && TxDone.back() > Now)
+    {
+      uint64_t wait = TxDone.back() - Now;
+      Count.txBlockedUs += (uint32_t)wait;
+      sim::advance((uint32_t)wait);
+    }
+  drainTx();
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  drainTx();
+  if (TxDone.size() >= SERIAL_TX_BUFFER_SIZE)
+    {  // buffer full.  The real core spins here until the UART frees a slot
+      uint64_t wait = TxDone.front() - Now;
+      Count.txBlockedUs += (uint32_t)wait;
+      sim::advance((uint32_t)wait);
+      drainTx();
+    }
+  uint64_t start = TxDone.empty() ? Now : TxDone.back();
+  if (start < Now) start = Now;
+  TxDone.push_back(start + sim::byteTime());
+  TxLog.push_back((char)c);
+  Count.txBytes++;
+  return(1);
+}
+
+// ------------------------------------------------------------- sim
+namespace sim
+{
+  void reset()
+  {
+    Now = 0;
+    Baud = 0;
+    RxLine.clear();
+    RxHead = RxCount = 0;
+    RxLost = 0;
+    TxDone.clear();
+    TxLog.clear();
+    for (int i=0; i < NUM_DIGITAL_PINS; i++)
+      PinDig[i] = PinPWM[i] = PinModes[i] = PinIn[i] = AnalogIn[i] = 0;
+    for (int i=0; i < NUM_DIGITAL_PINS; i++)
+      {
+        PinDutyV[i] = 0;
+        PinTimer[i] = false;
+      }
+    PCICR = PCMSK0 = PCMSK1 = PCMSK2 = 0;
+    PORTB.set(0);
+    PORTC.set(0);
+    PORTD.set(0);
+    TCCR0A.set(_BV(WGM01) | _BV(WGM00));  // as the Arduino core's init()
+    TCCR0B = _BV(CS01) | _BV(CS00);
+    TCCR1A.set(_BV(WGM10));
+    TCCR1B.set(_BV(CS11) | _BV(CS10));
+    TCCR2A.set(_BV(WGM20));
+    TCCR2B = _BV(CS22);
+    OCR0A.set(0);
+    OCR0B.set(0);
+    OCR2A.set(0);
+    OCR2B.set(0);
+    OCR1A.set(0);
+    OCR1B.set(0);
+    ICR1.set(0);
+    ADMUX = ADCSRA = 0;
+    ADC = 0;
+    AdcBusy = false;
+    Irqs = 0;
+    Tick = 0;
+    TickCtx = 0;
+    Hook = 0;
+    HookCtx = 0;
+    memset(&Count,0,sizeof(Count));
+  }
+
+  uint64_t now() { return(Now); }
+
+  void setTime(uint64_t us)
+  {
+    if (AdcBusy) AdcDone = us + ((AdcDone > Now) ? AdcDone - Now : 0);  // carries on from the new time
+    if (Tick) NextTick = us + ((NextTick > Now) ? NextTick - Now : 0);
+    Now = us;
+    deliverRx();
+  }
+
+  void advance(uint32_t us)
+  {
+    uint64_t end = Now + us;
+    for (;;)
+      {  // ticks and ADC conversions (and their ISR) run in time order
+        adcPoll();
+        bool adc = AdcBusy && (AdcDone <= end);
+        bool tick = Tick && (NextTick <= end);
+        if (!adc && !tick) break;
+        if (tick && (!adc || (NextTick <= AdcDone)))
+          {
+            Now = NextTick;
+            deliverRx();
+            NextTick += TickUs;
+            Tick(TickUs,TickCtx);
+          }
+        else
+          {
+            Now = AdcDone;
+            deliverRx();
+            adcComplete();
+          }
+      }
+    Now = end;
+    deliverRx();
+  }
+
+  unsigned long baud() { return(Baud); }
+
+  uint32_t byteTime()
+  {
+    return(Baud ? (uint32_t)((10UL*1000000UL + Baud/2) / Baud) : 0);
+  }
+
+  void rxAt(uint64_t startUs, const uint8_t *buf, size_t n)
+  {
+    uint64_t t = RxLine.empty() ? Now : RxLine.back().t;
+    if (t < startUs) t = startUs;
+    uint32_t dt = byteTime();
+    for (size_t i=0; i < n; i++)
+      {
+        t += dt;  // byte is available once its stop bit is in
+        RxByte b = { t, buf[i] };
+        RxLine.push_back(b);
+      }
+    deliverRx();
+  }
+
+  void rx(const uint8_t *buf, size_t n) { rxAt(Now,buf,n); }
+  void rx(const char *s) { rx((const uint8_t *)s,strlen(s)); }
+  size_t rxPending() { return(RxLine.size()); }
+  uint32_t rxOverflows() { return(RxLost); }
+
+  std::string &tx() { return(TxLog); }
+
+  int pinDigital(uint8_t pin) { return(validPin(pin) ? PinDig[pin] : 0); }
+  int pinPWM(uint8_t pin)     { return(validPin(pin) ? PinPWM[pin] : 0); }
+  double pinDuty(uint8_t pin) { return(validPin(pin) ? PinDutyV[pin] : 0); }
+
+  double timerHz(int timer)
+  {
+    bool pc;
+    uint16_t top;
+    uint32_t div;
+    switch(timer)
+      {
+      case 0:
+        div = prescale(TCCR0B,false);
+        return(div ? (double)F_CPU / div / (((TCCR0A & 3) == 3) ? 256 : 510) : 0);
+      case 1:
+        div = prescale(TCCR1B,false);
+        top = timer1Top(&pc);
+        if (!div || !top) return(0);
+        return(pc ? (double)F_CPU / div / (2.0 * top) : (double)F_CPU / div / (top + 1.0));
+      case 2:
+        div = prescale(TCCR2B,true);
+        return(div ? (double)F_CPU / div / (((TCCR2A & 3) == 3) ? 256 : 510) : 0);
+      }
+    return(0);
+  }
+
+  void timerWritten(int timer)
+  {
+    switch(timer)
+      {
+      case 0:
+        timer8Pin(6,TCCR0A,COM0A1,OCR0A);
+        timer8Pin(5,TCCR0A,COM0B1,OCR0B);
+        return;
+      case 1:
+        timer1Pin( 9,COM1A1,OCR1A,false);
+        timer1Pin(10,COM1B1,OCR1B,false);
+        return;
+      case 2:
+        timer8Pin(11,TCCR2A,COM2A1,OCR2A);
+        timer8Pin( 3,TCCR2A,COM2B1,OCR2B);
+        return;
+      }
+  }
+
+  void portWritten(uint8_t pin0, uint8_t was, uint8_t now)
+  {
+    uint8_t n = pin0 ? 6 : 8;  // PB6, PB7, PC6 are not Arduino pins
+    for (uint8_t b=0; b < n; b++)
+      if (((was ^ now) & (1 << b)) && !PinTimer[pin0 + b])
+        portDrive(pin0 + b,now & (1 << b));
+  }
+
+  uint8_t portLevels(uint8_t pin0)
+  {
+    uint8_t n = pin0 ? 6 : 8, v = 0;
+    for (uint8_t b=0; b < n; b++)
+      {
+        uint8_t pin = pin0 + b;
+        if ((PinModes[pin] == OUTPUT) ? PinDig[pin] : PinIn[pin]) v |= 1 << b;
+      }
+    return(v);
+  }
+  int pinMode(uint8_t pin)    { return(validPin(pin) ? PinModes[pin] : 0); }
+  void setAnalogInput(uint8_t pin, int counts) { if (validPin(pin)) AnalogIn[pin] = counts; }
+  void setDigitalInput(uint8_t pin, int val)
+  {
+    if (!validPin(pin)) return;
+    val = val ? HIGH : LOW;
+    if (PinIn[pin] == val) return;
+    PinIn[pin] = val;
+    pinChangeIrq(pin);
+  }
+
+  void setPinHook(PinHook fn, void *ctx)
+  {
+    Hook = fn;
+    HookCtx = ctx;
+  }
+
+  void setTickHook(TickHook fn, void *ctx, uint32_t periodUs)
+  {
+    Tick = periodUs ? fn : 0;
+    TickCtx = ctx;
+    TickUs = periodUs;
+    NextTick = Now + periodUs;
+  }
+
+  Counters &counters() { return(Count); }
+
+  void sleepCpu()
+  {
+    uint64_t t0 = Now;
+    uint64_t wake = (Now / 1024 + 1) * 1024;  // Timer0 overflow
+    if (!RxLine.empty() && (RxLine.front().t < wake)) wake = RxLine.front().t;
+    uint32_t irq = Irqs;
+    while ((Now < wake) && (Irqs == irq))
+      {  // step to each timed event, in case its ISR wakes us
+        uint64_t next = wake;
+        if (Tick && (NextTick < next)) next = NextTick;
+        adcPoll();
+        if (AdcBusy && (AdcDone < next)) next = AdcDone;
+        advance((uint32_t)(next - Now));
+      }
+    Count.sleeps++;
+    Count.sleepUs += Now - t0;
+  }
+
+  uint32_t runLoop(uint64_t untilUs, uint32_t loopUs)
+  {
+    uint32_t n = 0;
+    while (Now < untilUs)
+      {
+        loop();
+        advance(loopUs);
+        n++;
+      }
+    return(n);
+  }
+}
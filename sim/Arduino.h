@@ -0,0 +1,305 @@
+/*
+Host-side stand-in for the Arduino core, so the TankDrive sketch and its
+motor driver headers can be compiled and run on Linux, unchanged.
+
+Time is virtual.  Nothing advances the clock except sim::advance()
+(or a Serial write that has to wait for room in the TX buffer, just like
+the real HardwareSerial does).  Pin writes are recorded so a simulation
+or benchmark can inspect what the firmware asked the hardware to do.
+
+provided under LGPL license
+*/
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool    boolean;
+
+#define HIGH 1
+#define LOW  0
+
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+
+#define LED_BUILTIN 13
+#define NUM_DIGITAL_PINS 20
+
+#define SERIAL_RX_BUFFER_SIZE 64
+#define SERIAL_TX_BUFFER_SIZE 64
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+// AVR interrupt plumbing.  ISR(USART_RX_vect) in the firmware becomes a
+// function the simulated UART calls, with the byte in UDR0, as each
+// byte arrives.  Without one, bytes go to the Serial RX buffer.
+#define ISR(vect) extern "C" void vect(void)
+#define USART_RX_vect sim_USART_RX_vect
+extern "C" void sim_USART_RX_vect(void) __attribute__((weak));
+extern volatile uint8_t UDR0;
+// a plain byte here: avrbench/ marks its timed cases in it, for simavr
+extern volatile uint8_t GPIOR0;
+
+// Pin change interrupts.  When enabled in PCICR and PCMSKn, a change of
+// level from sim::setDigitalInput() calls the firmware's ISR(PCINTn_vect):
+// PCINT0 for pins 8..13, PCINT1 for 14..19 (A0..A5), PCINT2 for 0..7.
+extern volatile uint8_t PCICR, PCMSK0, PCMSK1, PCMSK2;
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCINT0_vect sim_PCINT0_vect
+#define PCINT1_vect sim_PCINT1_vect
+#define PCINT2_vect sim_PCINT2_vect
+extern "C" void sim_PCINT0_vect(void) __attribute__((weak));
+extern "C" void sim_PCINT1_vect(void) __attribute__((weak));
+extern "C" void sim_PCINT2_vect(void) __attribute__((weak));
+
+// ADC, for firmware that runs conversions from ISR(ADC_vect) instead of
+// analogRead().  Setting ADSC (with ADEN) starts a conversion of the
+// ADMUX channel; 13 ADC clocks later ADC holds the sim::setAnalogInput()
+// value, and the ISR runs if ADIE is set.
+extern volatile uint8_t ADMUX, ADCSRA;
+extern volatile uint16_t ADC;
+#define REFS0 6
+#define ADEN  7
+#define ADSC  6
+#define ADIF  4
+#define ADIE  3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define ADC_vect sim_ADC_vect
+extern "C" void sim_ADC_vect(void) __attribute__((weak));
+
+// Timers, for firmware that sets PWM frequency and resolution itself.
+// Reset leaves them as the Arduino core's init() does: Timer0 fast PWM,
+// Timer1 and Timer2 8 bit phase correct, all at clk/64.  Timer1 is
+// modelled: writing its registers changes what pins 9 (OC1A) and
+// 10 (OC1B) output (sim::pinDuty()), as analogWrite() to them does.
+// Of Timer0 and Timer2, the compare outputs are: with COMnx1 set in
+// TCCRnA, pins 6, 5 (OC0A, OC0B) and 11, 3 (OC2A, OC2B) output OCRnx
+// out of 255.  Their prescalers only hold what was written.
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+namespace sim
+{
+  void timerWritten(int timer);
+
+  template<class T, int TIMER=1> class TimerReg
+  {
+    volatile T v;
+  public:
+    operator T() const { return(v); }
+    TimerReg &operator=(T x) { v = x; timerWritten(TIMER); return(*this); }
+    TimerReg &operator|=(int x) { return(*this = (T)(v | x)); }
+    TimerReg &operator&=(int x) { return(*this = (T)(v & x)); }
+    void set(T x) { v = x; }  // without a side effect
+  };
+}
+extern sim::TimerReg<uint8_t,0> TCCR0A, OCR0A, OCR0B;
+extern sim::TimerReg<uint8_t,2> TCCR2A, OCR2A, OCR2B;
+extern volatile uint8_t TCCR0B, TCCR2B;
+extern sim::TimerReg<uint8_t>  TCCR1A, TCCR1B;
+extern sim::TimerReg<uint16_t> OCR1A, OCR1B, ICR1;
+#define WGM00  0
+#define WGM01  1
+#define COM0B1 5
+#define COM0A1 7
+#define CS00   0
+#define CS01   1
+#define WGM10  0
+#define WGM11  1
+#define COM1B1 5
+#define COM1A1 7
+#define CS10   0
+#define CS11   1
+#define CS12   2
+#define WGM12  3
+#define WGM13  4
+#define WGM20  0
+#define WGM21  1
+#define COM2B1 5
+#define COM2A1 7
+#define CS20   0
+#define CS21   1
+#define CS22   2
+#define WGM22  3
+
+// I/O ports, for firmware that writes them itself (FastPin.h).  Writing
+// PORTx drives each pin whose bit changed, unless a timer drives it;
+// PINx reads each pin's level.  PORTD is pins 0..7, PORTB 8..13, PORTC
+// 14..19 (A0..A5)
+namespace sim
+{
+  void portWritten(uint8_t pin0, uint8_t was, uint8_t now);
+  uint8_t portLevels(uint8_t pin0);
+
+  class PortReg
+  {
+    volatile uint8_t v;
+    const uint8_t pin0;  // of bit 0
+  public:
+    explicit PortReg(uint8_t first) : v(0), pin0(first) {}
+    operator uint8_t() const { return(v); }
+    PortReg &operator=(uint8_t x) { uint8_t was = v; v = x; portWritten(pin0,was,x); return(*this); }
+    PortReg &operator|=(int x) { return(*this = (uint8_t)(v | x)); }
+    PortReg &operator&=(int x) { return(*this = (uint8_t)(v & x)); }
+    void set(uint8_t x) { v = x; }  // without a side effect
+  };
+
+  class PinReg
+  {
+    const uint8_t pin0;
+  public:
+    explicit PinReg(uint8_t first) : pin0(first) {}
+    operator uint8_t() const { return(portLevels(pin0)); }
+  };
+}
+extern sim::PortReg PORTB, PORTC, PORTD;
+extern sim::PinReg PINB, PINC, PIND;
+// so FastPin.h takes its port register path here, as on the robot
+#define FASTPIN_AVR
+
+#define _BV(b)  (1 << (b))
+#define bit(b)  (1UL << (b))
+
+inline void cli() {}
+inline void sei() {}
+#define interrupts()   sei()
+#define noInterrupts() cli()
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int  digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+int  analogRead(uint8_t pin);
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+
+  size_t write(const char *s) { return(write((const uint8_t *)s, strlen(s))); }
+  size_t write(const uint8_t *buf, size_t n)
+  {
+    for (size_t i=0; i < n; i++) write(buf[i]);
+    return(n);
+  }
+
+  size_t print(const __FlashStringHelper *s) { return(write((const char *)s)); }
+  size_t print(const char *s) { return(write(s)); }
+  size_t print(char c) { return(write((uint8_t)c)); }
+  size_t print(int n, int base=DEC)           { return(print((long)n,base)); }
+  size_t print(unsigned int n, int base=DEC)  { return(print((unsigned long)n,base)); }
+  size_t print(long n, int base=DEC);
+  size_t print(unsigned long n, int base=DEC);
+  size_t print(double x, int digits=2);
+
+  size_t println() { return(write("\r\n")); }
+  template<class T> size_t println(T x)        { size_t n=print(x);      return(n+println()); }
+  template<class T> size_t println(T x, int b) { size_t n=print(x,b);    return(n+println()); }
+};
+
+class HardwareSerial : public Print
+{
+public:
+  void begin(unsigned long baud);
+  void end() {}
+  int available();
+  int peek();
+  int read();
+  int availableForWrite();
+  void flush();
+  virtual size_t write(uint8_t c);
+  using Print::write;
+  operator bool() { return(true); }
+};
+
+extern HardwareSerial Serial;
+// no USART_RX_vect of its own here, so COMMAND_RX_ISR may take it
+#define COMMAND_CORE_NO_RX_ISR
+
+// ------------------------------------------------------------------
+// Simulation controls.  Not part of the Arduino API.
+namespace sim
+{
+  // Return every pin, the clock and both serial buffers to power-on state
+  void reset();
+
+  uint64_t now();                 // virtual time, us since reset
+  void setTime(uint64_t us);      // jump the clock (e.g. just before a wrap)
+  void advance(uint32_t us);      // let virtual time pass
+
+  unsigned long baud();           // rate passed to Serial.begin()
+  uint32_t byteTime();            // us per 10-bit UART frame at baud()
+
+  // Queue bytes to arrive on the RX line.  Bytes arrive back to back at
+  // the configured baud rate, starting no earlier than startUs.
+  void rxAt(uint64_t startUs, const uint8_t *buf, size_t n);
+  void rx(const char *s);                       // starting now
+  void rx(const uint8_t *buf, size_t n);
+  size_t rxPending();             // queued, not yet arrived
+  uint32_t rxOverflows();         // bytes lost because the 64 byte buffer was full
+
+  std::string &tx();              // everything the firmware has written
+
+  // Pin state as the firmware last left it
+  int  pinDigital(uint8_t pin);   // last digitalWrite value
+  int  pinPWM(uint8_t pin);       // 0..255, digital writes show as 0 or 255
+  double pinDuty(uint8_t pin);    // 0..1, at the timer's full resolution
+  double timerHz(int timer);      // PWM frequency, from the registers
+  int  pinMode(uint8_t pin);
+  void setAnalogInput(uint8_t pin, int counts);
+  void setDigitalInput(uint8_t pin, int val);  // may run a pin change ISR
+
+  // Called after every digitalWrite/analogWrite, and Timer1 register
+  // write that changes pin 9 or 10.  pwm is 0..255.
+  typedef void (*PinHook)(uint8_t pin, int pwm, void *ctx);
+  void setPinHook(PinHook fn, void *ctx);
+
+  // Called every periodUs of virtual time, in order with the other
+  // timed events, e.g. to step a plant model (see Plant.h).  0 to remove.
+  typedef void (*TickHook)(uint32_t dtUs, void *ctx);
+  void setTickHook(TickHook fn, void *ctx, uint32_t periodUs);
+
+  struct Counters
+  {
+    uint32_t digitalWrites, analogWrites, digitalReads, analogReads;
+    uint32_t txBytes, txBlockedUs;
+    uint32_t sleeps;
+    uint64_t sleepUs;
+  };
+  Counters &counters();
+
+  // sleep_cpu() (see avr/sleep.h): let time pass until an interrupt
+  // wakes the CPU: Timer0 overflow (every 1024 us), an RX byte, or an
+  // ISR run by an ADC conversion or a tick hook's pin change
+  void sleepCpu();
+
+  // Call loop() repeatedly until virtual time reaches untilUs.
+  // Each pass costs loopUs of virtual time, on top of any time it blocked.
+  uint32_t runLoop(uint64_t untilUs, uint32_t loopUs);
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+Serial session captures, for replay through the host build.
+
+A capture is a text file:
+
+    # comment
+    T <us>               virtual clock at setup(), optional (e.g. just
+                         before millis() wraps).  0 if not given
+    <us> <hex bytes>     bytes arriving <us> after setup(), back to back
+                         at the sketch's baud rate
+
+Any tool that timestamps what the app sends can produce one; time
+stamps need only be as fine as the gaps between bursts.
+
+provided under LGPL license
+*/
+#ifndef SIM_CAPTURE_H
+#define SIM_CAPTURE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace sim
+{
+  struct RxChunk
+  {
+    uint64_t t;         // us after setup()
+    std::string bytes;
+  };
+
+  struct Capture
+  {
+    uint64_t start;     // virtual clock at setup()
+    std::vector<RxChunk> chunks;
+  };
+
+  inline int hexDigit(char c)
+  {
+    if (c >= '0' && c <= '9') return(c - '0');
+    if (c >= 'a' && c <= 'f') return(c - 'a' + 10);
+    if (c >= 'A' && c <= 'F') return(c - 'A' + 10);
+    return(-1);
+  }
+
+  // false, with a message in err, on a bad file
+  inline bool captureLoad(const char *path, Capture &cap, std::string &err)
+  {
+    cap.start = 0;
+    cap.chunks.clear();
+    FILE *f = fopen(path,"r");
+    if (!f)
+      {
+        err = std::string(path) + ": can not open";
+        return(false);
+      }
+    char buf[4096];
+    int line = 0;
+    while (fgets(buf,sizeof(buf),f))
+      {
+        line++;
+        char *p = buf;
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p || *p == '#' || *p == '\n' || *p == '\r') continue;
+        if (*p == 'T')
+          {
+            cap.start = strtoull(p+1,0,10);
+            continue;
+          }
+        char *end;
+        RxChunk c;
+        c.t = strtoull(p,&end,10);
+        if (end == p)
+          {
+            err = std::string(path) + ": line " + std::to_string(line) + ": no time";
+            fclose(f);
+            return(false);
+          }
+        for (p = end; *p; p++)
+          {
+            if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') continue;
+            int hi = hexDigit(p[0]), lo = (hi < 0) ? -1 : hexDigit(p[1]);
+            if (lo < 0)
+              {
+                err = std::string(path) + ": line " + std::to_string(line) + ": bad hex";
+                fclose(f);
+                return(false);
+              }
+            c.bytes.push_back((char)(hi * 16 + lo));
+            p++;
+          }
+        cap.chunks.push_back(c);
+      }
+    fclose(f);
+    return(true);
+  }
+
+  inline bool captureSave(const char *path, const Capture &cap)
+  {
+    FILE *f = fopen(path,"w");
+    if (!f) return(false);
+    if (cap.start) fprintf(f,"T %llu\n",(unsigned long long)cap.start);
+    for (size_t k=0; k < cap.chunks.size(); k++)
+      {
+        fprintf(f,"%llu ",(unsigned long long)cap.chunks[k].t);
+        for (size_t i=0; i < cap.chunks[k].bytes.size(); i++)
+          fprintf(f,"%02x",(uint8_t)cap.chunks[k].bytes[i]);
+        fputc('\n',f);
+      }
+    return(fclose(f) == 0);
+  }
+}
+
+#endif
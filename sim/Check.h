@@ -0,0 +1,88 @@
+/*
+Shared by the simulation checks:
+
+  check(ok, what)   print "ok  : what" or "FAIL: what", and count the
+                    failures in nFail.  main() returns nFail ? 1 : 0
+  PinEdges          the PWM changes of one pin, logged from the pin
+                    hook, and when each level first came
+  telemetry()       the newest telemetry record of an id in the TX
+                    stream
+
+Include this from exactly one translation unit per program, after
+Sketch.h or Arduino.h.
+
+provided under LGPL license
+*/
+#ifndef SIM_CHECK_H
+#define SIM_CHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifndef TELEMETRY_H
+#include "../Telemetry.h"
+#endif
+
+namespace
+{
+  int nFail = 0;
+
+  void check(bool ok, const char *what)
+  {
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) nFail++;
+  }
+}
+
+namespace sim
+{
+  // sim::setPinHook(PinEdges::hook,&edges)
+  struct PinEdges
+  {
+    struct Edge { uint64_t t; int pwm; };
+
+    uint8_t pin;
+    std::vector<Edge> v;
+
+    explicit PinEdges(uint8_t p) : pin(p) {}
+
+    void log(uint8_t p, int pwm)
+    {
+      if ((p == pin) && (v.empty() || (v.back().pwm != pwm)))
+        v.push_back(Edge{sim::now(),pwm});
+    }
+    static void hook(uint8_t p, int pwm, void *ctx) { ((PinEdges *)ctx)->log(p,pwm); }
+    void clear() { v.clear(); }
+
+    // time of the first change to pwm at or after t, 0 if none
+    uint64_t at(int pwm, uint64_t t) const
+    {
+      for (size_t k=0; k < v.size(); k++)
+        if ((v[k].t >= t) && (v[k].pwm == pwm)) return(v[k].t);
+      return(0);
+    }
+  };
+
+  const int ANY_MOTOR = -1;
+
+  // newest telemetry record id in the TX stream since from, for motor
+  // (or ANY_MOTOR): its value, and in *which, its motor.  false if none
+  inline bool telemetry(size_t from, byte id, int motor, int &value, int *which=0)
+  {
+    const std::string &tx = sim::tx();
+    bool found = false;
+    for (size_t k = tx.find((char)TELEMETRY_SYNC,from); k != std::string::npos &&
+           k + TELEMETRY_RECORD_LEN <= tx.size(); k = tx.find((char)TELEMETRY_SYNC,k+1))
+      if (((byte)tx[k+1] == id) && ((motor == ANY_MOTOR) || ((byte)tx[k+2] == motor)))
+        {
+          if (which) *which = (byte)tx[k+2];
+          value = (short)((byte)tx[k+5] | ((byte)tx[k+6] << 8));
+          found = true;
+        }
+    return(found);
+  }
+}
+
+#endif
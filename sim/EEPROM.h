@@ -0,0 +1,62 @@
+/*
+Host-side stand-in for the Arduino EEPROM library.  1 kB, as on the
+ATmega328P, kept across sim::reset() as the chip keeps it across power
+cycles.  sim::eepromErase() makes it a fresh chip, all 0xff.
+
+provided under LGPL license
+*/
+#ifndef SIM_EEPROM_H
+#define SIM_EEPROM_H
+
+#include "Arduino.h"
+#include <string.h>
+
+namespace sim
+{
+  const int EepromSize = 1024;
+
+  struct Eeprom
+  {
+    uint8_t d[EepromSize];
+    unsigned long writes;  // bytes written, for wear
+    Eeprom() { memset(d,0xff,sizeof(d)); writes = 0; }
+  };
+
+  inline Eeprom &eeprom()
+  {
+    static Eeprom e;
+    return(e);
+  }
+
+  inline void eepromErase() { memset(eeprom().d,0xff,EepromSize); }
+}
+
+class EEPROMClass
+{
+public:
+  uint8_t read(int idx) { return(sim::eeprom().d[idx % sim::EepromSize]); }
+  void write(int idx, uint8_t val)
+  {
+    sim::eeprom().d[idx % sim::EepromSize] = val;
+    sim::eeprom().writes++;
+  }
+  void update(int idx, uint8_t val) { if (read(idx) != val) write(idx,val); }
+  uint16_t length() { return(sim::EepromSize); }
+
+  template<typename T> T &get(int idx, T &t)
+  {
+    uint8_t *p = (uint8_t *)&t;
+    for (size_t k=0; k < sizeof(T); k++) p[k] = read(idx + k);
+    return(t);
+  }
+  template<typename T> const T &put(int idx, const T &t)
+  {  // as the library does: only the bytes that change are written
+    const uint8_t *p = (const uint8_t *)&t;
+    for (size_t k=0; k < sizeof(T); k++) update(idx + k,p[k]);
+    return(t);
+  }
+};
+
+static EEPROMClass EEPROM;
+
+#endif
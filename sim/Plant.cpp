@@ -0,0 +1,170 @@
+/*
+DC motor and tank vehicle model.  See Plant.h
+
+provided under LGPL license
+*/
+#include "Arduino.h"
+#include "Plant.h"
+
+namespace sim
+{
+  MotorParams::MotorParams()
+  {
+    R = 2.0;
+    Ke = 0.019;       // ~6000 rpm at 12V, no load
+    J = 7e-6;
+    stiction = 0.012;
+    coulomb = 0.008;
+    viscous = 2e-6;
+    gear = 30;
+    load = 0;
+    encoderCPR = 48;  // 12 line encoder on the motor shaft
+    csPerAmp = 100;
+  }
+
+  TankParams::TankParams()
+  {
+    wheelRadius = 0.04;
+    trackWidth = 0.25;
+    slip = 1.5;
+  }
+
+  void DCMotor::begin(const BridgePins &b, const MotorParams &mp)
+  {
+    pins = b;
+    p = mp;
+    w = angle = i = peakI = 0;
+    edges = 0;
+  }
+
+  void DCMotor::decode(double *duty, double *brake) const
+  {
+    *duty = *brake = 0;
+    double on, da, db;
+    int a, b;
+    switch(pins.type)
+      {
+      case BRIDGE_L298:      // PWM on EN, or on the direction input IN1/IN2
+        on = pinDuty(pins.en);
+        da = pinDuty(pins.in1);
+        db = pinDuty(pins.in2);
+        *duty = on * (db - da);         // inputs differ: driving
+        *brake = on - fabs(*duty);      // the same, while enabled: braking
+        return;
+      case BRIDGE_WTH3615D:  // EN gates, PWM input sets the speed
+        if (!pinDigital(pins.en)) return;
+        on = pinDuty(pins.pwm);
+        a = pinDigital(pins.in1);
+        b = pinDigital(pins.in2);
+        if (a == b) *brake = 1;
+        else *duty = a ? -on : on;
+        return;
+      case BRIDGE_DBH1:      // PWM on EN, and on the active direction input
+        on = pinDuty(pins.en);
+        da = pinDuty(pins.in1);
+        db = pinDuty(pins.in2);
+        if ((da == 0) == (db == 0)) *brake = on;
+        else *duty = da ? -on * da : on * db;
+        return;
+      }
+  }
+
+  void DCMotor::step(double dt, double vbat)
+  {
+    double duty, brk;
+    decode(&duty,&brk);
+    double emf = p.Ke * w;
+    if (duty > 0)      i =  duty * ( vbat - emf) / p.R;  // off part of the cycle coasts,
+    else if (duty < 0) i = -duty * (-vbat - emf) / p.R;
+    else               i = 0;
+    i -= brk * emf / p.R;                                // or brakes
+    if (fabs(i) > peakI) peakI = fabs(i);
+
+    double tm = p.Ke * i;
+    double hold = p.stiction + p.load;
+    if ((w != 0) || (fabs(tm) > hold))
+      {  // stuck, until the motor beats stiction and load
+        double dir = (w != 0) ? ((w > 0) ? 1 : -1) : ((tm > 0) ? 1 : -1);
+        double wNew = w + (tm - dir * (p.coulomb + p.load) - p.viscous * w) * dt / p.J;
+        if ((wNew * dir < 0) && (fabs(tm) <= hold)) wNew = 0;  // friction stops it, no further
+        w = wNew;
+        angle += w * dt;
+      }
+
+    if (pins.encA != 255)
+      {  // one edge per count, B leading A going forward
+        static const uint8_t seq[4] = { 0, 1, 3, 2 };
+        long c = (long)floor(angle * p.encoderCPR / (2 * M_PI));
+        while (c != edges)
+          {
+            edges += (c > edges) ? 1 : -1;
+            uint8_t s = seq[edges & 3];
+            setDigitalInput(pins.encA,s >> 1);
+            setDigitalInput(pins.encB,s & 1);
+          }
+      }
+    if (pins.cs != 255)
+      {
+        double counts = fabs(i) * p.csPerAmp;
+        setAnalogInput(pins.cs,(counts > 1023) ? 1023 : (int)counts);
+      }
+  }
+
+  double DCMotor::wheelTurns() const { return(angle / (2 * M_PI * p.gear)); }
+
+  TankPlant::TankPlant()
+  {
+    vbat = 12;
+    x = y = theta = odometer = 0;
+  }
+
+  namespace
+  {
+    void tick(uint32_t dtUs, void *ctx)
+    {
+      static_cast<TankPlant *>(ctx)->step(dtUs * 1e-6);
+    }
+  }
+
+  void TankPlant::attach(const BridgePins &l, const BridgePins &r,
+                         const MotorParams &mp, uint32_t stepUs)
+  {
+    left.begin(l,mp);
+    right.begin(r,mp);
+    x = y = theta = odometer = 0;
+    setTickHook(tick,this,stepUs);
+  }
+
+  void TankPlant::detach() { setTickHook(0,0,0); }
+
+  double TankPlant::speedL() const { return(left.w  / left.p.gear  * tank.wheelRadius); }
+  double TankPlant::speedR() const { return(right.w / right.p.gear * tank.wheelRadius); }
+  double TankPlant::speed()  const { return((speedL() + speedR()) / 2); }
+
+  void TankPlant::step(double dt)
+  {
+    left.step(dt,vbat);
+    right.step(dt,vbat);
+    double v = speed();
+    theta += (speedR() - speedL()) / (tank.trackWidth * tank.slip) * dt;
+    x += v * cos(theta) * dt;
+    y += v * sin(theta) * dt;
+    odometer += fabs(v) * dt;
+  }
+
+  BridgePins sketchPinsL(Bridge type)
+  {
+    BridgePins b = { type, 9,7,8,11, 14,17, 255 };  // WTH3615D
+    if (type == BRIDGE_L298) { b.en = 11; b.pwm = 255; }
+    if (type == BRIDGE_DBH1) { b.en = 10; b.in1 = 6; b.in2 = 11; b.pwm = 255; b.cs = 2; }
+    return(b);
+  }
+
+  BridgePins sketchPinsR(Bridge type)
+  {
+    BridgePins b = { type, 5,2,4,3, 18,19, 255 };
+    if (type == BRIDGE_L298) { b.en = 3; b.pwm = 255; }
+    if (type == BRIDGE_DBH1) { b.en = 9; b.in1 = 5; b.in2 = 3; b.pwm = 255; b.cs = 1; }
+    return(b);
+  }
+}
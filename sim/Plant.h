@@ -0,0 +1,124 @@
+/*
+DC motor and skid-steer (tank) vehicle model, driven by the firmware's
+own pin writes in the mock Arduino core.
+
+Each side's H-bridge pins are decoded, as the bridge would, into drive
+(at the PWM duty, in a direction), brake (motor shorted) or coast
+(open).  Braking, or driving slower than the back-EMF, the motor
+current is reversed and brakes it.  PWM is averaged over the cycle;
+the off part of the cycle coasts, as it does with PWM on the enable,
+or brakes, with PWM on an L298 direction input (both inputs low).
+
+The motor is a DC motor with no inductance:
+
+    current  i = duty * (Vbat - Ke w) / R      driving
+                 - brake * Ke w / R            braking, part of the cycle
+    torque     = Kt i - friction - load,  Kt = Ke
+    J dw/dt    = torque
+
+with stiction (it does not move until the drive torque beats it),
+sliding and viscous friction, and a load torque from the terrain.
+
+Track speeds come from the wheel speeds through the gearbox, and the
+vehicle pose from tank kinematics, with a slip factor on the turn rate
+(1 for no slip, more as the tracks skid sideways).
+
+Optionally each side feeds quadrature edges to encoder input pins,
+which run the firmware's pin change ISR, and |current| to a current
+sense analog input.
+
+attach() steps the model from the mock core's tick hook, so the sketch
+runs unchanged, and a plant step costs well under a microsecond.
+
+provided under LGPL license
+*/
+#ifndef SIM_PLANT_H
+#define SIM_PLANT_H
+
+#include <stdint.h>
+
+namespace sim
+{
+  enum Bridge { BRIDGE_L298, BRIDGE_WTH3615D, BRIDGE_DBH1 };  // which pins carry the PWM
+
+  struct MotorParams
+  {
+    double R;          // ohm
+    double Ke;         // V / (rad/s), also Kt in N m / A
+    double J;          // kg m^2 at the motor, including the vehicle's share
+    double stiction;   // N m, breakaway torque
+    double coulomb;    // N m, sliding friction
+    double viscous;    // N m / (rad/s)
+    double gear;       // motor turns per wheel turn
+    double load;       // N m at the motor, against motion (terrain)
+    double encoderCPR; // quadrature counts per motor turn
+    double csPerAmp;   // current sense ADC counts per A
+
+    MotorParams();     // a small 12V gearmotor on a ~2kg robot
+  };
+
+  struct BridgePins
+  {
+    Bridge type;
+    uint8_t en, in1, in2, pwm;   // pwm only for WTH3615D
+    uint8_t encA, encB;          // 255 for none
+    uint8_t cs;                  // analog input, 255 for none
+  };
+
+  class DCMotor
+  {
+  public:
+    MotorParams p;
+    BridgePins pins;
+    double w;        // motor speed, rad/s
+    double angle;    // motor shaft, rad
+    double i;        // A
+    double peakI;    // highest |i| since reset
+    long edges;      // quadrature position fed to the encoder pins
+
+    void begin(const BridgePins &b, const MotorParams &mp);
+
+    // bridge output, from the pin state: drive duty -1..1, or brake 0..1
+    void decode(double *duty, double *brake) const;
+
+    void step(double dt, double vbat);
+    double wheelTurns() const;   // since begin()
+  };
+
+  struct TankParams
+  {
+    double wheelRadius;  // m, drive sprocket / wheel
+    double trackWidth;   // m, between track centres
+    double slip;         // turn rate divisor, >= 1
+
+    TankParams();
+  };
+
+  class TankPlant
+  {
+  public:
+    DCMotor left, right;
+    TankParams tank;
+    double vbat;         // V
+    double x, y, theta;  // m, m, rad.  starts at 0, facing +x
+    double odometer;     // m, path length of the centre
+
+    TankPlant();
+
+    // set up both sides, and step every stepUs of virtual time
+    void attach(const BridgePins &l, const BridgePins &r,
+                const MotorParams &mp, uint32_t stepUs=100);
+    void detach();
+
+    void step(double dt);
+    double speedL() const;   // m/s, track
+    double speedR() const;
+    double speed() const;    // m/s, centre
+  };
+
+  // pins as set up by TankDrive.ino's setup()
+  BridgePins sketchPinsL(Bridge type);
+  BridgePins sketchPinsR(Bridge type);
+}
+
+#endif
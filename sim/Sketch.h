@@ -0,0 +1,13 @@
+/*
+Pull the TankDrive sketch into a host program, the way the Arduino
+builder would: Arduino.h first, then the .ino as plain C++.
+
+Include this from exactly one translation unit per program.
+*/
+#ifndef SIM_SKETCH_H
+#define SIM_SKETCH_H
+
+#include "Arduino.h"
+#include "../TankDrive.ino"
+
+#endif
@@ -0,0 +1,102 @@
+/*
+Host-side decoder for the firmware's binary telemetry records
+(see ../Telemetry.h), and pose frames (../Odometry.h).  Bytes outside
+a record are passed through, so ordinary text output stays readable.
+
+provided under LGPL license
+*/
+#ifndef SIM_TELEMETRY_DECODE_H
+#define SIM_TELEMETRY_DECODE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+
+#ifndef TELEMETRY_H
+#include "../Telemetry.h"
+#endif
+
+inline const char *telemetryName(int id)
+{
+  switch(id)
+    {
+    case TEL_STOP:        return("stop");
+    case TEL_EMERGENCY:   return("emergency");
+    case TEL_STOPPED:     return("stopped");
+    case TEL_START:       return("start");
+    case TEL_STARTED:     return("started");
+    case TEL_RESTART:     return("restart");
+    case TEL_MOVING:      return("moving");
+    case TEL_CLOCK_WRAP:  return("clock-wrap");
+    case TEL_CMD_RESET:   return("command-reset");
+    case TEL_CMD_BAD_NEG: return("unexpected-minus");
+    case TEL_COMMAND:     return("command");
+    case TEL_DROPPED:     return("dropped");
+    case TEL_TASK_JITTER: return("task-jitter-us");
+    case TEL_TASK_OVERRUN:return("task-overruns");
+    case TEL_PROF_COUNT:  return("profile-count");
+    case TEL_PROF_MAX:    return("profile-max-us");
+    case TEL_PROF_BIN:    return("profile-bin");
+    case TEL_OVERCURRENT: return("overcurrent");
+    case TEL_CURRENT:     return("current");
+    case TEL_CURRENT_PEAK:return("current-peak");
+    case TEL_SLEEP:       return("asleep-permille");
+    case TEL_QUEUE:       return("queue");
+    case TEL_QUEUE_FULL:  return("queue-full");
+    case TEL_QUEUE_DRY:   return("queue-dry");
+    case TEL_CAL_BREAKAWAY:return("cal-breakaway-pwm");
+    case TEL_CAL_MIN_PWM: return("cal-min-pwm");
+    case TEL_CAL_START:   return("cal-start-ms");
+    case TEL_CAL_STOP:    return("cal-stop-ms");
+    case TEL_CAL_FAILED:  return("cal-failed");
+    case TEL_CAL_LOADED:  return("cal-loaded");
+    }
+  return("?");
+}
+
+// one line per record: "<ms> <motor> <event> <value>"
+inline std::string telemetryDecode(const std::string &in)
+{
+  std::string out;
+  size_t i = 0;
+  while (i < in.size())
+    {
+      if (((uint8_t)in[i] == TELEMETRY_POSE_SYNC) && (i + TELEMETRY_POSE_LEN <= in.size()))
+        {  // x, y mm, heading in degrees
+          const uint8_t *r = (const uint8_t *)in.data() + i;
+          unsigned t = r[1] | (r[2] << 8);
+          long x = (int32_t)((r[3] << 8) | (r[4] << 16) | ((uint32_t)r[5] << 24)) >> 8;
+          long y = (int32_t)((r[6] << 8) | (r[7] << 16) | ((uint32_t)r[8] << 24)) >> 8;
+          unsigned h = r[9] | (r[10] << 8);
+          char line[80];
+          snprintf(line,sizeof(line),"%5u pose %ld %ld %.1f\n",t,x,y,h * (360.0 / 65536));
+          out += line;
+          i += TELEMETRY_POSE_LEN;
+          continue;
+        }
+      if (((uint8_t)in[i] != TELEMETRY_SYNC) || (i + TELEMETRY_RECORD_LEN > in.size()))
+        {
+          out.push_back(in[i++]);
+          continue;
+        }
+      const uint8_t *r = (const uint8_t *)in.data() + i;
+      unsigned t = r[3] | (r[4] << 8);
+      int v = (int16_t)(r[5] | (r[6] << 8));
+      char motor[8];
+      if ((r[1] >= TEL_PROF_COUNT) && (r[1] <= TEL_PROF_BIN))
+        {  // histogram number, and bin; counts are unsigned
+          v = (uint16_t)v;
+          if (r[1] == TEL_PROF_BIN) snprintf(motor,sizeof(motor),"%u.%u",r[2] >> 5,r[2] & 31);
+          else snprintf(motor,sizeof(motor),"%u",r[2]);
+        }
+      else if (r[2] >= ' ' && r[2] < 127) snprintf(motor,sizeof(motor),"%c",r[2]);
+      else snprintf(motor,sizeof(motor),"%u",r[2]);
+      char line[80];
+      snprintf(line,sizeof(line),"%5u %s %s %d\n",t,motor,telemetryName(r[1]),v);
+      out += line;
+      i += TELEMETRY_RECORD_LEN;
+    }
+  return(out);
+}
+
+#endif
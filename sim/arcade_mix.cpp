@@ -0,0 +1,115 @@
+/*
+Check arcade drive (ARCADE_DRIVE, commandMix() in ../Command.h).
+
+  - every throttle and steer in -255..255: left = throttle + steer and
+    right = throttle - steer when neither saturates; otherwise both
+    are scaled by the same factor, to within a count, with the faster
+    side at full speed and no sign flipped
+  - out of range inputs clip
+  - through the sketch: "T<throttle>,S<steer>" and an arcade frame set
+    both motors in the same loop() pass, a lone 'S' keeps the last
+    throttle, and '!' zeroes both
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#define ARCADE_DRIVE
+#include "Sketch.h"
+#include "Check.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace
+{
+  const uint32_t LoopUs = 20;
+  const uint8_t PwmL = 11, PwmR = 3;   // WTH3615D PWM inputs
+
+  uint64_t changedL, changedR;  // sim time of the last PWM change
+  void watch(uint8_t pin, int, void *)
+  {
+    if (pin == PwmL) changedL = sim::now();
+    if (pin == PwmR) changedR = sim::now();
+  }
+
+  bool mixOk(int t, int s)
+  {
+    int l, r;
+    commandMix(t,s,l,r);
+    int wl = t + s, wr = t - s;
+    int m = abs(wl) > abs(wr) ? abs(wl) : abs(wr);
+    if (m <= 255) return((l == wl) && (r == wr));
+    if ((abs(l) > 255) || (abs(r) > 255)) return(false);
+    if ((abs(l) != 255) && (abs(r) != 255)) return(false);
+    if (((long)l * wl < 0) || ((long)r * wr < 0)) return(false);
+    double el = (double)wl * 255 / m - l, er = (double)wr * 255 / m - r;
+    return((el <= 1) && (el >= -1) && (er <= 1) && (er >= -1));
+  }
+
+  // speed the WTH3615D pins show: PWM, signed by direction
+  int speedOf(uint8_t pwm, uint8_t in1)
+  {
+    return(sim::pinDigital(in1) ? -sim::pinPWM(pwm) : sim::pinPWM(pwm));
+  }
+
+  // send s every 20 ms for ms, then show both sides
+  void drive(const uint8_t *s, size_t n, uint32_t ms, int &l, int &r)
+  {
+    for (uint32_t k=0; k < ms; k += 20)
+      {
+        sim::rx(s,n);
+        sim::runLoop(sim::now() + 20000,LoopUs);
+      }
+    l = speedOf(PwmL,7);
+    r = speedOf(PwmR,2);
+  }
+  void drive(const char *s, uint32_t ms, int &l, int &r)
+  {
+    drive((const uint8_t *)s,strlen(s),ms,l,r);
+  }
+}
+
+int main()
+{
+  char what[120];
+  long nBad = 0, nSat = 0;
+  for (int t=-255; t <= 255; t++)
+    for (int s=-255; s <= 255; s++)
+      {
+        if (!mixOk(t,s)) nBad++;
+        if ((abs(t + s) > 255) || (abs(t - s) > 255)) nSat++;
+      }
+  snprintf(what,sizeof(what),"mix of all %d throttle/steer pairs (%ld saturate): %ld wrong",
+           511 * 511, nSat, nBad);
+  check(nBad == 0, what);
+  int l, r;
+  commandMix(1000,-2000,l,r);
+  check((l == 0) && (r == 255), "out of range inputs clip");
+
+  sim::reset();
+  sim::setPinHook(watch,0);
+  setup();
+  sim::runLoop(4000000,LoopUs);  // power-on emergency stop
+
+  drive("T150,S50\n",1000,l,r);
+  snprintf(what,sizeof(what),"T150,S50: left %d, right %d",l,r);
+  check((l == 200) && (r == 100), what);
+  check(changedL == changedR, "  both sides changed in the same pass");
+
+  uint8_t f[COMMAND_FRAME_LEN];
+  commandEncodeDrive(f,-200,100,COMMAND_OP_ARCADE);
+  drive(f,sizeof(f),1500,l,r);
+  snprintf(what,sizeof(what),"arcade frame T-200,S100: left %d, right %d",l,r);
+  check((l == -85) && (r == -255), what);
+
+  drive("S-60\n",1500,l,r);
+  snprintf(what,sizeof(what),"lone S-60 keeps throttle -200: left %d, right %d",l,r);
+  check((l == -255) && (r == -137), what);
+
+  sim::rx("!\n");
+  sim::runLoop(sim::now() + 5000000,LoopUs);
+  drive("S80\n",1000,l,r);
+  snprintf(what,sizeof(what),"after '!', S80 spins in place: left %d, right %d",l,r);
+  check((l == 80) && (r == -80), what);
+  return(nFail ? 1 : 0);
+}
@@ -0,0 +1,20 @@
+/*
+Host-side stand-in for <avr/sleep.h>.  sleep_cpu() lets virtual time
+pass until an interrupt would wake the CPU (see sim::sleepCpu()).
+Only idle mode is modelled: the timers, UART and ADC keep running.
+
+provided under LGPL license
+*/
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include "Arduino.h"
+
+#define SLEEP_MODE_IDLE 0
+
+inline void set_sleep_mode(uint8_t) {}
+inline void sleep_enable() {}
+inline void sleep_disable() {}
+inline void sleep_cpu() { sim::sleepCpu(); }
+
+#endif
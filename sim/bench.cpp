@@ -0,0 +1,106 @@
+/*
+Host benchmark for the TankDrive sketch.
+
+Reports loop() iterations per (wall clock) second while a phone-app style
+command stream is arriving, and the cost of individual
+MotorDrive::setSpeed() and update() calls.  Pin writes per call are
+reported too, since on the AVR those dominate the cost of a call.
+Scheduler jitter and overruns per task are reported for the loop run.
+
+provided under LGPL license
+*/
+#include "Sketch.h"
+#include <stdio.h>
+#include <chrono>
+
+namespace
+{
+  typedef std::chrono::steady_clock Clock;
+
+  double secondsSince(Clock::time_point t0)
+  {
+    return(std::chrono::duration<double>(Clock::now() - t0).count());
+  }
+
+  uint32_t pinWrites()
+  {
+    sim::Counters &c = sim::counters();
+    return(c.digitalWrites + c.analogWrites);
+  }
+
+  void benchLoop()
+  {
+    sim::reset();
+    setup();
+
+    const uint32_t loopUs = 20;      // virtual cost of one pass
+    const uint32_t cmdEveryUs = 20000; // app sends an update every 20ms
+    const uint64_t simUs = 60ULL*1000000ULL;
+    char cmd[32];
+    uint32_t n = 0, nCmd = 0;
+    uint32_t w0 = pinWrites();
+
+    Clock::time_point t0 = Clock::now();
+    for (uint64_t t = cmdEveryUs; t <= simUs; t += cmdEveryUs)
+      {
+        int spd = (int)((nCmd * 7) % 511) - 255;
+        snprintf(cmd,sizeof(cmd),"L%d,R%d\n",spd,-spd);
+        sim::rx(cmd);
+        nCmd++;
+        n += sim::runLoop(t,loopUs);
+      }
+    double dt = secondsSince(t0);
+
+    printf("loop()            : %10.0f iterations/s  (%u passes, %u commands, %.1f pin writes/command)\n",
+           n / dt, n, nCmd, (double)(pinWrites() - w0) / nCmd);
+    printf("serial TX         : %10u bytes, blocked %u us, %u telemetry records dropped\n",
+           sim::counters().txBytes, sim::counters().txBlockedUs, Tel.dropped);
+    for (int i=0; i < Sched.nTask; i++)
+      printf("task %d (%6lu us) : worst late %6lu us, %u overruns\n",
+             i, (unsigned long)Sched.task[i].period, (unsigned long)Sched.task[i].maxLate, Sched.task[i].overruns);
+  }
+
+  template<class F>
+  void benchCall(const char *name, F f, uint32_t n)
+  {
+    uint32_t w0 = pinWrites();
+    Clock::time_point t0 = Clock::now();
+    for (uint32_t i=0; i < n; i++) f(i);
+    double dt = secondsSince(t0);
+    printf("%-18s: %10.1f ns/call  %5.2f pin writes/call\n",
+           name, dt * 1e9 / n, (double)(pinWrites() - w0) / n);
+  }
+
+  void benchMotor()
+  {
+    const uint32_t n = 2000000;
+    sim::reset();
+    setup();
+
+    // get MotL running forward, so setSpeed exercises the steady-state path
+    unsigned long t = 10000;
+    sim::setTime(t*1000);
+    MotL.setSpeed(100,t);
+    t += 1000;
+    MotL.update(t);
+
+    benchCall("setSpeed (run)",
+              [&](uint32_t i) { MotL.setSpeed(100 + (int)(i & 63),t); },
+              n);
+    benchCall("update (run)",
+              [&](uint32_t) { MotL.update(t); },
+              n);
+
+    // alternate direction: every call is a stop or restart transition
+    benchCall("setSpeed (reverse)",
+              [&](uint32_t i) { t += 1000; MotL.setSpeed((i & 1) ? -150 : 150,t); MotL.update(t); },
+              n / 10);
+  }
+}
+
+int main()
+{
+  benchLoop();
+  benchMotor();
+  return(0);
+}
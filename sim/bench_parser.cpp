@@ -0,0 +1,145 @@
+/*
+Host throughput of the command parser (../Command.h), bytes per second,
+for each kind of input it sees: app traffic, binary frames, long digit
+runs, sync bytes and random noise.  Bytes go in through the RX ring
+(COMMAND_RX_ISR), one put() and get() per byte, as on the robot.
+
+Also checks that the cost per byte is bounded, so no input pattern
+makes the parser fall behind the line.  get() has no loop but the
+frame CRC, a fixed 24 steps on a frame's last byte, so its calls per
+byte bound the cost: no byte of any input may take more than
+MaxCalls.  That is counted, not timed, so it holds on a loaded host.
+The timings, and the slowest input over the fastest, are printed only.
+Exits non-zero if the bound fails.
+
+These are host figures only.  The parser's AVR cycles per byte have
+not been measured: avrbench/ would, but has never been run (see
+avrbench/README.md).
+
+provided under LGPL license
+*/
+#define COMMAND_RX_ISR
+#include "Arduino.h"
+#include "../Command.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <chrono>
+
+// no sketch here, just the parser
+void setup() {}
+void loop() {}
+
+namespace
+{
+  const size_t Bytes = 1 << 22;   // per run
+  const int MaxCalls = 2;  // get() calls for one byte: a frame's two commands
+
+  CommandReader Reader;
+  volatile long Sink;  // keeps the results live
+
+  double nsPerByte(const std::string &s)
+  {
+    double best = 1e9;
+    for (int run=0; run < 5; run++)
+      {
+        CommandRx = CommandRing();
+        Reader = CommandReader();
+        Reader.begin();
+        long sum = 0;
+        char c;
+        int v;
+        const uint8_t *p = (const uint8_t *)s.data();
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (size_t k=0; k < s.size(); k++)
+          {
+            CommandRx.put(p[k]);
+            while (Reader.pendCode || CommandRx.available())
+              if (Reader.get(c,v)) sum += c + v;
+          }
+        double ns = std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now() - t0).count();
+        Sink = sum;
+        if (ns / s.size() < best) best = ns / s.size();
+      }
+    return(best);
+  }
+
+  // the most get() calls any one byte of s takes
+  int mostCalls(const std::string &s)
+  {
+    CommandRx = CommandRing();
+    Reader = CommandReader();
+    Reader.begin();
+    int most = 0;
+    char c;
+    int v;
+    for (size_t k=0; k < s.size(); k++)
+      {
+        CommandRx.put((uint8_t)s[k]);
+        int n = 0;
+        while (Reader.pendCode || CommandRx.available())
+          {
+            Reader.get(c,v);
+            n++;
+          }
+        if (n > most) most = n;
+      }
+    return(most);
+  }
+
+  std::string fill(const char *kind)
+  {
+    std::string s;
+    srand(1);
+    char buf[32];
+    while (s.size() < Bytes)
+      switch(kind[0])
+        {
+        case 'a':  // app: "L-123,R45\n"
+          snprintf(buf,sizeof(buf),"L%d,R%d\n",rand() % 511 - 255,rand() % 511 - 255);
+          s += buf;
+          break;
+        case 'b':  // binary drive frames
+          {
+            byte f[COMMAND_FRAME_LEN];
+            commandEncodeDrive(f,rand() % 511 - 255,rand() % 511 - 255);
+            s.append((const char *)f,sizeof(f));
+          }
+          break;
+        case 'd':  // one long value
+          s += (s.empty() ? 'S' : (char)('0' + rand() % 10));
+          break;
+        case 's':  // nothing but sync bytes
+          s += (char)COMMAND_SYNC;
+          break;
+        default:   // noise
+          s += (char)(rand() & 0xff);
+        }
+    return(s);
+  }
+}
+
+int main()
+{
+  static const char *Kinds[] = { "app ASCII", "binary frames", "digit run", "sync flood", "random" };
+  const int nKind = sizeof(Kinds) / sizeof(Kinds[0]);
+  double ns[nKind], lo = 1e9, hi = 0;
+  int most = 0;
+
+  printf("input           ns/byte   Mbyte/s  get()/byte\n");
+  for (int k=0; k < nKind; k++)
+    {
+      std::string s = fill(Kinds[k]);
+      int calls = mostCalls(s);
+      ns[k] = nsPerByte(s);
+      if (ns[k] < lo) lo = ns[k];
+      if (ns[k] > hi) hi = ns[k];
+      if (calls > most) most = calls;
+      printf("%-14s %8.2f %9.1f %11d\n", Kinds[k], ns[k], 1e3 / ns[k], calls);
+    }
+  printf("slowest input %.1fx the fastest, on this host\n", hi / lo);
+  bool ok = most <= MaxCalls;
+  printf("%s: at most %d get() calls for any byte (limit %d)\n",
+         ok ? "ok  " : "FAIL", most, MaxCalls);
+  return(ok ? 0 : 1);
+}
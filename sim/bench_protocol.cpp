@@ -0,0 +1,143 @@
+/*
+Compare the ASCII and binary command encodings.
+
+For a stream of left/right updates, reports bytes per update, the
+latency from the first byte of an update going out on the wire until
+both motors have been given their new speed, at the sketch's baud rate,
+and the skew between the left and right side changing speed.
+A flood of back-to-back updates shows how long the backlog takes to
+clear once the last byte is in.
+
+provided under LGPL license
+*/
+#include "Sketch.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace
+{
+  const uint32_t LoopUs = 20;   // virtual cost of one loop() pass
+
+  // run loop() until both motors have been commanded l,r.  return us waited
+  uint32_t waitApplied(int l, int r, uint64_t t0, uint32_t *skew=0)
+  {
+    uint64_t limit = t0 + 100000;
+    uint64_t tL = 0, tR = 0;
+    while (sim::now() < limit)
+      {
+        loop();
+        if (!tL && (MotL._speedCmd == l)) tL = sim::now();
+        if (!tR && (MotR._speedCmd == r)) tR = sim::now();
+        if (tL && tR)
+          {
+            if (skew) *skew = (uint32_t)((tL > tR) ? tL - tR : tR - tL);
+            return((uint32_t)(sim::now() - t0));
+          }
+        sim::advance(LoopUs);
+      }
+    return(0xffffffff);
+  }
+
+  void run(const char *name, bool binary)
+  {
+    sim::reset();
+    setup();
+    sim::advance(50000);
+    sim::runLoop(sim::now() + 10000,LoopUs);
+
+    const int nCmd = 2000;
+    unsigned long bytes = 0;
+    uint64_t sumL = 0;
+    uint32_t maxL = 0, lost = 0, maxSkew = 0;
+    srand(1);
+    for (int k=0; k < nCmd; k++)
+      {
+        // keep both sides moving forward, so every update is a plain speed change
+        int l, r;
+        do { l = 60 + rand() % 196; } while (l == MotL._speedCmd);
+        do { r = 60 + rand() % 196; } while (r == MotR._speedCmd);
+        byte buf[32];
+        size_t n;
+        if (binary)
+          n = commandEncodeDrive(buf,l,r);
+        else
+          n = snprintf((char *)buf,sizeof(buf),"L%d,R%d\n",l,r);
+        bytes += n;
+
+        uint64_t t0 = sim::now();
+        sim::rx(buf,n);
+        uint32_t skew = 0;
+        uint32_t dt = waitApplied(l,r,t0,&skew);
+        if (dt == 0xffffffff) { lost++; continue; }
+        if (skew > maxSkew) maxSkew = skew;
+        sumL += dt;
+        if (dt > maxL) maxL = dt;
+        sim::runLoop(sim::now() + 5000,LoopUs);  // idle gap between updates
+      }
+    int ok = nCmd - lost;
+    printf("%-8s: %5.2f bytes/update  latency mean %6.0f us  max %6u us  L/R skew max %5u us  (%d updates, %u not applied)\n",
+           name, (double)bytes / nCmd, ok ? (double)sumL / ok : 0.0, maxL, maxSkew, nCmd, lost);
+  }
+
+  // queue a burst of updates back to back, and time how long after the
+  // last byte arrives the newest pair is in effect
+  void flood(const char *name, bool binary)
+  {
+    sim::reset();
+    setup();
+    sim::advance(50000);
+    sim::runLoop(sim::now() + 10000,LoopUs);
+
+    const int nBurst = 8;
+    byte buf[32*nBurst];
+    size_t n = 0;
+    int l = 0, r = 0;
+    for (int k=0; k < nBurst; k++)
+      {
+        l = 100 + 10*k;
+        r = 200 - 10*k;
+        if (binary)
+          n += commandEncodeDrive(buf+n,l,r);
+        else
+          n += snprintf((char *)buf+n,32,"L%d,R%d\n",l,r);
+      }
+    uint64_t tLast = sim::now() + n * (uint64_t)sim::byteTime();
+    sim::rx(buf,n);
+    uint32_t dt = waitApplied(l,r,sim::now());
+    long after = (long)(sim::now() - tLast);
+    printf("%-8s: burst of %d updates (%u bytes) applied %ld us after last byte, %u us after first\n",
+           name, nBurst, (unsigned)n, after, dt);
+  }
+
+  // flip one bit in each frame, and check none of them gets through
+  void corrupt()
+  {
+    const int nCmd = 1000;
+    unsigned int bad0 = Command.nBadFrame;
+    int applied = 0;
+    srand(2);
+    for (int k=0; k < nCmd; k++)
+      {
+        byte buf[COMMAND_FRAME_LEN];
+        int l;
+        do { l = 60 + rand() % 196; } while (l == MotL._speedCmd);
+        commandEncodeDrive(buf,l,l);
+        buf[1 + rand() % 4] ^= (byte)(1 << (rand() % 8));
+        sim::rx(buf,sizeof(buf));
+        sim::runLoop(sim::now() + 2000,LoopUs);
+        if (MotL._speedCmd == l) applied++;
+      }
+    printf("corrupt : %u of %d frames rejected, %d applied\n",
+           Command.nBadFrame - bad0, nCmd, applied);
+  }
+}
+
+int main()
+{
+  run("ascii",false);
+  run("binary",true);
+  flood("ascii",false);
+  flood("binary",true);
+  corrupt();
+  return(0);
+}
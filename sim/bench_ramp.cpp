@@ -0,0 +1,355 @@
+/*
+Compare fixed-point ramping against the stop-then-restart behaviour.
+
+For a full reversal and a speed step, reports the time until the motor
+output reaches the new speed and how many brake (stop) cycles it took,
+and the host time per update() call while running, for:
+
+  - the original float driver (FloatDrive, below): MotorDrive from
+    MotorDrive298.h before the ramp, copied here as the baseline.  It
+    brakes for |_speed * _decel| ms, in float, on every stop or reversal
+  - the integer core (MotorDriveCore.h) with no ramp, which keeps that
+    brake window in fixed point
+  - the integer core with a few accel/decel rates
+
+Times per call are host ns, not AVR cycles: the float math is
+emulated in software on the AVR, and costs far more there than on the
+host.  avrbench/ would count the cycles, but has not been run (see
+avrbench/README.md).
+
+provided under LGPL license
+*/
+#include "Sketch.h"
+#include <stdio.h>
+#include <chrono>
+
+namespace
+{
+  typedef std::chrono::steady_clock Clock;
+
+  // The baseline MotorDrive (L298 logic, WTH3615D PWM pin), as it was
+  // before the integer core: float brake time, no ramp.  Only the
+  // DBH1 pin changes are left out
+  class FloatDrive
+  {
+  protected:
+    inline int clipPWM(int pwm)
+    {
+      if (ABS(pwm) > 255)
+        pwm = (pwm < 0) ? -255 : 255;
+      return(pwm);
+    }
+    inline int getPWM(int pwm)
+    {
+      return(ABS(clipPWM(pwm)));
+    }
+
+    void setReverse(bool rev) // true==set reverse direction, false==forward
+    {
+      if (rev)
+        {
+          digitalWrite(Pin.IN2,0);
+          digitalWrite(Pin.IN1,1);
+        }
+      else
+        {
+          digitalWrite(Pin.IN1,0);
+          digitalWrite(Pin.IN2,1);
+        }
+    }
+
+  public:
+    struct {
+      BYTE IN1, IN2;  // forward/reverse selectors.
+      BYTE EN;        // enable pin
+#ifdef WTH3615D
+      BYTE PWM;
+#endif
+    } Pin;
+    SHORT _speed;     // current speed
+    SHORT _speedCmd;  // commanded speed
+
+    float _decel; // time to allow to stop, in ms / PWM count
+    BYTE _mode;
+    unsigned long _doneTime;  // time when mode automatically transitions
+    SHORT _deadTime;    // ms until deadman transition to emergency stop
+    SHORT _maxPWM;      // clip PWM commands to this magnitude
+    SHORT _startupTime; // ms of full-power pulse to start from dead stop
+    SHORT _stopTime;    // ms to lock-out commands after emergency stop
+
+    BYTE _msgCount;   // turn off diagnostics after this many messages
+
+    FloatDrive(const float decel=2.0,
+               const int deadTime=500,
+               const int startupTime=50,
+               const int stopTime=3000,
+               const int maxPWM=255)
+    {
+      _deadTime = deadTime;
+      _maxPWM = maxPWM;
+      _startupTime = startupTime;
+      _stopTime = stopTime;
+      _decel = decel;
+      _speed = _speedCmd = 0;
+      _msgCount = 11;
+    }
+
+    void begin(const int en, const int in1, const int in2
+#ifdef WTH3615D
+               , const int ppwm
+#endif
+               )
+    {
+      pinMode(en,OUTPUT);
+      digitalWrite(en,0);   // make sure we are disabled ASAP
+      Pin.EN  =en;
+      Pin.IN1 =in1;
+      Pin.IN2 =in2;
+#ifdef WTH3615D
+      Pin.PWM=ppwm;
+      pinMode(Pin.PWM,OUTPUT);
+      analogWrite(Pin.PWM,0);
+#endif
+      pinMode(Pin.IN1,OUTPUT);
+      pinMode(Pin.IN2,OUTPUT);
+
+      emergencyStop();
+    }
+
+    // no ramp to set: the baseline has none
+    void setRampRates(const float, const float) {}
+
+    virtual void stop()
+    {
+      _speedCmd=0;
+      digitalWrite(Pin.EN , 0);
+      digitalWrite(Pin.IN1, 0);
+      digitalWrite(Pin.IN2, 0);
+#ifdef WTH3615D
+      analogWrite(Pin.PWM, 0);
+#endif
+      digitalWrite(Pin.EN , 1);
+      int stoppingTime = (int)ABS(_speed * _decel);
+if(_msgCount>0){_msgCount--;Serial.print(stoppingTime);Serial.println(" ms to stop.");}
+      _doneTime = millis() + stoppingTime;
+      _mode = MOTOR_STOPPING;
+    }
+
+    virtual void emergencyStop()
+    {
+      Serial.print("Emergency ");
+      _msgCount = 11;  // turn on diagnostics for a few commands
+      stop();
+      _speedCmd=0;
+      _doneTime += _stopTime;
+    }
+
+    virtual void setSpeed(const int spdReq, unsigned long t)
+    {
+      BYTE prevMode = _mode;
+      bool rev;
+      switch(prevMode)
+        {
+        case MOTOR_STOPPING :
+          _speedCmd = spdReq;
+          if ((unsigned long)t < _doneTime)
+            {  // make sure things are stopped
+              digitalWrite(Pin.IN1,0);
+              digitalWrite(Pin.IN2,0);
+              digitalWrite(Pin.EN ,1);  // brake
+              return;
+            }
+          // done stoping, continue to STOP mode
+          _speed = 0;
+          _mode = MOTOR_STOPPED;
+if(_msgCount>0){_msgCount--;Serial.println(F("stopped."));}
+          // fall through
+        case MOTOR_STOPPED :
+          if (spdReq == 0) return;  // leave in full brake stop
+          _mode = (spdReq < 0) ? MOTOR_START_REV : MOTOR_START_FWD;
+          rev = (_mode == MOTOR_START_REV);
+          digitalWrite(rev?Pin.IN1:Pin.IN2,1); // don't worry about PWM
+          digitalWrite(rev?Pin.IN2:Pin.IN1,0); // this is transistional state
+#ifdef WTH3615D
+          analogWrite(Pin.PWM,255);
+#endif
+          digitalWrite(Pin.EN,1);   // hard kick to get started
+          _doneTime = t + _startupTime;
+          _speedCmd = spdReq;
+if(_msgCount>0){_msgCount--;
+Serial.print(F("Start "));
+Serial.println(rev ? F("REV") : F("FWD"));}
+          return;
+        case MOTOR_FWD :
+        case MOTOR_REV :
+          if (t > _doneTime) { emergencyStop(); return; } // deadman expired
+          if ( (spdReq == 0)  ||  // stop or change direction
+               ((spdReq < 0) && (prevMode == MOTOR_FWD)) ||
+               ((spdReq > 0) && (prevMode == MOTOR_REV)) )
+            {
+              stop();
+              _speedCmd = clipPWM(spdReq);
+              return;
+            }
+          setReverse(spdReq < 0);
+          _speed = _speedCmd = spdReq;
+#ifdef WTH3615D
+          digitalWrite(Pin.EN,1);
+          analogWrite(Pin.PWM,getPWM(_speed));
+#else
+          analogWrite(Pin.EN,getPWM(_speed));
+#endif
+          _doneTime = t + _deadTime;
+          return;
+        case MOTOR_START_REV :
+        case MOTOR_START_FWD :
+          if (spdReq == 0)
+            {
+              _speed = 100;  // give it some time to decel, although just starting
+              stop();
+              return;
+            }
+          if ( ((spdReq < 0) && (_mode == MOTOR_START_FWD)) ||
+               ((spdReq > 0) && (_mode == MOTOR_START_REV)) )
+            { // direction change
+              _speed = 100;  // give it some time to decel, although just starting
+              stop();
+              _speedCmd = spdReq;  // go to this speed after coast-down period
+              return;
+            }
+          // same direction, but speed request change
+          _speed = _speedCmd = spdReq;
+          if (t >= _doneTime)
+            {
+              _mode = (_speedCmd > 0) ? MOTOR_FWD : MOTOR_REV;
+              _doneTime = t + _deadTime;
+              setReverse(_mode == MOTOR_REV);  // make sure direction is correct
+#ifdef WTH3615D
+              digitalWrite(Pin.EN,1);
+              analogWrite(Pin.PWM,getPWM(_speedCmd));
+#else
+              analogWrite(Pin.EN,getPWM(_speedCmd));
+#endif
+              if(_msgCount>0){_msgCount--;Serial.print(F("Started"));Serial.println(_speedCmd);}
+            }
+          return;
+        }
+    }
+
+    virtual void update(unsigned long t)  // current time, from millis()
+    {
+      if ((_doneTime > 0xfffff000) && (t < 999))
+        {  // time counter must have wrapped around
+          _doneTime = 0;
+          Serial.println(F("Clock wrap-around"));
+        }
+
+      byte prevMode = _mode;
+      switch(prevMode)
+        {
+        case MOTOR_STOPPING :
+        case MOTOR_STOPPED :
+          if ((t > _doneTime) && _speedCmd)
+            { // this was a temp stop in a direction change.  Command desired speed.
+if(_msgCount>0){_msgCount--;Serial.print(F("Restart "));Serial.println(_speedCmd);}
+              setSpeed(_speedCmd,t);
+            }
+          return;
+        case MOTOR_FWD :
+        case MOTOR_REV :
+          if (t > _doneTime) emergencyStop(); // deadman expired
+          return;
+        case MOTOR_START_REV :
+        case MOTOR_START_FWD :
+          if (t > _doneTime)
+            {
+if(_msgCount>0){_msgCount--;Serial.println(F("moving"));}
+              setSpeed(_speedCmd,t);
+            }
+          return;
+        }
+    }
+  };
+
+  // as MotL, on pins of its own
+  FloatDrive Baseline(0.5f);
+
+  // run m at 1 kHz updates, app commands every 20 ms, until its output
+  // reaches spd.  return ms taken, or -1
+  template<class M> long timeTo(M &m, int spd, int *nStops)
+  {
+    unsigned long t0 = millis();
+    *nStops = 0;
+    BYTE prevMode = m._mode;
+    for (unsigned long dt=0; dt < 3000; dt++)
+      {
+        unsigned long t = t0 + dt;
+        sim::setTime((uint64_t)t*1000);
+        if (dt % 20 == 0) m.setSpeed(spd,t);
+        m.update(t);
+        if ((m._mode == MOTOR_STOPPING) && (prevMode != MOTOR_STOPPING)) (*nStops)++;
+        prevMode = m._mode;
+        if ((m._speed == spd) && ((m._mode == MOTOR_FWD) || (m._mode == MOTOR_REV)))
+          return(dt);
+      }
+    return(-1);
+  }
+
+  void begin(decltype(MotL) &) {}  // setup() did
+  void begin(FloatDrive &m)
+  {
+#ifdef WTH3615D
+    m.begin(12,14,15,16);
+#else
+    m.begin(12,14,15);
+#endif
+  }
+
+  template<class M> void start(M &m, float accel, float decel)
+  {
+    sim::reset();
+    setup();
+    begin(m);
+    m.setRampRates(accel,decel);
+    sim::setTime(4000000);  // past the power-on emergency stop
+    int n;
+    timeTo(m,100,&n);
+  }
+
+  template<class M> void run(M &m, const char *name, float accel, float decel)
+  {
+    int nRev, nStep;
+    start(m,accel,decel);
+    timeTo(m,200,&nStep);
+    long rev = timeTo(m,-200,&nRev);
+    long step = timeTo(m,-50,&nStep);
+    step = timeTo(m,-250,&nStep);
+
+    // host cost of update() while ramping toward a far target
+    start(m,accel,decel);
+    unsigned long t = millis();
+    m.setSpeed(255,t);
+    const int n = 1000000;
+    Clock::time_point c0 = Clock::now();
+    for (int k=0; k < n; k++)
+      {
+        if ((k & 1023) == 0) m.setSpeed((k & 1024) ? 250 : 30,t);  // keep it ramping
+        m.update(t);
+        t += (k & 1);
+      }
+    double ns = std::chrono::duration<double>(Clock::now() - c0).count() * 1e9 / n;
+
+    printf("%-24s: reverse 200->-200 %5ld ms (%d brake)   step -50->-250 %5ld ms (%d brake)   update %5.1f host ns\n",
+           name, rev, nRev, step, nStep, ns);
+  }
+}
+
+int main()
+{
+  run(Baseline,"float baseline (stop)",0,0);
+  run(MotL,"integer, no ramp (stop)",0,0);
+  run(MotL,"ramp 1 count/ms",1,1);
+  run(MotL,"ramp 4 count/ms",4,4);
+  run(MotL,"ramp 8 up, 16 down",8,16);
+  return(0);
+}
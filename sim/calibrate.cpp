@@ -0,0 +1,168 @@
+/*
+Check motor calibration (CALIBRATE, see ../Calibrate.h) against the
+plant model in Plant.h, whose encoder edges run the firmware's pin
+change ISR.
+
+  - 'k' finds the breakaway PWM the plant's stiction gives, to a count,
+    and a minimum PWM between the sliding friction's and breakaway
+  - from rest, the calibrated start pulse starts the motor at the
+    calibrated minimum PWM every time, where no pulse does not
+  - the calibrated brake window covers the plant's own time to brake to
+    a stop from full speed, with not much to spare
+  - the results are in EEPROM, and loaded at the next boot; a fresh
+    EEPROM leaves the constructor's values
+  - on a lower battery the calibration follows, and EEPROM with it
+  - '!' aborts it, and puts the motor's settings back
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#define ENCODERS
+#define CALIBRATE
+#include "Sketch.h"
+#include "Plant.h"
+#include "Check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+namespace
+{
+  sim::TankPlant Plant;
+
+  // power on, with the plant at battery volts
+  void boot(double battery)
+  {
+    sim::reset();
+    setup();
+    Plant.vbat = battery;
+    Plant.attach(sim::sketchPinsL(sim::BRIDGE_WTH3615D),sim::sketchPinsR(sim::BRIDGE_WTH3615D),sim::MotorParams());
+    sim::runLoop(4000000,20);  // power-on emergency stop
+  }
+
+  // 'k', until both motors are done.  ms it took
+  unsigned long calibrate()
+  {
+    sim::rx("k\n");
+    sim::runLoop(sim::now() + 10000,20);
+    uint64_t t0 = sim::now();
+    while ((CalL.running() || CalR.running()) && (sim::now() < t0 + 60000000))
+      sim::runLoop(sim::now() + 10000,20);
+    sim::runLoop(sim::now() + 20000,20);  // telemetry out
+    return((sim::now() - t0) / 1000);
+  }
+
+  // plant thresholds, in PWM counts: drive torque at rest over stiction,
+  // and over sliding friction
+  double breakaway(double battery)
+  {
+    sim::MotorParams p;
+    return(255 * p.stiction * p.R / (p.Ke * battery));
+  }
+  double sliding(double battery)
+  {
+    sim::MotorParams p;
+    return(255 * p.coulomb * p.R / (p.Ke * battery));
+  }
+
+  // starts of MotL from rest at speed, in n tries, that got it turning
+  int starts(int speed, int n)
+  {
+    int ok = 0;
+    for (int k=0; k < n; k++)
+      {
+        sim::runLoop(sim::now() + 500000,20);  // braked, and still
+        for (int ms=0; ms < 300; ms += 50)
+          {
+            MotL.setSpeed(speed,millis());  // the speed loop is idle
+            if (!MotL._startupTime && (MotL._mode & 4)) MotL.setSpeed(speed,millis());  // no pulse at all
+            sim::runLoop(sim::now() + 50000,20);
+          }
+        if (Plant.left.w > 1) ok++;
+        MotL.setSpeed(0,millis());
+      }
+    return(ok);
+  }
+
+  // ms for the plant to brake to a stop from full speed
+  double brakeMs()
+  {
+    for (int ms=0; ms < 1000; ms += 50)
+      {
+        MotL.setSpeed(255,millis());
+        sim::runLoop(sim::now() + 50000,20);
+      }
+    MotL.setSpeed(0,millis());
+    uint64_t t0 = sim::now();
+    while (fabs(Plant.left.w) > 0.1) sim::runLoop(sim::now() + 100,20);
+    return((sim::now() - t0) / 1000.0);
+  }
+}
+
+int main()
+{
+  char what[160];
+  int v;
+
+  sim::eepromErase();
+  boot(12);
+  check(sim::telemetry(0,TEL_CAL_LOADED,'L',v) && (v == 0) && (MotL._minPWM == 1),
+        "fresh EEPROM: the constructor's values");
+  size_t tx0 = sim::tx().size();
+  unsigned long ms = calibrate();
+  int brk = -1;
+  sim::telemetry(tx0,TEL_CAL_BREAKAWAY,'L',brk);
+  printf("calibrated in %lu ms: breakaway %d, min PWM %d, start pulse %lu ms, decel %.2f ms/count\n",
+         ms, brk, MotL._minPWM, (unsigned long)(MotL._startupTime / MOTOR_TICKS_PER_MS), MotL._decel / 256.0);
+  snprintf(what,sizeof(what),"breakaway at PWM %d (plant stiction: %.1f)",brk,breakaway(12));
+  check(fabs(brk - breakaway(12)) < 1.5, what);
+  snprintf(what,sizeof(what),"min PWM %d, between sliding friction (%.1f) and breakaway",MotL._minPWM,sliding(12));
+  check((MotL._minPWM > sliding(12)) && (MotL._minPWM < brk) && (MotR._minPWM == MotL._minPWM), what);
+
+  int good = starts(MotL._minPWM,10);
+  uint32_t pulse = MotL._startupTime;
+  MotL._startupTime = 0;
+  int bare = starts(MotL._minPWM,3);
+  MotL._startupTime = pulse;
+  snprintf(what,sizeof(what),"from rest at min PWM, the start pulse starts it %d of 10 times (no pulse: %d of 3)",good,bare);
+  check((good == 10) && (bare == 0), what);
+
+  double stop = brakeMs(), window = 255 * MotL._decel / 256.0;
+  snprintf(what,sizeof(what),"brake window from full speed %.0f ms, plant stops in %.0f ms",window,stop);
+  check((window >= stop) && (window < 1.5 * stop), what);
+
+  // next boot
+  SHORT minPWM = MotL._minPWM;
+  uint32_t startup = MotL._startupTime;
+  unsigned short decel = MotL._decel;
+  boot(12);
+  check(sim::telemetry(0,TEL_CAL_LOADED,'L',v) && (v == 1) && sim::telemetry(0,TEL_CAL_LOADED,'R',v) && (v == 1) &&
+        (MotL._minPWM == minPWM) && (MotL._startupTime == startup) && (MotL._decel == decel),
+        "loaded from EEPROM at boot");
+
+  // '!' part way: settings back as loaded, EEPROM untouched
+  unsigned long writes = sim::eeprom().writes;
+  sim::rx("k\n");
+  sim::runLoop(sim::now() + 1500000,20);
+  bool was = CalL.running();
+  tx0 = sim::tx().size();
+  sim::rx("!\n");
+  sim::runLoop(sim::now() + 20000,20);
+  check(was && !CalL.running() && !CalR.running() && sim::telemetry(tx0,TEL_CAL_FAILED,'L',v) &&
+        (MotL._minPWM == minPWM) && (MotL._startupTime == startup) && (MotL._decel == decel) &&
+        (MotL._mode == MOTOR_STOPPING) && (sim::eeprom().writes == writes),
+        "'!' aborts, and puts the settings back");
+
+  // weaker battery
+  boot(9);
+  tx0 = sim::tx().size();
+  calibrate();
+  sim::telemetry(tx0,TEL_CAL_BREAKAWAY,'L',brk);
+  snprintf(what,sizeof(what),"9 V battery: breakaway at PWM %d (plant: %.1f), min PWM %d",brk,breakaway(9),MotL._minPWM);
+  check((fabs(brk - breakaway(9)) < 1.5) && (MotL._minPWM > minPWM), what);
+  minPWM = MotL._minPWM;
+  boot(9);
+  check(MotL._minPWM == minPWM, "  and stored");
+  return(nFail ? 1 : 0);
+}
@@ -0,0 +1,152 @@
+/*
+Check the background current sampler and overcurrent trip
+(DBH1 with CURRENT_SENSE, see ../CurrentSense.h).
+
+Checks that MotorDrive keeps the defaults the DBH1 build had before
+the drivers shared one core, that loop() never waits on an analogRead(), that the averages
+and peaks follow the current sense inputs, and that a current step
+over the trip level brakes that motor within one sample period, even
+while loop() is stuck in a slow pass, with the emergency stop and its
+telemetry following on the next update.  A trip that comes in the
+middle of setSpeed()'s pin writes, for a new speed or a start pulse,
+leaves the bridge braked.
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#define DBH1
+#define CURRENT_SENSE
+#include "Sketch.h"
+#include "Check.h"
+#include <stdio.h>
+
+namespace
+{
+  // MotL is on en 10, in1 6, in2 11, current sense A2
+  uint64_t BrakeAt;
+  void watchBrake(uint8_t pin, int, void *)
+  {
+    if ((pin == 10 || pin == 6 || pin == 11) && !BrakeAt &&
+        sim::pinDigital(10) && !sim::pinPWM(6) && !sim::pinPWM(11))
+      BrakeAt = sim::now();
+  }
+
+  // trip MotL from the pin hook, at its first write to pin
+  uint8_t TripPin = 255;
+  void tripOnWrite(uint8_t pin, int, void *)
+  {
+    if (pin != TripPin) return;
+    TripPin = 255;
+    MotL.trip();  // as the ADC interrupt would, between two pin writes
+  }
+
+  inline bool braked()
+  {
+    return(sim::pinDigital(10) && !sim::pinPWM(6) && !sim::pinPWM(11));
+  }
+
+  void start()
+  {
+    sim::reset();
+    setup();
+    sim::setAnalogInput(1,200);
+    sim::setAnalogInput(2,200);
+    sim::runLoop(sim::now() + 4000000,100);  // wait out the power-on emergency stop
+    sim::rx("L150,R150\n");
+    sim::runLoop(sim::now() + 100000,100);
+  }
+
+  // the DBH1 build of MotorDrive, as it was before the drivers shared a
+  // core: the L298 driver's defaults, direction input PWM at 250
+  void defaults()
+  {
+    start();
+    check((MotL._deadTime == 500) && (MotL._startupTime == 50 * MOTOR_TICKS_PER_MS) &&
+          (MotL._maxPWM == 255) && (MotL._minPWM == 1) && (MotL._stopTime == 3000),
+          "MotorDrive keeps the L298 driver's defaults");
+    check((MotL._mode == MOTOR_FWD) && (sim::pinPWM(11) == 250) && (sim::pinPWM(6) == 0),
+          "  direction input at PWM 250");
+  }
+
+  void sampling()
+  {
+    start();
+    check(sim::counters().analogReads == 0, "loop() never calls analogRead()");
+    check((MotL.getCurrentCounts() == 200) && (MotR.getCurrentCounts() == 200),
+          "averages follow the inputs");
+    Current.peak(0);
+    sim::setAnalogInput(1,500);
+    sim::advance(300);
+    sim::setAnalogInput(1,200);
+    sim::advance(2000);
+    unsigned short pk = Current.peak(0);
+    char what[80];
+    snprintf(what,sizeof(what),"  short spike in the peak (%u), not in the average (%u)",
+             pk, MotR.getCurrentCounts());
+    check((pk == 500) && (MotR.getCurrentCounts() < 300), what);
+    check(MotR._mode == MOTOR_FWD, "  spike under the trip level: still running");
+  }
+
+  void trip(uint32_t loopUs)
+  {
+    start();
+    sim::rx("L150,R150\n");
+    sim::runLoop(sim::now() + 20000,100);
+    bool running = (MotL._mode == MOTOR_FWD) && (MotR._mode == MOTOR_FWD);
+
+    BrakeAt = 0;
+    sim::setPinHook(watchBrake,0);
+    uint64_t t0 = sim::now();
+    sim::setAnalogInput(2,CURRENT_TRIP + 100);
+    loop();
+    sim::advance(loopUs);  // a slow pass: the trip has to come from the ISR
+    sim::setPinHook(0,0);
+    size_t tx0 = sim::tx().size();
+    sim::setAnalogInput(2,200);
+    sim::runLoop(sim::now() + 5000,100);
+    Tel.drain();
+
+    char what[100];
+    snprintf(what,sizeof(what),"%u us loop pass: overcurrent brake after %lu us (sample period 208)",
+             loopUs, (unsigned long)(BrakeAt - t0));
+    check(running && BrakeAt && (BrakeAt - t0 <= 2 * 104), what);
+    check(MotL._mode == MOTOR_STOPPING, "  emergency stop on the next update");
+    check(MotR._mode == MOTOR_FWD, "  other motor still running");
+    check(sim::tx().find(std::string("\xA6\x12L",3),tx0) != std::string::npos,
+          "  overcurrent telemetry sent");
+  }
+
+  // setSpeed() interrupted by the trip after its first pin write
+  void tripMidSequence()
+  {
+    start();
+    bool running = (MotL._mode == MOTOR_FWD);
+    TripPin = 6;  // in1(0), then in2 and en to drive
+    sim::setPinHook(tripOnWrite,0);
+    MotL.setSpeed(200);
+    sim::setPinHook(0,0);
+    check(running && (TripPin == 255) && braked(), "trip in the middle of a speed change: braked");
+    MotL.update(millis());
+    check(MotL._mode == MOTOR_STOPPING, "  emergency stop on the next update");
+
+    sim::advance(4000000);  // out of the emergency stop
+    MotL.update(millis());
+    bool stopped = (MotL._mode == MOTOR_STOPPED) || (MotL._mode == MOTOR_STOPPING);
+    TripPin = 6;  // in1(0), then in2 and en on: the start pulse
+    sim::setPinHook(tripOnWrite,0);
+    MotL.setSpeed(150);
+    sim::setPinHook(0,0);
+    check(stopped && (TripPin == 255) && braked(), "trip in the middle of a start pulse: braked");
+  }
+}
+
+int main()
+{
+  defaults();
+  sampling();
+  trip(100);
+  trip(20000);
+  tripMidSequence();
+  return(nFail ? 1 : 0);
+}
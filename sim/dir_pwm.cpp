@@ -0,0 +1,142 @@
+/*
+Check PWM on the L298 direction input (L298Drive::setDirPwm()), and the
+output map (setOutputMap(), ../MotorMap.h), against the plant model.
+
+  - a lone motor is run to a steady speed at each low speed command,
+    with PWM on EN, on the direction input, and on the direction input
+    through MotorMapDir.  The ideal is speed in proportion to the
+    command.  PWM on EN runs away from it (nothing, then a third of full
+    speed at once); on the direction input it is a straight line less a
+    deadband; through the map it follows the command closely
+  - MotorMapDir is the map fitted to the plant motor now, to within a
+    count per entry
+
+    dir_pwm -t    fit the map to the plant, and print it as MotorMap.h
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#include "Arduino.h"
+#include "Plant.h"
+#include "../MotorDrive298.h"
+#include "../MotorMap.h"
+#include "Check.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// no sketch here, just a motor
+void setup() {}
+void loop() {}
+
+namespace
+{
+  const uint8_t En = 11, In1 = 9, In2 = 10;
+
+  // steady motor speed, rad/s, at speed command spd
+  double steady(bool dirPwm, const byte *map, int spd)
+  {
+    sim::reset();
+    L298Drive<> M(0.5f);
+    M.setDirPwm(dirPwm);
+    M.setOutputMap(map);
+    M.begin(En,In1,In2);
+    sim::DCMotor mot;
+    sim::BridgePins b = { sim::BRIDGE_L298, En,In1,In2,255, 255,255, 255 };
+    mot.begin(b,sim::MotorParams());
+    sim::advance(3100000);  // out of begin()'s emergency stop
+    M.update(millis());
+
+    double sum = 0;
+    int n = 0;
+    for (int ms=0; ms < 3000; ms++)
+      {
+        if ((ms % 100) == 0) M.setSpeed(spd,millis());  // ahead of the deadman
+        else M.update(millis());
+        for (int k=0; k < 10; k++)
+          {
+            mot.step(1e-4,12);
+            sim::advance(100);
+          }
+        if (ms >= 2500)
+          {
+            sum += mot.w;
+            n++;
+          }
+      }
+    return(sum / n);
+  }
+
+  // PWM for each speed, for a straight line response on the direction input
+  void fit(byte *map)
+  {
+    double w[256];
+    for (int d=0; d < 256; d++) w[d] = steady(true,0,d);
+    map[0] = 0;
+    for (int k=1; k < 256; k++)
+      {
+        double target = w[255] * k / 255;
+        int d = 1;
+        while ((d < 255) && (w[d] < target)) d++;
+        double f = (w[d] > w[d-1]) ? (target - w[d-1]) / (w[d] - w[d-1]) : 1;
+        if (f < 0) f = 0;
+        int v = (int)floor(d - 1 + f + 0.5);
+        map[k] = (v < map[k-1]) ? map[k-1] : v;
+      }
+  }
+
+  // worst and rms error from the ideal over speeds 1..top, % of full speed
+  void tracking(bool dirPwm, const byte *map, int top, double *worst, double *rms)
+  {
+    double full = steady(dirPwm,map,255);
+    double sum = 0;
+    *worst = 0;
+    for (int k=1; k <= top; k++)
+      {
+        double e = fabs(steady(dirPwm,map,k) - full * k / 255) / full * 100;
+        if (e > *worst) *worst = e;
+        sum += e * e;
+      }
+    *rms = sqrt(sum / top);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  byte map[256];
+  if ((argc > 1) && !strcmp(argv[1],"-t"))
+    {
+      fit(map);
+      printf("const byte MotorMapDir[256] PROGMEM = {\n");
+      for (int k=0; k < 256; k++)
+        printf("%s%3d%s", (k % 16) ? "" : "  ", map[k], (k == 255) ? "\n" : ((k % 16) == 15) ? ",\n" : ",");
+      printf("};\n");
+      return(0);
+    }
+
+  char what[120];
+  const int Top = 64;  // low speeds, a quarter of the range
+  double enWorst, enRms, dirWorst, dirRms, mapWorst, mapRms;
+  tracking(false,0,Top,&enWorst,&enRms);
+  tracking(true,0,Top,&dirWorst,&dirRms);
+  tracking(true,MotorMapDir,Top,&mapWorst,&mapRms);
+  printf("speed error from the ideal, speeds 1..%d, %% of full speed\n", Top);
+  printf("  PWM on EN            : worst %5.1f  rms %5.1f\n", enWorst, enRms);
+  printf("  on the direction pin : worst %5.1f  rms %5.1f\n", dirWorst, dirRms);
+  printf("  through MotorMapDir  : worst %5.1f  rms %5.1f\n", mapWorst, mapRms);
+  snprintf(what,sizeof(what),"direction PWM with the map tracks low speeds within %.1f%% (EN PWM %.1f%%)",
+           mapWorst, enWorst);
+  check((mapWorst < 1.5) && (mapRms * 5 < dirRms) && (dirRms < enRms), what);
+
+  fit(map);
+  int off = 0;
+  for (int k=0; k < 256; k++)
+    {
+      int d = abs((int)map[k] - (int)pgm_read_byte(MotorMapDir + k));
+      if (d > off) off = d;
+    }
+  snprintf(what,sizeof(what),"MotorMapDir fits the plant motor (off by %d at most)",off);
+  check(off <= 1, what);
+  return(nFail ? 1 : 0);
+}
@@ -0,0 +1,167 @@
+/*
+Check the compile-time pin drivers (MotorPinsFast, FastPin.h) against
+the run-time ones (MotorPins): the same command script, through each,
+must drive the same pins to the same levels in the same order.
+
+The mock core models the port and timer registers, so FastPin takes its
+register path here, as on the robot (see Arduino.h).  Each pin change
+is logged as (time, pin, PWM); a change undone at once, as when
+FastPin disconnects a timer just before the port write, is dropped.
+
+  - L298 and WTH3615D pin sets, as TankDrive.ino's FAST_PINS build
+  - DBH1 pins, with PWM on Timer0, Timer1 and Timer2 pins
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#include "Arduino.h"
+#include "../MotorDrive298.h"
+#include "../MotorDriveDBH1.h"
+#include "Check.h"
+#include <stdio.h>
+#include <vector>
+
+// no sketch here, just motors
+void setup() {}
+void loop() {}
+
+namespace
+{
+  struct Change
+  {
+    unsigned long t;
+    uint8_t pin;
+    int pwm;
+    bool operator==(const Change &o) const { return((t == o.t) && (pin == o.pin) && (pwm == o.pwm)); }
+  };
+
+  struct Trace
+  {
+    std::vector<Change> v;
+    int last[NUM_DIGITAL_PINS];
+  };
+
+  void logPin(uint8_t pin, int pwm, void *ctx)
+  {
+    Trace &tr = *(Trace *)ctx;
+    if (pwm == tr.last[pin]) return;
+    Change c = { micros(), pin, pwm };
+    if (!tr.v.empty() && (tr.v.back().t == c.t) && (tr.v.back().pin == pin))
+      {  // the same pin again, at once
+        tr.v.pop_back();
+        tr.last[pin] = 0;
+        for (size_t k=tr.v.size(); k-- > 0; )
+          if (tr.v[k].pin == pin)
+            {
+              tr.last[pin] = tr.v[k].pwm;
+              break;
+            }
+        if (pwm == tr.last[pin]) return;
+      }
+    tr.v.push_back(c);
+    tr.last[pin] = pwm;
+  }
+
+  // the script: start, speed changes, a reverse, ramps, the deadman, a
+  // trip, a stop.  Updated every ms, commanded every 20 ms
+  template<class M> void script(M &m)
+  {
+    static const int Cmd[] = { 100, 100, 180, 40, -120, -120, -255, 0,
+                               60, 250, 250, -30, 0, 0 };
+    sim::advance(3100000);  // out of begin()'s emergency stop
+    for (size_t k=0; k < sizeof(Cmd)/sizeof(Cmd[0]); k++)
+      {
+        if (k == 9) m.setRampRates(2.0f,1.0f);
+        for (int ms=0; ms < 200; ms++)
+          {
+            if ((ms % 20) == 0) m.setSpeed(Cmd[k],millis());
+            else m.update(millis());
+            sim::advance(1000);
+          }
+      }
+    m.setRampRates(0,0);
+    m.setSpeed(200,millis());
+    for (int ms=0; ms < 1000; ms++)  // deadman, no commands
+      {
+        m.update(millis());
+        sim::advance(1000);
+      }
+    m.setSpeed(150,millis());
+    sim::advance(100000);
+    m.setSpeed(150,millis());
+    m.trip();
+    m.setSpeed(150,millis());
+    sim::advance(1000);
+    m.update(millis());
+  }
+
+  template<class M> struct Begin0
+  {
+    void operator()(M &m) const { m.begin(); }
+  };
+  template<class M> struct Begin3
+  {
+    int a, b, c;
+    void operator()(M &m) const { m.begin(a,b,c); }
+  };
+  template<class M> struct Begin4
+  {
+    int a, b, c, d;
+    void operator()(M &m) const { m.begin(a,b,c,d); }
+  };
+
+  template<class M, class B> Trace run(const B &begin)
+  {
+    Trace tr;
+    for (int k=0; k < NUM_DIGITAL_PINS; k++) tr.last[k] = 0;  // low from reset
+    sim::reset();
+    sim::setPinHook(logPin,&tr);
+    M m(0.5f);
+    begin(m);
+    script(m);
+    sim::setPinHook(0,0);
+    return(tr);
+  }
+
+  void compare(const char *name, const Trace &slow, const Trace &fast)
+  {
+    char what[160];
+    size_t n = (slow.v.size() < fast.v.size()) ? slow.v.size() : fast.v.size(), k = 0;
+    while ((k < n) && (slow.v[k] == fast.v[k])) k++;
+    if ((k == n) && (slow.v.size() == fast.v.size()))
+      snprintf(what,sizeof(what),"%s: %u pin changes, the same", name, (unsigned)n);
+    else if (k < n)
+      snprintf(what,sizeof(what),"%s: change %u differs: %lu us pin %u %d, fast pin %u %d",
+               name, (unsigned)k, slow.v[k].t, slow.v[k].pin, slow.v[k].pwm, fast.v[k].pin, fast.v[k].pwm);
+    else
+      snprintf(what,sizeof(what),"%s: %u pin changes, fast %u", name,
+               (unsigned)slow.v.size(), (unsigned)fast.v.size());
+    check((k == n) && (slow.v.size() == fast.v.size()) && (n > 50), what);
+  }
+}
+
+int main()
+{
+  typedef L298Drive<> L298;
+  typedef L298Drive< MotorPinsFast<11,7,8> > L298L;
+  typedef L298Drive< MotorPinsFast<3,2,4> >  L298R;
+  Begin3<L298> l298L = { 11,7,8 }, l298R = { 3,2,4 };
+  compare("L298 left (11,7,8)",run<L298>(l298L),run<L298L>(Begin0<L298L>()));
+  compare("L298 right (3,2,4)",run<L298>(l298R),run<L298R>(Begin0<L298R>()));
+
+  typedef WTH3615DDrive<> WTH;
+  typedef WTH3615DDrive< MotorPinsFast<9,7,8,11> > WTHL;
+  typedef WTH3615DDrive< MotorPinsFast<5,2,4,3> >  WTHR;
+  Begin4<WTH> wthL = { 9,7,8,11 }, wthR = { 5,2,4,3 };
+  compare("WTH3615D left (9,7,8,11)",run<WTH>(wthL),run<WTHL>(Begin0<WTHL>()));
+  compare("WTH3615D right (5,2,4,3)",run<WTH>(wthR),run<WTHR>(Begin0<WTHR>()));
+
+  typedef DBH1Drive<> DBH1;
+  typedef DBH1Drive< MotorPinsFast<10,6,11,NO_PIN,2> > DBH1L;
+  typedef DBH1Drive< MotorPinsFast<9,5,3,NO_PIN,1> >   DBH1R;
+  Begin4<DBH1> dbh1L = { 10,6,11,2 }, dbh1R = { 9,5,3,1 };
+  compare("DBH1 left (10,6,11)",run<DBH1>(dbh1L),run<DBH1L>(Begin0<DBH1L>()));
+  compare("DBH1 right (9,5,3)",run<DBH1>(dbh1R),run<DBH1R>(Begin0<DBH1R>()));
+  return(nFail ? 1 : 0);
+}
@@ -0,0 +1,316 @@
+/*
+Fuzz the command parser (../Command.h), the only path for bytes from
+the Bluetooth link.
+
+Every input is fed a byte at a time, as from the RX interrupt, to a
+fresh CommandReader, built over garbage memory, checking after each byte that:
+
+  - get() takes one byte per call, and returns at most two commands
+    per byte (a binary frame's L and R, M and V, T and S, or J and K)
+  - every command code is one the parser knows, and every value is in
+    range: |ASCII value| <= COMMAND_VAL_MAX, frame speeds <= 255
+  - the partial command state stays in range
+
+Standalone, runs seeded random byte streams, every value either side
+of the saturation point (COMMAND_VAL_MAX), then structured streams:
+random garbage, a resync ("\n" x5, then '~'), then valid ASCII commands
+and binary frames, which must all decode exactly, in order.  Input
+files given on the command line (e.g. a crash from libFuzzer) are run
+instead.
+
+    fuzz_command [-n count] [-s seed] [file ...]
+
+Built with -DLIBFUZZER and -fsanitize=fuzzer it is a libFuzzer target
+instead (see the Makefile's fuzz-libfuzzer).  Aborts on failure.
+
+provided under LGPL license
+*/
+#define COMMAND_RX_ISR
+#include "Arduino.h"
+#include "../Command.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <new>
+
+// no sketch here, just the parser
+void setup() {}
+void loop() {}
+
+namespace
+{
+  struct Cmd
+  {
+    char code;
+    int val;
+    bool operator==(const Cmd &o) const { return((code == o.code) && (val == o.val)); }
+  };
+
+  void fail(const char *what, const uint8_t *data, size_t n)
+  {
+    fprintf(stderr,"FAIL: %s.  input (%zu bytes):\n",what,n);
+    for (size_t k=0; k < n; k++) fprintf(stderr,"%02x%s",data[k],((k % 32) == 31) ? "\n" : "");
+    fprintf(stderr,"\n");
+    abort();
+  }
+
+  bool isSeparator(char c)
+  {
+    return(strchr(" \t\r\n,;",c) != 0);  // and 0: strchr finds the terminator
+  }
+
+  bool knownCode(char c)
+  {
+    return(isSeparator(c) || (c && strchr("LR!?^aAFqokpmtCcSTGgrdMVJKQO",c)));
+  }
+
+  // parse data, checking the invariants.  commands out, separators dropped
+  void parse(const uint8_t *data, size_t n, std::vector<Cmd> *out)
+  {
+    CommandRx = CommandRing();
+    // built over garbage, as a reader on the stack or heap starts: the
+    // member initializers alone must give a clean state
+    alignas(CommandReader) static unsigned char mem[sizeof(CommandReader)];
+    memset(mem,0xa5,sizeof(mem));
+    CommandReader &r = *new(mem) CommandReader;
+    for (size_t k=0; k < n; k++)
+      {
+        CommandRx.put(data[k]);
+        int nGot = 0, nCall = 0;
+        Cmd c;
+        while (r.pendCode || CommandRx.available())
+          {
+            if (++nCall > 2) fail("more than two get() calls for one byte",data,n);
+            if (!r.get(c.code,c.val)) continue;
+            if (++nGot > 2) fail("more than two commands for one byte",data,n);
+            if (!knownCode(c.code)) fail("unknown command code",data,n);
+            if ((c.val < -COMMAND_VAL_MAX) || (c.val > COMMAND_VAL_MAX))
+              fail("command value out of range",data,n);
+            if (c.code && strchr("!?^aAFqok",c.code) && c.val) fail("value on a command without one",data,n);
+            if (out && !isSeparator(c.code)) out->push_back(c);
+          }
+        if (CommandRx.available()) fail("byte left unread",data,n);
+        if (r.nFrame >= COMMAND_FRAME_LEN) fail("frame index out of range",data,n);
+        if ((r.val < 0) || (r.val > COMMAND_VAL_MAX)) fail("partial value out of range",data,n);
+        if ((r.nDig < 0) || (r.nDig > COMMAND_VAL_DIGITS)) fail("digit count out of range",data,n);
+        if ((r.pendCode != 0) && (r.pendCode != 'R') && (r.pendCode != 'V') && (r.pendCode != 'S') && (r.pendCode != 'K')) fail("bad pending code",data,n);
+      }
+  }
+
+  // garbage biased to the bytes the parser cares about
+  void garbage(std::string &s, size_t n)
+  {
+    static const char Alphabet[] = "LR0123456789-,;\n\r \t~!?^aAFqpmtCcSTGgrdMVJKQ";
+    for (size_t k=0; k < n; k++)
+      {
+        int r = rand() % 8;
+        if (r == 0) s += (char)COMMAND_SYNC;
+        else if (r < 5) s += Alphabet[rand() % (sizeof(Alphabet) - 1)];
+        else s += (char)(rand() & 0xff);
+      }
+  }
+
+  int saturate(long v)
+  {
+    // exact up to COMMAND_VAL_MAX, and COMMAND_VAL_MAX past it
+    return((v > COMMAND_VAL_MAX) ? COMMAND_VAL_MAX : (int)v);
+  }
+
+  // a valid command, appended to s, and what it must decode to
+  void valid(std::string &s, std::vector<Cmd> &want)
+  {
+    static const char Valued[] = "pmtCcSTGgrdMVJKQO";
+    static const char Bare[] = "!?^aAFqok";
+    char buf[48];
+    int l, r;
+    switch(rand() % 8)
+      {
+      case 0:  // drive pair, as the app sends it
+        l = rand() % 511 - 255;
+        r = rand() % 511 - 255;
+        snprintf(buf,sizeof(buf),"L%d,R%d\n",l,r);
+        s += buf;
+        want.push_back(Cmd{'L',l});
+        want.push_back(Cmd{'R',r});
+        break;
+      case 1:  // binary drive frame
+        {
+          byte f[COMMAND_FRAME_LEN];
+          l = rand() % 511 - 255;
+          r = rand() % 511 - 255;
+          commandEncodeDrive(f,l,r);
+          s.append((const char *)f,sizeof(f));
+          want.push_back(Cmd{'L',l});
+          want.push_back(Cmd{'R',r});
+        }
+        break;
+      case 5:  // binary group frame
+        {
+          byte f[COMMAND_FRAME_LEN];
+          byte mask = rand() & 0xff;
+          l = rand() % 511 - 255;
+          commandEncodeGroup(f,mask,l);
+          s.append((const char *)f,sizeof(f));
+          want.push_back(Cmd{'M',mask});
+          want.push_back(Cmd{'V',l});
+        }
+        break;
+      case 6:  // binary arcade frame
+        {
+          byte f[COMMAND_FRAME_LEN];
+          l = rand() % 511 - 255;
+          r = rand() % 511 - 255;
+          commandEncodeDrive(f,l,r,COMMAND_OP_ARCADE);
+          s.append((const char *)f,sizeof(f));
+          want.push_back(Cmd{'T',l});
+          want.push_back(Cmd{'S',r});
+        }
+        break;
+      case 7:  // binary segment and queue frames
+        {
+          byte f[2 * COMMAND_FRAME_LEN];
+          l = rand() % 511 - 255;
+          r = rand() % 511 - 255;
+          int ms = (rand() % 4) ? rand() % 5000 : rand() % 40000;
+          commandEncodeSegment(f,l,r,ms);
+          s.append((const char *)f,sizeof(f));
+          want.push_back(Cmd{'J',l});
+          want.push_back(Cmd{'K',r});
+          want.push_back(Cmd{'Q',(ms > COMMAND_VAL_MAX) ? COMMAND_VAL_MAX : ms});
+        }
+        break;
+      case 2:  // command with a value, maybe long enough to saturate
+        {
+          char c = Valued[rand() % (sizeof(Valued) - 1)];
+          static const long Edge[] = { 3276, 3277, 32759, 32760, 32761, 32766, 32767,
+                                       32768, 32769, 32770, 32777, 32799, 327670 };
+          long v = (rand() % 4) ? rand() % 1000 : (rand() % 2) ? rand() % 10000000 :
+                   Edge[rand() % (sizeof(Edge)/sizeof(Edge[0]))];
+          bool neg = rand() % 2;
+          snprintf(buf,sizeof(buf),"%c%s%s%ld\n",c,neg ? "-" : "",(rand() % 8) ? "" : "00",v);
+          s += buf;
+          want.push_back(Cmd{c,neg ? -saturate(v) : saturate(v)});
+        }
+        break;
+      case 3:  // command without a value
+        {
+          char c = Bare[rand() % (sizeof(Bare) - 1)];
+          s += c;
+          s += '\n';
+          want.push_back(Cmd{c,0});
+        }
+        break;
+      default:  // value run, many digits
+        {
+          std::string d(1 + rand() % 40,'9');
+          s += "S" + d + "\n";
+          want.push_back(Cmd{'S',(d.size() < 5) ? atoi(d.c_str()) : COMMAND_VAL_MAX});
+        }
+      }
+  }
+
+  // every value around the saturation point, one command each
+  void edges()
+  {
+    for (long v=32700; v <= 32800; v++)
+      for (int neg=0; neg < 2; neg++)
+        {
+          char buf[16];
+          snprintf(buf,sizeof(buf),"Q%s%ld\n",neg ? "-" : "",v);
+          std::vector<Cmd> got;
+          parse((const uint8_t *)buf,strlen(buf),&got);
+          int want = neg ? -saturate(v) : saturate(v);
+          if ((got.size() != 1) || (got[0].code != 'Q') || (got[0].val != want))
+            fail("value near COMMAND_VAL_MAX not decoded exactly",(const uint8_t *)buf,strlen(buf));
+        }
+  }
+
+  void structured(unsigned long count)
+  {
+    for (unsigned long k=0; k < count; k++)
+      {
+        std::string s;
+        garbage(s,rand() % 64);
+        s += "\n\n\n\n\n~";  // ends any frame, then any partial command
+        std::vector<Cmd> got, want;
+        parse((const uint8_t *)s.data(),s.size(),&got);
+        size_t skip = got.size();
+        int nValid = 1 + rand() % 8;
+        for (int v=0; v < nValid; v++) valid(s,want);
+        got.clear();
+        parse((const uint8_t *)s.data(),s.size(),&got);
+        if ((got.size() != skip + want.size()) ||
+            !std::equal(want.begin(),want.end(),got.begin() + skip))
+          fail("valid commands after a resync not decoded exactly",
+               (const uint8_t *)s.data(),s.size());
+      }
+  }
+
+  bool runFile(const char *path)
+  {
+    FILE *f = fopen(path,"rb");
+    if (!f)
+      {
+        perror(path);
+        return(false);
+      }
+    std::string s;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf,1,sizeof(buf),f)) > 0) s.append(buf,n);
+    fclose(f);
+    parse((const uint8_t *)s.data(),s.size(),0);
+    return(true);
+  }
+}
+
+#ifdef LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t n)
+{
+  parse(data,n,0);
+  return(0);
+}
+#else
+int main(int argc, char **argv)
+{
+  unsigned long count = 20000;
+  unsigned seed = 1;
+  int opt;
+  while ((opt = getopt(argc,argv,"n:s:")) != -1)
+    switch(opt)
+      {
+      case 'n': count = strtoul(optarg,0,10); break;
+      case 's': seed = strtoul(optarg,0,10); break;
+      default:
+        fprintf(stderr,"usage: fuzz_command [-n count] [-s seed] [file ...]\n");
+        return(2);
+      }
+  if (optind < argc)
+    {
+      for (int k=optind; k < argc; k++)
+        if (!runFile(argv[k])) return(2);
+      printf("ok  : %d input files\n", argc - optind);
+      return(0);
+    }
+
+  srand(seed);
+  size_t bytes = 0;
+  for (unsigned long k=0; k < count; k++)
+    {
+      std::string s;
+      garbage(s,rand() % 512);
+      bytes += s.size();
+      parse((const uint8_t *)s.data(),s.size(),0);
+    }
+  printf("ok  : %lu random streams (%zu bytes), parser invariants hold\n", count, bytes);
+  edges();
+  printf("ok  : values 32700..32800 decode exactly, or saturate to %d\n", COMMAND_VAL_MAX);
+  structured(count / 4);
+  printf("ok  : %lu streams of garbage, resync, then valid commands decode exactly\n", count / 4);
+  return(0);
+}
+#endif
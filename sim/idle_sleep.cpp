@@ -0,0 +1,116 @@
+/*
+Check idle sleep between deadlines (IDLE_SLEEP, see ../IdleSleep.h).
+
+Runs the sketch idle, driving, reversing and timing out, with loop()
+sleeping whenever nothing is due.  Checks that no scheduler task runs
+late or skips a period, that the motor transitions (start pulse end,
+brake before a reversal, deadman) come as many ms after their cause as
+without sleep, that a command still takes effect as soon as its last
+byte is in, and that the CPU sleeps most of the time while idle.
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#define IDLE_SLEEP
+#include "Sketch.h"
+#include "Check.h"
+#include <stdio.h>
+
+namespace
+{
+  const uint32_t LoopUs = 20;   // virtual cost of one awake loop() pass
+  const uint8_t  PwmL = 11;     // MotL's PWM input (WTH3615D)
+
+  sim::PinEdges Edges(PwmL);  // MotL PWM pin changes
+
+  // send cmd every 20 ms from t for ms.  returns when the last one was sent
+  uint64_t send(const char *cmd, uint64_t t, uint32_t ms)
+  {
+    uint64_t last = t;
+    for (uint32_t k=0; k < ms; k += 20)
+      {
+        last = t + (uint64_t)k * 1000;
+        sim::runLoop(last,LoopUs);
+        sim::rx(cmd);
+      }
+    return(last);
+  }
+
+  void schedulerOnTime(const char *phase)
+  {
+    unsigned long late = 0, over = 0;
+    for (byte i=0; i < Sched.nTask; i++)
+      {
+        if (Sched.task[i].maxLate > late) late = Sched.task[i].maxLate;
+        over += Sched.task[i].overruns;
+        Sched.task[i].maxLate = 0;
+      }
+    char what[100];
+    snprintf(what,sizeof(what),"  %s: no task late (worst %lu us) or skipped (%lu)",
+             phase, late, over);
+    check((late <= 2 * LoopUs) && (over == 0), what);
+  }
+}
+
+int main()
+{
+  sim::reset();
+  sim::setPinHook(sim::PinEdges::hook,&Edges);
+  setup();
+
+  // power-on emergency stop, then idle
+  sim::runLoop(4000000,LoopUs);
+  schedulerOnTime("power-on stop");
+  uint64_t s0 = sim::counters().sleepUs, t0 = sim::now();
+  sim::runLoop(t0 + 5000000,LoopUs);
+  double idle = (double)(sim::counters().sleepUs - s0) / (sim::now() - t0);
+  char what[120];
+  snprintf(what,sizeof(what),"idle: asleep %.0f%% of the time, %u sleeps/s",
+           idle * 100, (unsigned)(sim::counters().sleeps / (sim::now() * 1e-6)));
+  check(idle > 0.6, what);
+  schedulerOnTime("idle");
+
+  // drive forward: start pulse, then running
+  uint64_t c0 = sim::now();
+  uint64_t in = c0 + 5 * sim::byteTime();  // "L150," is in
+  uint64_t last = send("L150,R150\n",c0,1000);
+  sim::runLoop(last + 1,LoopUs);
+  uint64_t kick = Edges.at(255,c0), run = Edges.at(150,c0);
+  snprintf(what,sizeof(what),"drive: start pulse %lu us after the L command is in",
+           (unsigned long)(kick - in));
+  check(kick && (kick - in <= 3 * LoopUs), what);
+  snprintf(what,sizeof(what),"  start pulse %lu us (50 ms, plus up to 2 ms)",
+           (unsigned long)(run - kick));
+  check(run && (run - kick >= 50000) && (run - kick <= 52000), what);
+  schedulerOnTime("driving");
+
+  // reverse: brake for the stopping time, then start the other way
+  unsigned int stopMs = (150UL * MotL._decel) >> 8;
+  uint64_t r0 = sim::now();
+  last = send("L-150,R150\n",r0,1000);
+  uint64_t brake = Edges.at(0,r0), rekick = Edges.at(255,r0);
+  snprintf(what,sizeof(what),"reverse: restart %lu us after the brake (%u ms stopping time, plus up to 2 ms)",
+           (unsigned long)(rekick - brake), stopMs);
+  check(brake && rekick && (rekick - brake >= stopMs * 1000UL) &&
+        (rekick - brake <= stopMs * 1000UL + 2000), what);
+  schedulerOnTime("reversing");
+
+  // the app goes quiet: deadman
+  sim::runLoop(last + 2000000,LoopUs);
+  uint64_t dead = Edges.at(0,last);
+  uint64_t lastIn = last + 11 * sim::byteTime();
+  snprintf(what,sizeof(what),"deadman: brake %lu ms after the last command (%d ms, plus up to 2 ms)",
+           (unsigned long)((dead - lastIn) / 1000), MotL._deadTime);
+  check(dead && (dead - lastIn >= (uint64_t)MotL._deadTime * 1000) &&
+        (dead - lastIn <= (uint64_t)MotL._deadTime * 1000 + 2000 + 3 * LoopUs), what);
+  schedulerOnTime("deadman");
+
+  // '?' reports time asleep
+  size_t tx0 = sim::tx().size();
+  sim::rx("?\n");
+  sim::runLoop(sim::now() + 50000,LoopUs);
+  size_t at = sim::tx().find(std::string("\xA6\x15",2),tx0);
+  check(at != std::string::npos, "'?' reports time asleep");
+  return(nFail ? 1 : 0);
+}
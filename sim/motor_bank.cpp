@@ -0,0 +1,293 @@
+/*
+Check MotorBank<N> (../MotorBank.h) against the driver objects it
+stands in for, and report its SRAM per channel.
+
+  - a bank channel with L298 pins, and one with WTH3615D pins, are fed
+    the same random commands as an L298Drive and a WTH3615DDrive:
+    speeds, reversals, stops, emergency stops and deadman timeouts,
+    with and without ramps, and with a decel-only ramp.  The bank runs
+    the drivers' state machine (MotorStateMachine), so their pins must
+    match every ms
+  - the bank's 16 bit deadlines carry on across the millis() wrap
+    (only their low 16 bits are kept), and a command after an idle
+    long enough for them to wrap around still starts the motor
+  - group commands: 'L'/'R' set each side's channels, "M<mask>,V<speed>"
+    and a group frame set any set of channels, newest per channel wins
+  - channels sharing pins (TankDrive.ino's 6 channel L298 table) are
+    only commanded together: a command to one goes to its whole side,
+    at one speed, and their deadman timers run out together
+  - trip() brakes a channel's side at once, and the emergency stop
+    follows on the next update()
+  - per channel SRAM is well under a driver object's
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#include "Arduino.h"
+#include "../MotorDrive298.h"
+#include "../MotorBank.h"
+#include "../Command.h"
+#include "Check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+// no sketch here, just motors
+void setup() {}
+void loop() {}
+
+namespace
+{
+  // L298Drive<MotorPins> on an AVR: 43 bytes of state (a float-free
+  // MotorDriveCore, and the drive mode), and 5 pins.  The host's
+  // sizeof() pads its longs
+  const unsigned DriveAvrBytes = 48;
+
+  struct Pins { uint8_t en, in1, in2, pwm; };
+  const Pins RefL298 = {11, 7, 8,NO_PIN}, BankL298 = { 3, 2, 4,NO_PIN};
+  const Pins RefWth  = {19,17,18, 9},     BankWth  = {12,14,15,10};
+
+  bool same(const Pins &a, const Pins &b)
+  {
+    if ((sim::pinPWM(a.en) != sim::pinPWM(b.en)) ||
+        (sim::pinDigital(a.in1) != sim::pinDigital(b.in1)) ||
+        (sim::pinDigital(a.in2) != sim::pinDigital(b.in2))) return(false);
+    return((a.pwm == NO_PIN) || (sim::pinPWM(a.pwm) == sim::pinPWM(b.pwm)));
+  }
+
+  // random commands for ms, every 1 ms update.  ms of pin mismatch
+  unsigned long compare(float accel, float decel, unsigned long ms)
+  {
+    sim::reset();
+    L298Drive<> RefA(0.5f);
+    WTH3615DDrive<> RefB(0.5f);
+    MotorBank<2> Bank(0.5f);
+    RefA.begin(RefL298.en,RefL298.in1,RefL298.in2);
+    RefB.begin(RefWth.en,RefWth.in1,RefWth.in2,RefWth.pwm);
+    Bank.setPins(0,BankL298.en,BankL298.in1,BankL298.in2);
+    Bank.setPins(1,BankWth.en,BankWth.in1,BankWth.in2,BankWth.pwm);
+    Bank.begin();
+    if ((accel > 0) || (decel > 0))
+      {
+        RefA.setRampRates(accel,decel);
+        RefB.setRampRates(accel,decel);
+        Bank.setRampRates(accel,decel);
+      }
+
+    unsigned long bad = 0, next = 0;
+    for (unsigned long k=0; k < ms; k++)
+      {
+        sim::advance(1000);
+        unsigned long t = millis();
+        if (k >= next)
+          {
+            int r = rand() % 20;
+            int a = rand() % 511 - 255, b = rand() % 511 - 255;
+            if (r == 0)
+              {
+                RefA.emergencyStop();
+                RefB.emergencyStop();
+                Bank.emergencyStop(Bank.ALL);
+              }
+            else
+              {
+                if (r < 4) a = b = 0;
+                RefA.setSpeed(a,t);
+                RefB.setSpeed(b,t);
+                Bank.setSpeed(1,a,t);
+                Bank.setSpeed(2,b,t);
+              }
+            // mostly app rate, sometimes quiet long enough for the deadman
+            next = k + ((rand() % 10) ? 20 + rand() % 200 : 400 + rand() % 1000);
+          }
+        else
+          {
+            RefA.update(t);
+            RefB.update(t);
+            Bank.update(t);
+          }
+        if (!same(RefL298,BankL298) || !same(RefWth,BankWth)) bad++;
+      }
+    return(bad);
+  }
+
+  // bank alone, from just before the millis() wrap
+  bool acrossWrap()
+  {
+    sim::reset();
+    sim::setTime(((uint64_t)1 << 32) * 1000 - 10000000);  // 10 s before
+    MotorBank<1> B(0.5f);
+    B.setPins(0,BankL298.en,BankL298.in1,BankL298.in2);
+    B.begin();
+    bool ok = true;
+    for (unsigned long k=0; k < 20000; k++)
+      {  // drive from 5 s in, through the wrap
+        sim::advance(1000);
+        unsigned long t = millis();
+        if ((k >= 5000) && ((k % 100) == 0)) B.setSpeed(1,120,t);
+        else B.update(t);
+        if ((k > 5100) && (sim::pinPWM(BankL298.en) != 120)) ok = false;
+      }
+    // quiet for over a minute, so the 16 bit deadline wraps around
+    for (unsigned long k=0; k < 70000; k++)
+      {
+        sim::advance(1000);
+        B.update(millis());
+      }
+    ok = ok && (B._mode[0] == MOTOR_STOPPED) && (sim::pinPWM(BankL298.en) == 255);
+    B.setSpeed(1,80,millis());
+    return(ok && (B._mode[0] == MOTOR_START_FWD));
+  }
+
+  // drain() after bytes arrive
+  CommandBatch send(CommandReader &r, const uint8_t *buf, size_t n)
+  {
+    sim::rx(buf,n);
+    sim::advance(n * sim::byteTime() + 1);
+    CommandBatch b;
+    r.drain(b);
+    return(b);
+  }
+  CommandBatch send(CommandReader &r, const char *s)
+  {
+    return(send(r,(const uint8_t *)s,strlen(s)));
+  }
+
+  // TankDrive.ino's 6 channel L298 pins: each side shares IN1, IN2
+  const byte Pins6[6][3] = { {11, 7, 8}, {10, 7, 8}, { 9, 7, 8},  { 3, 2, 4}, { 5, 2, 4}, { 6, 2, 4} };
+
+  void sharedPins()
+  {
+    sim::reset();
+    MotorBank<6> B(0.5f);
+    for (byte k=0; k < 6; k++) B.setPins(k,Pins6[k][0],Pins6[k][1],Pins6[k][2]);
+    B.begin();
+    sim::advance(3100000);  // out of begin()'s emergency stop
+    B.update(millis());
+    check((B._link[0] == 0x07) && (B._link[4] == 0x38), "channels sharing pins found: 0x07, 0x38");
+
+    B.setSpeed(0x01,120,millis());
+    bool side = true;
+    for (byte k=0; k < 3; k++)
+      side = side && (B._mode[k] == MOTOR_START_FWD) && (B._speedCmd[k] == 120);
+    check(side && (B._mode[3] == MOTOR_STOPPED), "a command to channel 0 goes to its side only, all of it");
+
+    int spd[6] = { -80, 200, 40, 0, 0, 0 };
+    sim::advance(100000);
+    B.setSpeeds(0x06,spd,millis());  // 1 and 2, not 0
+    side = true;
+    for (byte k=0; k < 3; k++) side = side && (B._speedCmd[k] == 200);
+    check(side, "  setSpeeds() within a side: the lowest channel's speed for all of it");
+
+    unsigned long t0 = millis(), off[3] = { 0, 0, 0 };
+    for (unsigned long ms=0; ms < 2000; ms++)
+      {
+        sim::advance(1000);
+        B.update(millis());
+        for (byte k=0; k < 3; k++)
+          if (!off[k] && (B._mode[k] == MOTOR_STOPPING)) off[k] = millis() - t0;
+      }
+    char what[100];
+    snprintf(what,sizeof(what),"  deadman stops the side together: %lu, %lu, %lu ms",
+             off[0], off[1], off[2]);
+    check(off[0] && (off[0] == off[1]) && (off[1] == off[2]), what);
+  }
+
+  void trip()
+  {
+    sim::reset();
+    MotorBank<6> B(0.5f);
+    for (byte k=0; k < 6; k++) B.setPins(k,Pins6[k][0],Pins6[k][1],Pins6[k][2]);
+    B.begin();
+    sim::advance(3100000);
+    for (int ms=0; ms < 100; ms++)
+      {
+        sim::advance(1000);
+        if ((ms % 20) == 0) B.setSpeed(B.ALL,150,millis());
+        else B.update(millis());
+      }
+    bool running = (B._mode[0] == MOTOR_FWD) && (B._mode[3] == MOTOR_FWD);
+    B.trip(0x02);  // as an interrupt would
+    bool braked = sim::pinDigital(11) && sim::pinDigital(10) && sim::pinDigital(9) &&
+                  !sim::pinDigital(7) && !sim::pinDigital(8) && (sim::pinPWM(3) == 150);
+    check(running && braked, "trip() brakes the tripped channel's side at once");
+    B.setSpeed(B.ALL,150,millis());
+    check((B._mode[1] == MOTOR_STOPPING) && (B._mode[4] == MOTOR_FWD) && !B._tripped[1],
+          "  emergency stop on the next command, the other side runs on");
+  }
+
+  void groups()
+  {
+    sim::reset();
+    Serial.begin(57600);
+    CommandReader r;
+    r.begin();
+    r.groupL = 0x03;
+    r.groupR = 0x0C;
+    CommandBatch b = send(r,"L100,R-50\n");
+    check((b.newSpeed == 0x0F) && (b.speed[0] == 100) && (b.speed[1] == 100) &&
+          (b.speed[2] == -50) && (b.speed[3] == -50), "'L'/'R' set each side's channels");
+    b = send(r,"M5,V-120\nM2,V30\n");
+    check((b.newSpeed == 0x07) && (b.speed[0] == -120) && (b.speed[2] == -120) &&
+          (b.speed[1] == 30), "M<mask>,V<speed> set the channels in mask");
+    b = send(r,"L10,M1,V20\n");
+    check((b.newSpeed == 0x03) && (b.speed[0] == 20) && (b.speed[1] == 10),
+          "  newest command per channel wins");
+    uint8_t f[COMMAND_FRAME_LEN];
+    commandEncodeGroup(f,0x30,-200);
+    b = send(r,f,sizeof(f));
+    check((b.newSpeed == 0x30) && (b.speed[4] == -200) && (b.speed[5] == -200) &&
+          (r.group == 0x30), "group frame: mask 0x30, speed -200");
+  }
+}
+
+int main()
+{
+  srand(1);
+  char what[120];
+  unsigned long bad = compare(0,0,120000);
+  snprintf(what,sizeof(what),"L298 and WTH3615D channels match the drivers: %lu of 120000 ms differ",bad);
+  check(bad == 0, what);
+  bad = compare(0.5f,1.0f,120000);
+  snprintf(what,sizeof(what),"  with ramps: %lu of 120000 ms differ",bad);
+  check(bad == 0, what);
+  bad = compare(0,0.5f,120000);
+  snprintf(what,sizeof(what),"  with a decel-only ramp: %lu of 120000 ms differ",bad);
+  check(bad == 0, what);
+
+  check(acrossWrap(), "bank runs across the millis() wrap, and starts after a long idle");
+  groups();
+  sharedPins();
+  trip();
+
+  // SRAM
+  typedef MotorBank<6> Bank6;
+  unsigned shared = sizeof(MotorBank<1>) - Bank6::CHANNEL_BYTES;
+  snprintf(what,sizeof(what),"SRAM per channel %u bytes (driver object %u), %u shared (host, padded); 6 channels %u bytes (drivers %u)",
+           (unsigned)Bank6::CHANNEL_BYTES, DriveAvrBytes, shared,
+           (unsigned)sizeof(Bank6), 6 * DriveAvrBytes);
+  check((Bank6::CHANNEL_BYTES * 2 <= DriveAvrBytes) &&
+        (sizeof(Bank6) <= 6 * Bank6::CHANNEL_BYTES + shared + 1), what);
+
+  // one batched pass, against one update() per driver object
+  sim::reset();
+  Bank6 B(0.5f);
+  L298Drive<> D[6];
+  for (byte k=0; k < 6; k++)
+    {
+      B.setPins(k,3,2,4);
+      D[k].begin(11,7,8);
+    }
+  B.begin();
+  const int nRun = 200000;
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  for (int k=0; k < nRun; k++) B.update(k);
+  double nsBank = std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now() - t0).count() / nRun;
+  t0 = std::chrono::steady_clock::now();
+  for (int k=0; k < nRun; k++)
+    for (byte c=0; c < 6; c++) D[c].update(k);
+  double nsDrv = std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now() - t0).count() / nRun;
+  printf("6 channel update : %.1f ns/pass (bank), %.1f ns (6 drivers, host)\n", nsBank, nsDrv);
+  return(nFail ? 1 : 0);
+}
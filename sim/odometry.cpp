@@ -0,0 +1,194 @@
+/*
+Check on-board dead reckoning (ODOMETRY, see ../Odometry.h) against
+the vehicle pose of the plant model in Plant.h, whose encoder edges
+run the firmware's pin change ISR.
+
+  - the table sin and cos are within a few Q15 counts over the turn
+  - on a course of straights, spins and arcs, the pose from the
+    encoders stays within a few mm and a fraction of a degree of the
+    plant's.  The same integration fed the driven speeds instead, as
+    the sketch does with no encoders, drifts far more
+  - pose frames come out at the default rate, "O<ms>" changes it and
+    "O0" stops them, the last frame matches the pose, and teldecode
+    reads them
+  - 'o' resets the pose to the origin
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#define ENCODERS
+#define ODOMETRY
+#include "Sketch.h"
+#include "Plant.h"
+#include "TelemetryDecode.h"
+#include "Check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+
+namespace
+{
+  sim::TankPlant Plant;
+  Odometry Open;  // from the driven speeds, as with no encoders
+
+  // loop() passes of 100 us, with an app command every 20 ms while sending.
+  // Open is fed MotL and MotR every 10 ms, as the sketch's odometryTask
+  void run(uint64_t untilUs, const char *cmd)
+  {
+    while (sim::now() < untilUs)
+      {
+        if (cmd && (sim::now() % 20000 == 0)) sim::rx(cmd);
+        if (sim::now() % 10000 == 0) Open.addSpeeds(MotL.driveSpeed(),MotR.driveSpeed(),millis());
+        loop();
+        sim::advance(100);
+      }
+  }
+
+  // worst table error, Q15 counts, over every binary angle
+  int trigError()
+  {
+    int worst = 0;
+    for (long a=0; a < 65536; a++)
+      {
+        double r = a * (2 * M_PI / 65536);
+        int es = abs(odometrySin(a) - (int)lround(32767 * sin(r)));
+        int ec = abs(odometryCos(a) - (int)lround(32767 * cos(r)));
+        if (es > worst) worst = es;
+        if (ec > worst) worst = ec;
+      }
+    return(worst);
+  }
+
+  // heading difference, degrees, -180..180
+  double headingError(unsigned short h, double theta)
+  {
+    double e = h * (360.0 / 65536) - theta * (180 / M_PI);
+    e = fmod(e,360);
+    if (e > 180) e -= 360;
+    if (e < -180) e += 360;
+    return(e);
+  }
+
+  struct Pose { unsigned t; long x, y; unsigned short h; };
+
+  // pose frames in the TX stream since from.  Records are skipped whole
+  std::vector<Pose> frames(size_t from)
+  {
+    std::vector<Pose> f;
+    const std::string &tx = sim::tx();
+    size_t i = from;
+    while (i < tx.size())
+      {
+        const uint8_t *r = (const uint8_t *)tx.data() + i;
+        if ((r[0] == TELEMETRY_SYNC) && (i + TELEMETRY_RECORD_LEN <= tx.size()))
+          {
+            i += TELEMETRY_RECORD_LEN;
+            continue;
+          }
+        if ((r[0] == TELEMETRY_POSE_SYNC) && (i + TELEMETRY_POSE_LEN <= tx.size()))
+          {
+            Pose p;
+            p.t = r[1] | (r[2] << 8);
+            p.x = (int32_t)((r[3] << 8) | (r[4] << 16) | ((uint32_t)r[5] << 24)) >> 8;
+            p.y = (int32_t)((r[6] << 8) | (r[7] << 16) | ((uint32_t)r[8] << 24)) >> 8;
+            p.h = r[9] | (r[10] << 8);
+            f.push_back(p);
+            i += TELEMETRY_POSE_LEN;
+            continue;
+          }
+        i++;
+      }
+    return(f);
+  }
+
+  // mean ms between frames
+  double period(const std::vector<Pose> &f)
+  {
+    if (f.size() < 2) return(0);
+    return((unsigned short)(f.back().t - f.front().t) / (double)(f.size() - 1));
+  }
+}
+
+int main()
+{
+  char what[160];
+  int e = trigError();
+  snprintf(what,sizeof(what),"table sin, cos within %d Q15 counts over the turn",e);
+  check(e <= 3,what);
+
+  sim::reset();
+  setup();
+  Plant.attach(sim::sketchPinsL(sim::BRIDGE_WTH3615D),sim::sketchPinsR(sim::BRIDGE_WTH3615D),sim::MotorParams());
+  Open.begin(0.0033f,ODOMETRY_TRACK_MM,0);  // the sketch's open loop default
+  run(4000000,0);  // power-on emergency stop
+  Odo.reset();
+  Open.reset();
+  Plant.x = Plant.y = Plant.theta = Plant.odometer = 0;
+
+  // course: straight, spin, arc, reverse arc, straight
+  struct Leg { const char *cmd; uint32_t ms; };
+  const Leg Course[] = {
+    {"L100,R100\n",2000}, {"L-60,R60\n",1500}, {"L140,R70\n",3000},
+    {"L-50,R-110\n",2000}, {"L30,R30\n",1500}, {0,1000} };
+  size_t tx0 = sim::tx().size();
+  for (const Leg &l : Course) run(sim::now() + l.ms * 1000ULL,l.cmd);
+
+  double ex = Odo.x() - Plant.x * 1000, ey = Odo.y() - Plant.y * 1000;
+  double ePos = sqrt(ex*ex + ey*ey), eH = headingError(Odo.heading(),Plant.theta);
+  double ox = Open.x() - Plant.x * 1000, oy = Open.y() - Plant.y * 1000;
+  double oPos = sqrt(ox*ox + oy*oy), oH = headingError(Open.heading(),Plant.theta);
+  printf("plant at (%.0f, %.0f) mm, heading %.1f deg, after %.0f mm\n",
+         Plant.x * 1000, Plant.y * 1000, Plant.theta * 180 / M_PI, Plant.odometer * 1000);
+  printf("  encoders     : (%ld, %ld), %.1f deg\n", Odo.x(), Odo.y(), Odo.heading() * 360.0 / 65536);
+  printf("  driven speeds: (%ld, %ld), %.1f deg\n", Open.x(), Open.y(), Open.heading() * 360.0 / 65536);
+  snprintf(what,sizeof(what),"encoder pose within %.1f mm and %.2f deg of the plant (driven speeds: %.0f mm, %.1f deg)",
+           ePos, fabs(eH), oPos, fabs(oH));
+  check((ePos < 0.005 * Plant.odometer * 1000) && (fabs(eH) < 0.5) && (oPos > 5 * ePos), what);
+
+  // frames, at the default rate
+  std::vector<Pose> f = frames(tx0);
+  double p = period(f);
+  snprintf(what,sizeof(what),"%u pose frames, every %.1f ms (%d ms)",(unsigned)f.size(),p,ODOMETRY_FRAME_MS);
+  check((f.size() > 100) && (fabs(p - ODOMETRY_FRAME_MS) < 1), what);
+  check(!f.empty() && (f.back().x == Odo.x()) && (f.back().y == Odo.y()) && (f.back().h == Odo.heading()),
+        "last frame is the pose, once stopped");
+  check(telemetryDecode(sim::tx().substr(tx0)).find(" pose ") != std::string::npos,
+        "teldecode reads pose frames");
+
+  sim::rx("O20\n");
+  run(sim::now() + 5000,0);
+  tx0 = sim::tx().size();
+  run(sim::now() + 1000000,"L60,R60\n");
+  p = period(frames(tx0));
+  snprintf(what,sizeof(what),"\"O20\": a frame every %.1f ms, driving",p);
+  check(fabs(p - 20) < 0.5, what);
+  sim::rx("O0\n");
+  run(sim::now() + 5000,0);
+  tx0 = sim::tx().size();
+  run(sim::now() + 1000000,0);
+  check(frames(tx0).empty(), "\"O0\": no frames");
+
+  // reset
+  sim::rx("O100\n");
+  run(sim::now() + 1000000,0);  // stopped
+  tx0 = sim::tx().size();
+  sim::rx("o\n");
+  run(sim::now() + 50000,0);
+  f = frames(tx0);
+  check((Odo.x() == 0) && (Odo.y() == 0) && (Odo.heading() == 0) &&
+        !f.empty() && (f[0].x == 0) && (f[0].y == 0) && (f[0].h == 0),
+        "'o' resets the pose, and sends it at once");
+
+  // cost, for the record.  Host only: the AVR has no FPU, so float trig
+  // there is soft-float library code, and this is a few integer multiplies
+  Plant.detach();
+  const int n = 1000000;
+  std::chrono::steady_clock::time_point c0 = std::chrono::steady_clock::now();
+  for (int k=0; k < n; k++) Odo.add(20 + (k & 7),20 - (k & 3));
+  double ns = std::chrono::duration<double>(std::chrono::steady_clock::now() - c0).count() * 1e9 / n;
+  printf("pose update : %.1f ns/call (host)\n", ns);
+  return(nFail ? 1 : 0);
+}
@@ -0,0 +1,177 @@
+/*
+Batch runs of the sketch against the tank plant model (Plant.h), over a
+command script and a grid of driver parameters: start-up pulse
+(_startupTime), decel rate (_decel) and deadman timeout (_deadTime).
+
+    plant_sweep [script]
+
+A script line is
+
+    <ms> [<to ms>] <command>
+
+sending <command> and a newline at <ms>, or every 20 ms, like the app,
+from <ms> up to <to ms>.  '#' starts a comment.  Without a script a
+built-in one drives forward, reverses, spins and stops, then goes
+quiet so the deadman trips.
+
+For each run, prints distance driven, final pose, peak motor current,
+and how far the robot went after the last command.  The last line is
+the speed of the whole sweep, as a multiple of real time.
+
+provided under LGPL license
+*/
+#include "Sketch.h"
+#include "Plant.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+namespace
+{
+  struct Step
+  {
+    uint32_t from, to;  // ms.  to == from for a single send
+    std::string cmd;
+  };
+
+  const char *BuiltIn =
+    "# forward, reverse, spin on the spot, stop, then the app goes quiet\n"
+    "0    1000 L150,R150\n"
+    "1000 2000 L-150,R-150\n"
+    "2000 3000 L120,R-120\n"
+    "3000 3500 L0,R0\n"
+    "3500 4000 L200,R200\n";
+
+  bool parse(const char *text, std::vector<Step> &steps)
+  {
+    const char *p = text;
+    int line = 0;
+    while (*p)
+      {
+        const char *eol = strchr(p,'\n');
+        std::string s(p, eol ? eol - p : strlen(p));
+        p = eol ? eol + 1 : p + s.size();
+        line++;
+        size_t hash = s.find('#');
+        if (hash != std::string::npos) s.erase(hash);
+        if (s.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+        Step st;
+        char *end;
+        st.from = st.to = strtoul(s.c_str(),&end,10);
+        if (end == s.c_str())
+          {
+            fprintf(stderr,"script line %d: no time\n",line);
+            return(false);
+          }
+        char *next;
+        unsigned long to = strtoul(end,&next,10);
+        if (next != end)
+          {
+            st.to = to;
+            end = next;
+          }
+        while (*end == ' ' || *end == '\t') end++;
+        st.cmd = end;
+        while (!st.cmd.empty() && (st.cmd.back() == '\r' || st.cmd.back() == ' ')) st.cmd.pop_back();
+        st.cmd += '\n';
+        steps.push_back(st);
+      }
+    return(true);
+  }
+
+  struct Result
+  {
+    double distance, x, y, heading, peakI, after;
+  };
+
+  // run the script, then 2 s more with no commands
+  Result run(const std::vector<Step> &steps, int startupMs, float decel, int deadMs)
+  {
+    sim::reset();
+    setup();
+    MotL.setStartPulseDuration(startupMs);
+    MotR.setStartPulseDuration(startupMs);
+    MotL.setDecelRate(decel);
+    MotR.setDecelRate(decel);
+    MotL.setCommandTimeout(deadMs);
+    MotR.setCommandTimeout(deadMs);
+
+    sim::TankPlant plant;
+    sim::MotorParams mp;
+    plant.attach(sim::sketchPinsL(sim::BRIDGE_WTH3615D),sim::sketchPinsR(sim::BRIDGE_WTH3615D),mp);
+    sim::runLoop(sim::now() + 4000000,100);  // wait out the power-on emergency stop
+    uint64_t t0 = sim::now();
+
+    uint32_t last = 0;
+    for (size_t k=0; k < steps.size(); k++)
+      if (steps[k].to > last) last = steps[k].to;
+
+    double odoLast = 0;
+    for (uint32_t ms=0; ms <= last + 2000; ms++)
+      {
+        for (size_t k=0; k < steps.size(); k++)
+          {
+            const Step &s = steps[k];
+            if ((ms == s.from) || ((ms > s.from) && (ms <= s.to) && ((ms - s.from) % 20 == 0)))
+              sim::rx(s.cmd.c_str());
+          }
+        if (ms == last) odoLast = plant.odometer;
+        sim::runLoop(t0 + (uint64_t)(ms + 1) * 1000,100);
+      }
+
+    plant.detach();
+    Result r;
+    r.distance = plant.odometer;
+    r.x = plant.x;
+    r.y = plant.y;
+    r.heading = plant.theta * 180 / M_PI;
+    r.peakI = (plant.left.peakI > plant.right.peakI) ? plant.left.peakI : plant.right.peakI;
+    r.after = plant.odometer - odoLast;
+    return(r);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::string text = BuiltIn;
+  if (argc > 1)
+    {
+      FILE *f = fopen(argv[1],"r");
+      if (!f)
+        {
+          perror(argv[1]);
+          return(1);
+        }
+      text.clear();
+      char buf[256];
+      while (fgets(buf,sizeof(buf),f)) text += buf;
+      fclose(f);
+    }
+  std::vector<Step> steps;
+  if (!parse(text.c_str(),steps)) return(1);
+
+  static const int   Startup[] = { 0, 25, 50, 100 };
+  static const float Decel[]   = { 0.25f, 0.5f, 1.0f, 2.0f };
+  static const int   Dead[]    = { 250, 500 };
+
+  printf("startup  decel  deadman : distance      x      y  heading  peak I  after last cmd\n");
+  printf("     ms  ms/ct       ms :        m      m      m      deg       A               m\n");
+  double simSeconds = 0;
+  std::chrono::steady_clock::time_point c0 = std::chrono::steady_clock::now();
+  for (int a=0; a < 4; a++)
+    for (int b=0; b < 4; b++)
+      for (int c=0; c < 2; c++)
+        {
+          Result r = run(steps,Startup[a],Decel[b],Dead[c]);
+          simSeconds += sim::now() * 1e-6;
+          printf("%7d  %5.2f  %7d : %8.3f %6.3f %6.3f %8.1f %7.2f %15.3f\n",
+                 Startup[a], Decel[b], Dead[c],
+                 r.distance, r.x, r.y, r.heading, r.peakI, r.after);
+        }
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - c0).count();
+  printf("%.0f s simulated in %.2f s : %.0fx real time\n", simSeconds, wall, simSeconds / wall);
+  return(0);
+}
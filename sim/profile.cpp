@@ -0,0 +1,105 @@
+/*
+Profile build of the sketch (PROFILE defined, see ../Profile.h).
+
+Runs an app-style command stream with a slow loop() pass now and then,
+prints the loop time and command latency histograms, then asks for a
+dump with '?' and checks that the telemetry records sent match them.
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#define PROFILE
+#include "Sketch.h"
+#include "Check.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+  const char *Names[PROFILE_HISTOGRAMS] = { "loop", "latency L", "latency R" };
+
+  void show(int h)
+  {
+    const Histogram &g = Prof.hist[h];
+    printf("%-10s: %7lu samples, max %6lu us\n", Names[h], g.count, g.max);
+    for (int k=0; k < PROFILE_BINS; k++)
+      {
+        if (!g.bin[k]) continue;
+        unsigned long lo = k ? 1UL << (k-1) : 0;
+        printf("    %6lu%s us : %u\n", lo, (k == PROFILE_BINS-1) ? "+" : " ", g.bin[k]);
+      }
+  }
+
+  // Histogram rebuilt from the dump records
+  struct Dumped
+  {
+    unsigned count, max, bin[PROFILE_BINS];
+  };
+
+  void parse(const std::string &tx, Dumped *d)
+  {
+    memset(d,0,sizeof(Dumped)*PROFILE_HISTOGRAMS);
+    for (size_t i=0; i + TELEMETRY_RECORD_LEN <= tx.size(); i++)
+      {
+        const uint8_t *r = (const uint8_t *)tx.data() + i;
+        if (r[0] != TELEMETRY_SYNC) continue;
+        unsigned v = r[5] | (r[6] << 8);
+        switch(r[1])
+          {
+          case TEL_PROF_COUNT: d[r[2]].count = v; break;
+          case TEL_PROF_MAX:   d[r[2]].max = v;   break;
+          case TEL_PROF_BIN:   d[r[2] >> 5].bin[r[2] & 31] = v; break;
+          default: continue;
+          }
+        i += TELEMETRY_RECORD_LEN - 1;
+      }
+  }
+}
+
+int main()
+{
+  sim::reset();
+  setup();
+  sim::runLoop(sim::now() + 4000000,100);  // wait out the power-on emergency stop
+
+  char buf[32];
+  for (int k=0; k < 500; k++)
+    {
+      snprintf(buf,sizeof(buf),"L%d,R%d\n",100 + k % 50,-100 - k % 50);
+      sim::rx(buf);
+      uint64_t until = sim::now() + 20000;
+      if (k % 50 == 0)
+        {  // a slow pass, as if blocked
+          loop();
+          sim::advance(6000);
+        }
+      sim::runLoop(until,150);
+    }
+
+  for (int h=0; h < PROFILE_HISTOGRAMS; h++) show(h);
+
+  Histogram snap[PROFILE_HISTOGRAMS];
+  memcpy(snap,Prof.hist,sizeof(snap));
+  size_t tx0 = sim::tx().size();
+  sim::rx("?");
+  sim::runLoop(sim::now() + 200000,150);  // no commands: motors stop, but loop() runs
+  check(Prof._dump == PROFILE_IDLE, "dump finished");
+
+  Dumped d[PROFILE_HISTOGRAMS];
+  parse(sim::tx().substr(tx0),d);
+  bool same = true;
+  for (int h=0; h < PROFILE_HISTOGRAMS; h++)
+    {
+      if (h == PROFILE_LOOP) continue;  // still counting while the dump is sent
+      same = same && (d[h].count == snap[h].count) && (d[h].max == snap[h].max);
+      for (int k=0; k < PROFILE_BINS; k++) same = same && (d[h].bin[k] == snap[h].bin[k]);
+    }
+  check(same, "dumped latency histograms match");
+  check(d[PROFILE_LOOP].count == ((snap[PROFILE_LOOP].count > 0xffff) ? 0xffff : snap[PROFILE_LOOP].count),
+        "  loop histogram dumped");
+  check(snap[PROFILE_LATENCY_L].count == 500, "  one latency sample per command");
+  check(snap[PROFILE_LOOP].max >= 6000, "  slow pass seen in loop max");
+  check(Tel.dropped == 0, "no telemetry dropped");
+  return(nFail ? 1 : 0);
+}
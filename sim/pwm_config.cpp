@@ -0,0 +1,123 @@
+/*
+Check the PWM frequency and resolution API (../Pwm.h) against the mock
+timer registers.
+
+  - Timer0 pins, pins without PWM, and more than 8 bits on Timer2 are
+    refused, leaving the registers as they were
+  - 10 bits on Timer1 sets phase correct PWM with TOP in ICR1, at the
+    asked for frequency; a frequency too high for 10 bits is refused
+  - Q7 duty comes out at the pin's full resolution: full scale is full
+    on, half is half, and a slow ramp on a 10 bit pin moves in steps
+    finer than 1/255
+  - an L298 drive with its EN on pin 9 ramps through the 10 bit pin,
+    and the default 8 bit drive is unchanged (see the golden traces)
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#include "Arduino.h"
+#include "../MotorDrive298.h"
+#include "Check.h"
+#include <stdio.h>
+#include <math.h>
+
+// no sketch here, just a motor
+void setup() {}
+void loop() {}
+
+namespace
+{
+  bool near(double a, double b, double tol) { return(fabs(a - b) <= tol); }
+}
+
+int main()
+{
+  char what[120];
+  sim::reset();
+
+  uint8_t b0 = TCCR0B, b2 = TCCR2B, b1 = TCCR1B;
+  check(pwmConfigure(5,7800,8) == PWM_TIMER0, "pin 5 (Timer0, millis()) refused");
+  check(pwmConfigure(7,7800,8) == PWM_NO_TIMER, "pin 7 (no PWM) refused");
+  check(pwmConfigure(11,7800,10) == PWM_BITS, "10 bits on pin 11 (Timer2) refused");
+  check(pwmConfigure(11,5,8) == PWM_FREQ, "5 Hz on Timer2 refused");
+  check(pwmConfigure(9,7800,17) == PWM_BITS, "17 bits on Timer1 refused");
+  check((TCCR0B == b0) && (TCCR2B == b2) && (TCCR1B == b1), "  registers untouched");
+
+  check(pwmConfigure(3,31372,8) == PWM_OK, "31.4 kHz, 8 bits on pin 3 (Timer2)");
+  snprintf(what,sizeof(what),"  Timer2 at %.0f Hz",sim::timerHz(2));
+  check(near(sim::timerHz(2),31372,50), what);
+
+  L298Drive<> M(0.5f);
+  M.begin(9,7,8);
+  check(M.setPwm(20000,10) == PWM_FREQ, "20 kHz at 10 bits on pin 9 refused (400 steps)");
+  check(TCCR1B == b1, "  Timer1 untouched");
+  check(M.setPwm(7800,10) == PWM_OK, "7.8 kHz, 10 bits on pin 9 (Timer1)");
+  snprintf(what,sizeof(what),"  ICR1 %u, mode 10, clk/1, Timer1 at %.0f Hz",
+           (unsigned)ICR1, sim::timerHz(1));
+  check((ICR1 == F_CPU / 2 / 7800) &&
+        ((TCCR1A & (_BV(WGM11) | _BV(WGM10))) == _BV(WGM11)) &&
+        (TCCR1B == (_BV(WGM13) | _BV(CS10))) &&
+        near(sim::timerHz(1),7800,10), what);
+
+  // duty scaling
+  pwmWrite(9,PWM_Q7_FULL);
+  check(sim::pinDuty(9) == 1.0, "full scale is full on");
+  pwmWrite(9,PWM_Q7_FULL / 2);
+  snprintf(what,sizeof(what),"half scale, duty %.4f",sim::pinDuty(9));
+  check(near(sim::pinDuty(9),0.5,1.0 / ICR1), what);
+  pwmWrite(9,64);
+  snprintf(what,sizeof(what),"half a count, duty %.5f (8 bit step %.5f)",sim::pinDuty(9),1 / 255.0);
+  check((sim::pinDuty(9) > 0) && (sim::pinDuty(9) < 1 / 255.0), what);
+  pwmWrite(9,0);
+  check(sim::pinDuty(9) == 0, "zero is off");
+
+  // a slow ramp through the 10 bit pin
+  M.setStartPulseDuration(0);
+  M.setRampRates(0.02f,0.02f);
+  sim::advance(4000000);  // out of begin()'s emergency stop
+  M.update(millis());
+  M.setSpeed(40,millis());
+  double last = -1, step = 1;
+  int nStep = 0;
+  for (int ms=0; ms < 2500; ms++)
+    {
+      sim::advance(1000);
+      if ((ms % 100) == 0) M.setSpeed(40,millis());  // ahead of the deadman
+      else M.update(millis());
+      double d = sim::pinDuty(9);
+      if ((d > 0) && (last > 0) && (d != last))
+        {
+          if (d - last < step) step = d - last;
+          nStep++;
+        }
+      last = d;
+    }
+  snprintf(what,sizeof(what),"ramp to 40 in %d steps, smallest %.5f (8 bit step %.5f), ends at %.4f",
+           nStep, step, 1 / 255.0, last);
+  check((nStep > 40 * 2) && (step < 1 / 255.0) && near(last,40 / 255.0,1.0 / ICR1), what);
+
+  // the same ramp at 8 bits moves whole counts
+  sim::reset();
+  L298Drive<> M8(0.5f);
+  M8.begin(9,7,8);
+  M8.setStartPulseDuration(0);
+  M8.setRampRates(0.02f,0.02f);
+  sim::advance(4000000);
+  M8.update(millis());
+  M8.setSpeed(40,millis());
+  last = -1;
+  nStep = 0;
+  for (int ms=0; ms < 2500; ms++)
+    {
+      sim::advance(1000);
+      if ((ms % 100) == 0) M8.setSpeed(40,millis());  // ahead of the deadman
+      else M8.update(millis());
+      double d = sim::pinDuty(9);
+      if ((d > 0) && (last > 0) && (d != last)) nStep++;
+      last = d;
+    }
+  snprintf(what,sizeof(what),"8 bit default: ramp to 40 in %d whole count steps",nStep);
+  check((nStep < 40) && near(last,40 / 255.0,1e-9), what);
+  return(nFail ? 1 : 0);
+}
@@ -0,0 +1,84 @@
+/*
+Check the ramp rates of MotorDriveCore (setRampRates()).
+
+  - a decel-only ramp, (0, d), slows to a stop at d counts/ms before
+    it brakes, and still speeds up at once
+  - an accel-only ramp, (a, 0), ramps up, and slows at once
+  - ramps turned on while the motor runs start from the speed it is
+    driven at, with no jump
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#include "Sketch.h"
+#include "Check.h"
+#include <stdio.h>
+
+namespace
+{
+  // MotL at spd for ms, updated every ms, commanded every 20 ms as the
+  // app does.  lowest and highest _speed on the way, while not braking
+  void drive(int spd, unsigned long ms, int *lo=0, int *hi=0)
+  {
+    if (lo) *lo = 1000;
+    if (hi) *hi = -1000;
+    for (unsigned long k=0; k < ms; k++)
+      {
+        sim::advance(1000);
+        if (k % 20 == 0) MotL.setSpeed(spd);
+        MotL.update(millis());
+        if (MotL._mode == MOTOR_STOPPING) continue;
+        if (lo && (MotL._speed < *lo)) *lo = MotL._speed;
+        if (hi && (MotL._speed > *hi)) *hi = MotL._speed;
+      }
+  }
+
+  void start(float accel, float decel)
+  {
+    sim::reset();
+    setup();
+    sim::setTime(4000000);  // past the power-on emergency stop
+    MotL.setRampRates(accel,decel);
+  }
+}
+
+int main()
+{
+  char what[120];
+  int lo, hi;
+
+  // decel only
+  start(0,1);
+  drive(200,200);
+  bool up = (MotL._mode == MOTOR_FWD) && (MotL._speed == 200);
+  drive(0,100,&lo,&hi);
+  snprintf(what,sizeof(what),"(0, 1): after 100 ms of 0, speed %d, not braked", MotL._speed);
+  check(up && (MotL._mode == MOTOR_FWD) && (MotL._speed >= 99) && (MotL._speed <= 101), what);
+  drive(0,150);
+  check((MotL._mode == MOTOR_STOPPING) || (MotL._mode == MOTOR_STOPPED), "  then braked, at the bottom");
+  drive(0,500);
+  drive(150,100);
+  drive(250,2,&lo,&hi);
+  snprintf(what,sizeof(what),"  speeds up at once: 150 -> %d", hi);
+  check(hi == 250, what);
+
+  // accel only
+  start(1,0);
+  drive(200,100);
+  snprintf(what,sizeof(what),"(1, 0): ramps up, %d after 100 ms", MotL._speed);
+  check((MotL._mode == MOTOR_FWD) && (MotL._speed > 50) && (MotL._speed < 200), what);
+  drive(200,300);
+  drive(40,2);
+  snprintf(what,sizeof(what),"  slows at once: 200 -> %d", MotL._speed);
+  check(MotL._speed == 40, what);
+
+  // turned on while running
+  start(0,0);
+  drive(200,100);
+  MotL.setRampRates(1,1);
+  drive(100,10,&lo,&hi);
+  snprintf(what,sizeof(what),"ramps turned on at 200: 10 ms toward 100 stays in %d..%d", lo, hi);
+  check((lo >= 189) && (hi <= 200) && (MotL._mode == MOTOR_FWD), what);
+  return(nFail ? 1 : 0);
+}
@@ -0,0 +1,195 @@
+/*
+Replay a serial capture (see Capture.h) through the sketch, and check
+the pin writes it makes against a golden trace.
+
+    replay [-l us] [-o trace] [-u] capture [golden]
+    replay -n count [-l us] capture
+
+    -l us     virtual time per loop() pass, default 100
+    -o trace  write the pin trace here ("-" for stdout)
+    -u        write the trace to golden, instead of comparing
+    -n count  throughput: replay the capture count times back to back,
+              without a trace, and report how fast it ran
+
+The trace has one line per pin change: "<us after setup()> <pin> <pwm>",
+with digital writes as 0 or 255.  Runs end 2 s after the last byte.
+With a golden trace, exits 1 at the first difference.
+
+provided under LGPL license
+*/
+#include "Sketch.h"
+#include "Capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+namespace
+{
+  struct Trace
+  {
+    uint64_t t0;
+    int last[NUM_DIGITAL_PINS];
+    std::string text;
+  };
+
+  void tracePin(uint8_t pin, int pwm, void *ctx)
+  {
+    Trace &tr = *static_cast<Trace *>(ctx);
+    if (tr.last[pin] == pwm) return;
+    tr.last[pin] = pwm;
+    char line[48];
+    snprintf(line,sizeof(line),"%llu %u %d\n",(unsigned long long)(sim::now() - tr.t0),pin,pwm);
+    tr.text += line;
+  }
+
+  // replay from time offset, returns time the last byte is in, after setup()
+  uint64_t play(const sim::Capture &cap, uint64_t t0, uint64_t offset, uint32_t loopUs)
+  {
+    for (size_t k=0; k < cap.chunks.size(); k++)
+      {
+        const sim::RxChunk &c = cap.chunks[k];
+        sim::runLoop(t0 + offset + c.t,loopUs);
+        sim::rxAt(t0 + offset + c.t,(const uint8_t *)c.bytes.data(),c.bytes.size());
+      }
+    while (sim::rxPending()) sim::runLoop(sim::now() + loopUs,loopUs);
+    return(sim::now() - t0);
+  }
+
+  bool readFile(const char *path, std::string &s)
+  {
+    FILE *f = fopen(path,"r");
+    if (!f) return(false);
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf,1,sizeof(buf),f)) > 0) s.append(buf,n);
+    fclose(f);
+    return(true);
+  }
+
+  bool writeFile(const char *path, const std::string &s)
+  {
+    FILE *f = strcmp(path,"-") ? fopen(path,"w") : stdout;
+    if (!f) return(false);
+    fwrite(s.data(),1,s.size(),f);
+    return((f == stdout) || (fclose(f) == 0));
+  }
+
+  // 0 if the same.  else prints the first difference
+  int compare(const std::string &got, const std::string &want, const char *golden)
+  {
+    size_t g = 0, w = 0;
+    int line = 1;
+    while ((g < got.size()) || (w < want.size()))
+      {
+        size_t ge = got.find('\n',g), we = want.find('\n',w);
+        if (ge == std::string::npos) ge = got.size();
+        if (we == std::string::npos) we = want.size();
+        std::string gl = got.substr(g,ge-g), wl = want.substr(w,we-w);
+        if (gl != wl)
+          {
+            printf("%s:%d: trace differs\n  golden : %s\n  replay : %s\n",
+                   golden, line,
+                   wl.empty() ? "(end)" : wl.c_str(),
+                   gl.empty() ? "(end)" : gl.c_str());
+            return(1);
+          }
+        g = ge + 1;
+        w = we + 1;
+        line++;
+      }
+    return(0);
+  }
+
+  int usage()
+  {
+    fprintf(stderr,"usage: replay [-l us] [-o trace] [-u] capture [golden]\n"
+                   "       replay -n count [-l us] capture\n");
+    return(2);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t loopUs = 100;
+  const char *out = 0;
+  bool update = false;
+  long repeat = 0;
+  int opt;
+  while ((opt = getopt(argc,argv,"l:o:un:")) != -1)
+    switch(opt)
+      {
+      case 'l': loopUs = strtoul(optarg,0,10); break;
+      case 'o': out = optarg; break;
+      case 'u': update = true; break;
+      case 'n': repeat = strtol(optarg,0,10); break;
+      default: return(usage());
+      }
+  if ((optind >= argc) || (loopUs == 0)) return(usage());
+  const char *capPath = argv[optind];
+  const char *golden = (optind + 1 < argc) ? argv[optind+1] : 0;
+
+  sim::Capture cap;
+  std::string err;
+  if (!sim::captureLoad(capPath,cap,err))
+    {
+      fprintf(stderr,"%s\n",err.c_str());
+      return(2);
+    }
+
+  sim::reset();
+  sim::setTime(cap.start);
+  uint64_t t0 = sim::now();
+
+  if (repeat > 0)
+    {  // throughput
+      setup();
+      t0 = sim::now();
+      size_t bytes = 0;
+      for (size_t k=0; k < cap.chunks.size(); k++) bytes += cap.chunks[k].bytes.size();
+      std::chrono::steady_clock::time_point c0 = std::chrono::steady_clock::now();
+      uint64_t offset = 0;
+      for (long r=0; r < repeat; r++)
+        offset = play(cap,t0,offset,loopUs) + 20000;
+      double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - c0).count();
+      double virt = (sim::now() - t0) * 1e-6;
+      printf("%s x %ld : %.1f h of traffic (%zu bytes) in %.2f s, %.0fx real time, %.0f bytes/s\n",
+             capPath, repeat, virt / 3600, bytes * repeat, wall, virt / wall, bytes * repeat / wall);
+      return(0);
+    }
+
+  Trace tr;
+  tr.t0 = t0;
+  for (int i=0; i < NUM_DIGITAL_PINS; i++) tr.last[i] = -1;
+  sim::setPinHook(tracePin,&tr);
+  setup();
+  play(cap,t0,0,loopUs);
+  sim::runLoop(sim::now() + 2000000,loopUs);
+  sim::setPinHook(0,0);
+
+  if (out && !writeFile(out,tr.text))
+    {
+      perror(out);
+      return(2);
+    }
+  if (!golden) return(0);
+  if (update)
+    {
+      if (!writeFile(golden,tr.text))
+        {
+          perror(golden);
+          return(2);
+        }
+      return(0);
+    }
+  std::string want;
+  if (!readFile(golden,want))
+    {
+      perror(golden);
+      return(2);
+    }
+  int rc = compare(tr.text,want,golden);
+  printf("%s: %s\n", rc ? "FAIL" : "ok  ", capPath);
+  return(rc);
+}
@@ -0,0 +1,119 @@
+/*
+Check the interrupt-driven command path (COMMAND_RX_ISR).
+
+Bytes are fed at line rate through the simulated USART RX interrupt
+while loop() passes are slow, as they are when the drivers block on
+Serial.print.  Checks that no byte is lost, that the newest command
+wins, that '!' stops the motors on the next pass even with a backlog
+in front of it, that a '!' in a batch drops the speeds before it but
+not those after it, and that a '!' value inside a binary frame does
+not stop them.
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#define COMMAND_RX_ISR
+#include "Sketch.h"
+#include "Check.h"
+#include <stdio.h>
+
+namespace
+{
+  void start()
+  {
+    sim::reset();
+    setup();
+    sim::runLoop(sim::now() + 4000000,100);  // wait out the power-on emergency stop
+  }
+
+  // a continuous stream of updates while each loop() pass takes slowUs
+  void lineRate(uint32_t slowUs)
+  {
+    start();
+    unsigned int over0 = CommandRx.overflows;
+    char buf[32];
+    int l = 0, r = 0;
+    for (int k=0; k < 400; k++)
+      {
+        l = 100 + k % 100;
+        r = 200 - k % 100;
+        snprintf(buf,sizeof(buf),"L%d,R%d\n",l,r);
+        sim::rx(buf);
+      }
+    while (sim::rxPending()) sim::runLoop(sim::now() + slowUs,slowUs);
+    sim::runLoop(sim::now() + 2*slowUs,slowUs);
+
+    char what[80];
+    snprintf(what,sizeof(what),"line rate, %u us loop: no overflow (%u)",
+             slowUs, CommandRx.overflows - over0);
+    check(CommandRx.overflows == over0, what);
+    check((MotL._speedCmd == l) && (MotR._speedCmd == r), "  newest L/R applied");
+  }
+
+  void emergency()
+  {
+    start();
+    sim::rx("L150,R150\n");
+    sim::runLoop(sim::now() + 200000,100);
+    check(MotL._mode == MOTOR_FWD, "running before '!'");
+
+    // a backlog of updates, then '!' while loop() is stuck in a slow pass
+    char buf[32];
+    for (int k=0; k < 10; k++)
+      {
+        snprintf(buf,sizeof(buf),"L%d,R%d\n",160+k,160+k);
+        sim::rx(buf);
+      }
+    sim::rx("!");
+    sim::advance(30000);  // everything, including '!', has arrived
+    check(CommandRx.emergency != 0, "ISR flagged '!'");
+    loop();
+    check((MotL._mode == MOTOR_STOPPING) && (MotR._mode == MOTOR_STOPPING),
+          "stopped on the next pass");
+  }
+
+  // '!' in the middle of a batch: the speeds before it are void, the
+  // ones after it are kept, for after the stop
+  void stopInBatch()
+  {
+    start();
+    sim::rx("L150,R150\n");
+    sim::runLoop(sim::now() + 200000,100);
+    sim::rx("L90,R90\n!\n");
+    sim::advance(10000);
+    loop();
+    check((MotL._mode == MOTOR_STOPPING) && (MotL._speedCmd == 0) && (MotR._speedCmd == 0),
+          "speeds before '!' in a batch dropped");
+    sim::runLoop(sim::now() + 4000000,100);
+    sim::rx("L150,R150\n");
+    sim::runLoop(sim::now() + 200000,100);
+    sim::rx("L90,R90\n!\nL40,R-40\n");
+    sim::advance(10000);
+    loop();
+    check((MotL._mode == MOTOR_STOPPING) && (MotL._speedCmd == 40) && (MotR._speedCmd == -40),
+          "  speeds after it kept, for after the stop");
+  }
+
+  void bangInFrame()
+  {
+    start();
+    byte buf[COMMAND_FRAME_LEN];
+    commandEncodeDrive(buf,'!','!');  // 33 == '!'
+    sim::rx(buf,sizeof(buf));
+    sim::advance(5000);
+    check(CommandRx.emergency == 0, "'!' inside a binary frame ignored");
+    loop();
+    check((MotL._speedCmd == '!') && (MotR._speedCmd == '!'), "  frame applied");
+  }
+}
+
+int main()
+{
+  lineRate(2000);
+  lineRate(15000);  // longer than the core's 64 byte buffer lasts at 57600
+  emergency();
+  stopInBatch();
+  bangInFrame();
+  return(nFail ? 1 : 0);
+}
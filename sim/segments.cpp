@@ -0,0 +1,185 @@
+/*
+Check the timed setpoint queue (SEGMENT_QUEUE, see ../Segments.h).
+
+Runs the sketch with a script of speed segments, sent over a link with
+up to 200 ms of jitter:
+
+  - streamed ahead as segments, every speed change comes on schedule,
+    to the ms, however late its bytes were; sent live as 'L'/'R' at
+    the same times, the changes carry the link's jitter
+  - a segment longer than the deadman timeout runs to its end with no
+    traffic on the link
+  - when the queue runs dry the last speeds hold, and the deadman
+    stops the motors its timeout after
+  - a live command, or '!', flushes the queue and takes over
+  - 'q' reports the depth, and a segment that does not fit is reported
+    and dropped
+  - binary segment frames queue the same as ASCII
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#define SEGMENT_QUEUE 8
+#include "Sketch.h"
+#include "Check.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace
+{
+  const uint32_t LoopUs = 20;
+  const uint8_t  PwmL = 11;     // MotL's PWM input (WTH3615D)
+
+  sim::PinEdges Edges(PwmL);  // MotL PWM pin changes
+
+  struct Seg { int speed; uint32_t ms; };
+  // all forward, so each change is a PWM change on the same pin
+  const Seg Script[] = { {150,500}, {80,400}, {200,300}, {120,600}, {60,200}, {180,300} };
+  const int NSeg = sizeof(Script) / sizeof(Script[0]);
+
+  uint32_t jitter() { return(rand() % 200000); }
+
+  // worst error, us, of the speed changes after the first from
+  // their times in the script, counted from start
+  uint64_t worstError(uint64_t start)
+  {
+    uint64_t worst = 0, at = start;
+    for (int k=1; k < NSeg; k++)
+      {
+        at += Script[k-1].ms * 1000ULL;
+        uint64_t e = Edges.at(Script[k].speed,at - 1000);
+        uint64_t err = e ? ((e > at) ? e - at : at - e) : 1000000;
+        if (err > worst) worst = err;
+      }
+    return(worst);
+  }
+
+  void settle()
+  {  // out of any emergency stop, motors stopped
+    sim::rx("!\n");
+    sim::runLoop(sim::now() + 4000000,LoopUs);
+  }
+}
+
+int main()
+{
+  char what[140];
+  srand(1);
+  sim::reset();
+  sim::setPinHook(sim::PinEdges::hook,&Edges);
+  setup();
+  sim::runLoop(4000000,LoopUs);  // power-on emergency stop
+
+  // live: each change sent at its time in the script, late by the jitter,
+  // and repeated every 100 ms, as the app does
+  uint64_t t0 = sim::now() + 100000, at = t0;
+  for (int k=0; k < NSeg; k++)
+    {
+      char cmd[32];
+      snprintf(cmd,sizeof(cmd),"L%d,R%d\n",Script[k].speed,Script[k].speed);
+      for (uint32_t dt=0; dt < Script[k].ms; dt += 100)
+        {
+          sim::runLoop(at + dt * 1000ULL + jitter(),LoopUs);
+          sim::rx(cmd);
+        }
+      at += Script[k].ms * 1000ULL;
+    }
+  sim::runLoop(at + 100000,LoopUs);
+  uint64_t liveErr = worstError(t0);
+  settle();
+
+  // queued: each segment sent 300 ms ahead of its time, plus the jitter.
+  // Timing counts from the first segment's kick
+  Edges.clear();
+  t0 = sim::now() + 100000;
+  at = t0;
+  uint64_t sent = 0;
+  for (int k=0; k < NSeg; k++)
+    {
+      char cmd[40];
+      snprintf(cmd,sizeof(cmd),"J%d,K%d,Q%u\n",Script[k].speed,Script[k].speed,Script[k].ms);
+      uint64_t when = (k ? at - 300000 : at) + jitter();
+      if (when < sent) when = sent;
+      sim::runLoop(when,LoopUs);
+      sim::rx(cmd);
+      sent = when;
+      at += Script[k].ms * 1000ULL;
+    }
+  sim::runLoop(at - 100000,LoopUs);
+  uint64_t start = Edges.at(255,t0);
+  uint64_t queueErr = worstError(start);
+  snprintf(what,sizeof(what),"queued: speed changes within %lu us of the script (live, with the link's jitter: %lu us)",
+           (unsigned long)queueErr, (unsigned long)liveErr);
+  check(start && (queueErr <= 1000) && (liveErr > 50000), what);
+
+  // ran dry: the last speed holds, then the deadman
+  uint64_t end = start;
+  for (int k=0; k < NSeg; k++) end += Script[k].ms * 1000ULL;
+  size_t tx0 = sim::tx().size();
+  sim::runLoop(end + 2000000,LoopUs);
+  uint64_t dead = Edges.at(0,end - 1000);
+  snprintf(what,sizeof(what),"dry: speed holds, deadman brakes %lu ms after the end (%d ms, plus up to 2 ms)",
+           (unsigned long)((dead - end) / 1000), MotL._deadTime);
+  check(dead && (dead >= end + MotL._deadTime * 1000ULL) &&
+        (dead <= end + MotL._deadTime * 1000ULL + 2000), what);
+  int m, v;
+  check(sim::telemetry(tx0,TEL_QUEUE_DRY,sim::ANY_MOTOR,v,&m), "  queue-dry reported");
+  settle();
+
+  // one segment much longer than the deadman, no traffic
+  Edges.clear();
+  sim::rx("J100,K100,Q3000\n");
+  uint64_t s0 = sim::now();
+  sim::runLoop(s0 + 2500000,LoopUs);
+  check((Edges.at(100,s0) != 0) && (Edges.at(0,s0) == 0) && (sim::pinPWM(PwmL) == 100),
+        "3 s segment runs with a 500 ms deadman, and no traffic");
+
+  // 'q', then a live command flushes
+  sim::rx("J50,K50,Q1000\nJ70,K70,Q1000\nq\n");
+  tx0 = sim::tx().size();
+  sim::runLoop(sim::now() + 100000,LoopUs);
+  check(sim::telemetry(tx0,TEL_QUEUE,sim::ANY_MOTOR,v,&m) && (m == 3) && (v > 2300) && (v < 2500),
+        "'q': 3 segments queued, ~2.4 s");
+  sim::rx("L40,R40\n");
+  sim::runLoop(sim::now() + 2000000,LoopUs);
+  check((Segs.depth() == 0) && !Segs.running() && (Edges.at(50,s0) == 0) && (Edges.at(70,s0) == 0),
+        "live 'L'/'R' flushes the queue and takes over");
+
+  // '!' flushes too
+  settle();
+  sim::rx("J90,K90,Q2000\nJ90,K90,Q2000\n");
+  sim::runLoop(sim::now() + 300000,LoopUs);
+  sim::rx("!\n");
+  sim::runLoop(sim::now() + 100000,LoopUs);
+  check((Segs.depth() == 0) && (sim::pinPWM(PwmL) == 0) && (sim::pinDigital(7) == sim::pinDigital(8)),
+        "'!' flushes the queue, and brakes");
+
+  // full queue
+  settle();
+  tx0 = sim::tx().size();
+  for (int k=0; k <= SEGMENT_QUEUE; k++)
+    {
+      sim::rx("J30,K30,Q777\n");
+      sim::runLoop(sim::now() + 5000,LoopUs);
+    }
+  sim::runLoop(sim::now() + 20000,LoopUs);  // telemetry out
+  check((Segs.depth() == SEGMENT_QUEUE) && sim::telemetry(tx0,TEL_QUEUE_FULL,sim::ANY_MOTOR,v,&m) && (v == 777),
+        "segment past the queue's capacity dropped, and reported");
+  sim::rx("F\n");
+  sim::runLoop(sim::now() + 10000,LoopUs);
+  check(Segs.depth() == 0, "'F' flushes");
+
+  // binary
+  settle();
+  Edges.clear();
+  uint8_t f[4 * COMMAND_FRAME_LEN];
+  commandEncodeSegment(f,110,110,400);
+  commandEncodeSegment(f + 2 * COMMAND_FRAME_LEN,-90,-90,400);
+  sim::rx(f,sizeof(f));
+  s0 = sim::now();
+  sim::runLoop(s0 + 700000,LoopUs);
+  check((Edges.at(110,s0) != 0) && (sim::pinPWM(PwmL) == 90) && sim::pinDigital(7),
+        "binary segment frames: forward, then reverse");
+  return(nFail ? 1 : 0);
+}
@@ -0,0 +1,107 @@
+/*
+Check the encoder speed loop (ENCODERS, see ../SpeedControl.h) against
+the DC motor model in Plant.h, which feeds quadrature edges back on the
+encoder pins and so runs the firmware's pin change ISR.
+
+Runs the app command stream at a few battery voltages and loads, and
+checks the wheel speed settles near the setpoint, where open loop PWM
+would not.  Also checks the deadman still stops the motors.
+
+Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#define ENCODERS
+#include "Sketch.h"
+#include "Plant.h"
+#include "Check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+namespace
+{
+  sim::TankPlant Plant;
+
+  // loop() passes of stepUs, with an app command every 20 ms while sending
+  void run(uint64_t untilUs, const char *cmd)
+  {
+    const uint32_t stepUs = 100;
+    while (sim::now() < untilUs)
+      {
+        if (cmd && (sim::now() % 20000 == 0)) sim::rx(cmd);
+        loop();
+        sim::advance(stepUs);
+      }
+  }
+
+  void start(double battery, double load)
+  {
+    sim::reset();
+    setup();
+    sim::MotorParams mp;
+    mp.load = load;
+    Plant.vbat = 12 * battery;
+    Plant.attach(sim::sketchPinsL(sim::BRIDGE_WTH3615D),sim::sketchPinsR(sim::BRIDGE_WTH3615D),mp);
+    run(4000000,0);  // wait out the power-on emergency stop
+  }
+
+  // mean wheel speed over the last 500 ms of a 2 s run
+  void settle(int cmd, double battery, double load)
+  {
+    start(battery,load);
+    char buf[32];
+    snprintf(buf,sizeof(buf),"L%d,R%d\n",cmd,-cmd);
+    run(sim::now() + 1500000,buf);
+    long e0l = Plant.left.edges, e0r = Plant.right.edges;
+    run(sim::now() + 500000,buf);
+    double vl = (Plant.left.edges - e0l) / 0.5, vr = (Plant.right.edges - e0r) / 0.5;
+    double sp = cmd * ENCODER_CPS;
+
+    char what[120];
+    snprintf(what,sizeof(what),
+             "setpoint %5.0f counts/s, battery %3.0f%%, load %.3f N m: L %6.0f  R %6.0f  (PWM %d)",
+             sp, battery*100, load, vl, vr, DriveL._pwm);
+    check((fabs(vl - sp) < 0.03 * sp) && (fabs(vr + sp) < 0.03 * sp), what);
+  }
+
+  void deadman()
+  {
+    start(1.0,0);
+    run(sim::now() + 500000,"L100,R100\n");
+    bool moving = (MotL._mode == MOTOR_FWD) && (Plant.left.edges > 0);
+    run(sim::now() + 1000000,0);  // app goes quiet
+    check(moving && (MotL._mode == MOTOR_STOPPING) && (MotR._mode == MOTOR_STOPPING),
+          "deadman: stopped when commands stop");
+  }
+
+  void cost()
+  {
+    start(1.0,0);
+    run(sim::now() + 500000,"L100,R100\n");
+    Plant.detach();
+    const int n = 1000000;
+    unsigned long t = millis();
+    std::chrono::steady_clock::time_point c0 = std::chrono::steady_clock::now();
+    for (int k=0; k < n; k++)
+      {
+        t++;
+        if ((k & 255) == 0) DriveL.setSpeed(800,t);  // keep the deadman fed
+        DriveL.update(t);
+      }
+    double ns = std::chrono::duration<double>(std::chrono::steady_clock::now() - c0).count() * 1e9 / n;
+    printf("speed loop update : %.1f ns/call (host)\n", ns);
+  }
+}
+
+int main()
+{
+  settle(100,1.0,0);
+  settle(100,0.75,0);
+  settle(100,1.0,0.02);
+  settle(200,0.85,0.01);
+  settle(30,1.0,0.005);
+  deadman();
+  cost();
+  return(nFail ? 1 : 0);
+}
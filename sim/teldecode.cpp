@@ -0,0 +1,21 @@
+/*
+Decode a captured telemetry stream from stdin into text on stdout.
+
+    teldecode < capture.bin
+
+provided under LGPL license
+*/
+#include "Arduino.h"
+#include "TelemetryDecode.h"
+#include <iostream>
+#include <iterator>
+
+void loop() {}
+
+int main()
+{
+  std::string in((std::istreambuf_iterator<char>(std::cin)),
+                 std::istreambuf_iterator<char>());
+  fputs(telemetryDecode(in).c_str(),stdout);
+  return(0);
+}
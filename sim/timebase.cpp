@@ -0,0 +1,152 @@
+/*
+Check the motor timebase across the clock wraps (MOTOR_MICROS, see
+../Deadline.h and ../MotorDriveCore.h).
+
+Runs the sketch with its motors on micros(), from 6 s before the point
+where millis() and micros() both wrap:
+
+  - a start pulse before the wrap, a brake before a reversal that
+    straddles it, and the start pulse after it, last as long as they
+    do anywhere else
+  - the deadman still stops the motors after the wrap
+  - the scheduler keeps its rate through the wrap: every heartbeat
+    toggle 800 ms after the one before, no task late or skipped
+  - a driver on its own takes a sub-ms start pulse (setStartPulseUs()),
+    right across a micros() wrap
+
+captures/clock_wrap.cap replays the same wrap with the motors on
+millis().  Exits non-zero on failure.
+
+provided under LGPL license
+*/
+#define MOTOR_MICROS
+#include "Sketch.h"
+#include "Check.h"
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+  const uint32_t LoopUs = 20;   // virtual cost of one loop() pass
+  const uint8_t  PwmL = 11;     // MotL's PWM input (WTH3615D)
+  const uint64_t Wrap = ((uint64_t)1 << 32) * 1000;  // us, both clocks wrap
+
+  sim::PinEdges Edges(PwmL);  // MotL PWM pin changes
+  std::vector<uint64_t> Beats;  // heartbeat LED toggles
+
+  void watch(uint8_t pin, int pwm, void *)
+  {
+    Edges.log(pin,pwm);
+    if (pin == 13) Beats.push_back(sim::now());
+  }
+
+  // send cmd every 20 ms from t until before end.  returns when the last one was sent
+  uint64_t send(const char *cmd, uint64_t t, uint64_t end)
+  {
+    uint64_t last = t;
+    for (; t < end; t += 20000)
+      {
+        sim::runLoop(t,LoopUs);
+        sim::rx(cmd);
+        last = t;
+      }
+    return(last);
+  }
+
+  bool near(uint64_t a, uint64_t b, uint64_t tol) { return((a >= b) && (a <= b + tol)); }
+
+  // a lone driver: pulse length of a setStartPulseUs(us) kick, started
+  // early us before a micros() wrap, with update() every 10 us
+  uint64_t subMsKick(unsigned long us, uint32_t early)
+  {
+    L298Drive<> M(0.5f);
+    M.begin(10,14,15);
+    M.setStartPulseUs(us);
+    for (int k=0; k < 4000; k++)
+      {  // out of begin()'s emergency stop
+        sim::advance(1000);
+        M.update(micros());
+      }
+    sim::setTime((sim::now() >> 32 << 32) + ((uint64_t)1 << 32) - early);
+    M.setSpeed(150,micros());
+    uint64_t t0 = sim::now();
+    if (sim::pinPWM(10) != 255) return(0);
+    while ((sim::pinPWM(10) == 255) && (sim::now() - t0 < 10000))
+      {
+        sim::advance(10);
+        M.update(micros());
+      }
+    return(sim::now() - t0);
+  }
+}
+
+int main()
+{
+  char what[120];
+  sim::reset();
+  sim::setTime(Wrap - 6000000);
+  sim::setPinHook(watch,0);
+  setup();
+  uint32_t lineUs = 10 * sim::byteTime();  // "L150,R150\n"
+
+  // from stop: start pulse, then running
+  uint64_t c0 = Wrap - 2000000;
+  send("L150,R150\n",c0,Wrap - 50000);
+  uint64_t kick = Edges.at(255,c0), run = Edges.at(150,c0);
+  snprintf(what,sizeof(what),"start pulse %lu us before the wrap (50 ms, plus up to 2 ms)",
+           (unsigned long)(run - kick));
+  check(kick && run && near(run - kick,50000,2000), what);
+
+  // reverse 50 ms before the wrap: the brake straddles it
+  unsigned int stopMs = (150UL * MotL._decel) >> 8;
+  uint64_t r0 = Wrap - 50000;
+  uint64_t last = send("L-150,R150\n",r0,Wrap + 1000000);
+  uint64_t brake = Edges.at(0,r0), rekick = Edges.at(255,r0), rerun = Edges.at(150,r0);
+  snprintf(what,sizeof(what),"reverse: restart %lu us after the brake (%u ms stopping time, plus up to 2 ms)",
+           (unsigned long)(rekick - brake), stopMs);
+  check(brake && rekick && (brake < Wrap) && (rekick > Wrap) &&
+        near(rekick - brake,stopMs * 1000UL,2000), what);
+  snprintf(what,sizeof(what),"  start pulse %lu us, after the wrap",(unsigned long)(rerun - rekick));
+  check(rerun && near(rerun - rekick,50000,2000), what);
+  check(Edges.at(0,rerun) == 0, "  then runs on, while commands come");
+
+  // the app goes quiet: deadman
+  sim::runLoop(last + 2000000,LoopUs);
+  uint64_t dead = Edges.at(0,last);
+  uint64_t lastIn = last + lineUs;
+  snprintf(what,sizeof(what),"deadman after the wrap: brake %lu ms after the last command (%d ms, plus up to 2 ms)",
+           (unsigned long)((dead - lastIn) / 1000), MotL._deadTime);
+  check(dead && near(dead - lastIn,(uint64_t)MotL._deadTime * 1000,2000 + 3 * LoopUs), what);
+
+  // scheduler
+  uint64_t worst = 0;
+  int nWrap = 0;
+  for (size_t k=1; k < Beats.size(); k++)
+    {
+      uint64_t d = Beats[k] - Beats[k-1];
+      uint64_t off = (d > 800000) ? d - 800000 : 800000 - d;
+      if (off > worst) worst = off;
+      if ((Beats[k-1] < Wrap) && (Beats[k] >= Wrap)) nWrap++;
+    }
+  snprintf(what,sizeof(what),"%u heartbeats, 800 ms apart to within %lu us, through the wrap",
+           (unsigned)Beats.size(), (unsigned long)worst);
+  check((Beats.size() > 8) && (nWrap == 1) && (worst <= 2 * LoopUs), what);
+  unsigned long late = 0, over = 0;
+  for (byte i=0; i < Sched.nTask; i++)
+    {
+      if (Sched.task[i].maxLate > late) late = Sched.task[i].maxLate;
+      over += Sched.task[i].overruns;
+    }
+  snprintf(what,sizeof(what),"  no task late (worst %lu us) or skipped (%lu)",late,over);
+  check((late <= 2 * LoopUs) && (over == 0), what);
+
+  // sub-ms start pulses
+  uint64_t p = subMsKick(600,300);
+  snprintf(what,sizeof(what),"lone driver: setStartPulseUs(600) kicks for %lu us, across a micros() wrap",
+           (unsigned long)p);
+  check(near(p,600,10), what);
+  p = subMsKick(2500,1000);
+  snprintf(what,sizeof(what),"  setStartPulseUs(2500): %lu us",(unsigned long)p);
+  check(near(p,2500,10), what);
+  return(nFail ? 1 : 0);
+}